@@ -0,0 +1,144 @@
+// AST footprint and code generation locality over the synthetic workloads:
+// nodes per program, bytes per node (both the live node, list and name
+// arrays and everything the parser took from the arena), and the time and last-level cache misses of
+// lowering plus Generator::gen_prog into the Encoder. Cache misses come from
+// perf_event_open and read "n/a" where no hardware PMU is exposed. Exits
+// with failure when the arena holds more than max_overhead times the live
+// arrays, which would mean the parser is leaving dead blocks behind again.
+//
+//     g++ -std=c++20 -O2 -Isrc bench/bench_ast.cpp -o bench_ast
+//     ./bench_ast [scale] [runs]
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "tokenizer.hpp"
+#include "parser.hpp"
+#include "lower.hpp"
+#include "ir_opt.hpp"
+#include "generator.hpp"
+#include "encoder.hpp"
+#include "workload.hpp"
+
+// Hardware cache-miss counter for this thread; valid() is false when the
+// kernel or hypervisor does not provide one.
+class CacheMisses {
+    public:
+        inline CacheMisses() {
+            perf_event_attr attr {};
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+
+        inline CacheMisses(const CacheMisses& other) = delete;
+        inline CacheMisses operator = (const CacheMisses& other) = delete;
+
+        inline ~CacheMisses() {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        [[nodiscard]] inline bool valid() const {
+            return fd >= 0;
+        }
+
+        inline void start() {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+
+        inline uint64_t stop() {
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            uint64_t value = 0;
+            if (read(fd, &value, sizeof(value)) != sizeof(value)) {
+                return 0;
+            }
+            return value;
+        }
+
+    private:
+        int fd;
+};
+
+static constexpr double max_overhead = 1.1;
+
+int main(int argc, char* argv[]) {
+    const size_t scale = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1;
+    const int runs = argc > 2 ? std::atoi(argv[2]) : 7;
+    CacheMisses misses;
+    int status = EXIT_SUCCESS;
+
+    std::cout << std::left << std::setw(14) << "workload" << std::right << std::setw(10) << "nodes"
+              << std::setw(12) << "live B/node" << std::setw(13) << "arena B/node"
+              << std::setw(12) << "codegen ms" << std::setw(14) << "misses/node" << '\n';
+    // Same sizes as bench_stages.
+    const std::vector<std::pair<workload::Kind, size_t>> workloads {
+        { workload::Kind::expr_chain, 256 * 1024 },
+        { workload::Kind::nested_scopes, 2000 },
+        { workload::Kind::elif_ladder, 64 * 1024 },
+        { workload::Kind::many_lets, 128 * 1024 },
+        { workload::Kind::comment_heavy, 64 * 1024 },
+        { workload::Kind::deep_nesting, 32 * 1024 },
+    };
+    for (const auto& [kind, base_size] : workloads) {
+        const size_t size = base_size * scale;
+        const std::string source = workload::generate(kind, size);
+        Tokenizer tokenizer(source);
+        ArenaAllocator allocator;
+        Parser parser(tokenizer, allocator);
+        const Ast ast = parser.parse_prog().value();
+        const size_t nodes = ast.nodes.size();
+        const size_t live = nodes * sizeof(Node) + ast.lists.size() * sizeof(NodeId) + ast.names.size() * sizeof(std::string_view);
+
+        double best = 1e30;
+        uint64_t best_misses = UINT64_MAX;
+        for (int i = 0; i < runs; i++) {
+            Encoder encoder;
+            if (misses.valid()) {
+                misses.start();
+            }
+            const auto start = std::chrono::steady_clock::now();
+            Generator generator(Lowering(ast).lower());
+            generator.gen_prog(encoder);
+            const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (misses.valid()) {
+                best_misses = std::min(best_misses, misses.stop());
+            }
+            best = std::min(best, elapsed.count());
+        }
+
+        std::cout << std::left << std::setw(14) << workload::kind_name(kind) << std::right << std::setw(10) << nodes
+                  << std::fixed << std::setprecision(1)
+                  << std::setw(12) << static_cast<double>(live) / nodes
+                  << std::setw(13) << static_cast<double>(allocator.bytes_used()) / nodes
+                  << std::setprecision(3) << std::setw(12) << best * 1e3;
+        if (misses.valid()) {
+            std::cout << std::setw(14) << static_cast<double>(best_misses) / nodes << '\n';
+        } else {
+            std::cout << std::setw(14) << "n/a" << '\n';
+        }
+        if (static_cast<double>(allocator.bytes_used()) > static_cast<double>(live) * max_overhead) {
+            std::cerr << workload::kind_name(kind) << ": the arena holds " << allocator.bytes_used()
+                      << " bytes for " << live << " live" << std::endl;
+            status = EXIT_FAILURE;
+        }
+    }
+    return status;
+}
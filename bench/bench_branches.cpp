@@ -0,0 +1,157 @@
+// Branches in generated executables at -O0 and -O1, both without the AST
+// optimizer, which would decide most of these conditions at compile time.
+// Each program runs once under ptrace, one instruction at a time; a jmp or
+// jcc counts as taken when the next instruction is not the one after it.
+// Also reports the jumps in the code and the instructions executed.
+//
+//     g++ -std=c++20 -O2 -Isrc bench/bench_branches.cpp -o bench_branches
+//     ./bench_branches [arms]
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "driver.hpp"
+#include "workload.hpp"
+
+struct Counts {
+    uint64_t instructions = 0;
+    uint64_t branches = 0;
+    uint64_t taken = 0;
+    int status = 0;
+};
+
+// Length of the jmp or jcc whose first bytes are `bytes`, or 0.
+static size_t jump_length(uint64_t bytes) {
+    const uint8_t first = bytes & 0xff;
+    const uint8_t second = (bytes >> 8) & 0xff;
+    if (first == 0xe9) {
+        return 5;
+    }
+    if (first == 0xeb || (first >= 0x70 && first <= 0x7f)) {
+        return 2;
+    }
+    if (first == 0x0f && second >= 0x80 && second <= 0x8f) {
+        return 6;
+    }
+    return 0;
+}
+
+static Counts trace(const std::string& path) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+        ptrace(PTRACE_TRACEME, 0, nullptr, nullptr);
+        execl(path.c_str(), path.c_str(), static_cast<char*>(nullptr));
+        _exit(127);
+    }
+    Counts counts;
+    int status = 0;
+    waitpid(pid, &status, 0);
+    while (WIFSTOPPED(status)) {
+        user_regs_struct regs {};
+        ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+        const uint64_t bytes = static_cast<uint64_t>(ptrace(PTRACE_PEEKTEXT, pid, regs.rip, nullptr));
+        const size_t length = jump_length(bytes);
+        const uint64_t next = regs.rip + length;
+        ptrace(PTRACE_SINGLESTEP, pid, nullptr, nullptr);
+        waitpid(pid, &status, 0);
+        counts.instructions++;
+        if (length != 0 && WIFSTOPPED(status)) {
+            ptrace(PTRACE_GETREGS, pid, nullptr, &regs);
+            counts.branches++;
+            counts.taken += regs.rip != next;
+        }
+    }
+    counts.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    return counts;
+}
+
+// Jumps in the code, counting every instruction that starts with a jump
+// opcode. Immediates could contain those bytes too, so this only compares
+// pipelines roughly.
+static uint64_t static_jumps(const std::vector<uint8_t>& code) {
+    uint64_t jumps = 0;
+    for (size_t i = 0; i + 1 < code.size(); i++) {
+        jumps += (code[i] == 0xe9) || (code[i] == 0x0f && code[i + 1] >= 0x80 && code[i + 1] <= 0x8f);
+    }
+    return jumps;
+}
+
+static std::vector<uint8_t> compile(const std::string& src, int opt_level) {
+    Tokenizer tokenizer(src);
+    ArenaAllocator allocator;
+    Parser parser(tokenizer, allocator);
+    const Options options { .opt_level = opt_level };
+    Stats stats;
+    Generator generator(lower_prog(parser.parse_prog().value(), options, stats));
+    return encode_prog(generator, options, stats);
+}
+
+// An if/elif ladder whose arms are all false until the else, and one of
+// nested ifs that are all true, each ending in an empty arm or an else.
+static std::string ladder(size_t arms) {
+    std::string src = "let x = 7;\nlet z = x - 7;\nlet y = 0;\n";
+    for (size_t arm = 0; arm < arms; arm++) {
+        src += (arm == 0 ? "if (z * " : "} elif (z * ") + std::to_string(arm + 1) + ") {\n    y = y + 1;\n";
+    }
+    return src + "} else {\n    y = y + 2;\n}\nreturn(y);\n";
+}
+
+static std::string nested(size_t depth) {
+    std::string src = "let x = 7;\nlet y = 0;\n";
+    for (size_t i = 0; i < depth; i++) {
+        src += "if (x - " + std::to_string(i + 100) + ") {\n    y = y + 1;\n";
+    }
+    for (size_t i = 0; i < depth; i++) {
+        src += i % 2 == 0 ? "}\n" : "} else {\n}\n";
+    }
+    return src + "return(y);\n";
+}
+
+int main(int argc, char* argv[]) {
+    const size_t arms = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+    const std::string path = "/tmp/bench_branches_" + std::to_string(getpid());
+
+    struct Program {
+        std::string name;
+        std::string source;
+    };
+    const std::vector<Program> programs {
+        { "false_ladder", ladder(arms) },
+        { "true_nest", nested(arms) },
+        { "elif_ladder", workload::generate(workload::Kind::elif_ladder, arms) },
+        { "nested_scopes", workload::generate(workload::Kind::nested_scopes, arms / 4) },
+    };
+
+    std::cout << std::left << std::setw(16) << "program" << std::right << std::setw(5) << "opt"
+              << std::setw(10) << "jumps" << std::setw(12) << "executed" << std::setw(10) << "branches"
+              << std::setw(10) << "taken" << '\n';
+    for (const Program& program : programs) {
+        int status = -1;
+        for (const int opt_level : { 0, 1 }) {
+            const std::vector<uint8_t> code = compile(program.source, opt_level);
+            if (!elf::write_executable(path, code)) {
+                std::cerr << "Could not write " << path << std::endl;
+                return EXIT_FAILURE;
+            }
+            const Counts counts = trace(path);
+            if (opt_level > 0 && counts.status != status) {
+                std::cerr << program.name << " exits with " << counts.status << " at -O1 but " << status << " at -O0" << std::endl;
+                return EXIT_FAILURE;
+            }
+            status = counts.status;
+            std::cout << std::left << std::setw(16) << program.name << std::right << std::setw(4) << "-O" << opt_level
+                      << std::setw(10) << static_jumps(code) << std::setw(12) << counts.instructions
+                      << std::setw(10) << counts.branches << std::setw(10) << counts.taken << '\n';
+        }
+    }
+    unlink(path.c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,131 @@
+// Cost of calls, and what the inliner saves. Each program is lowered and
+// optimized at -O1 twice: once with every function kept and called, once
+// through the Inliner. Both are run `runs` times as machine code (JitCode)
+// and by the Interpreter; reports the best time per run, the calls left and
+// the size of the machine code. All four runs must return the same exit code.
+//
+//     g++ -std=c++20 -O2 -Isrc bench/bench_calls.cpp -o bench_calls
+//     ./bench_calls [size] [runs]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "driver.hpp"
+#include "workload.hpp"
+
+static ir::Module lower(const std::string& source, bool inline_calls) {
+    Tokenizer tokenizer(source);
+    ArenaAllocator allocator;
+    Parser parser(tokenizer, allocator);
+    ir::Module module = Lowering(parser.parse_prog().value()).lower();
+    ir::Optimizer optimizer;
+    if (inline_calls) {
+        ir::Inliner(optimizer).run(module);
+        return module;
+    }
+    optimizer.optimize(module.main);
+    for (ir::Function& fn : module.functions) {
+        optimizer.optimize(fn);
+    }
+    return module;
+}
+
+static size_t calls(const ir::Module& module) {
+    size_t count = 0;
+    const auto scan = [&count](const ir::Function& fn) {
+        count += std::count_if(fn.insts.begin(), fn.insts.end(), [](const ir::Inst& inst) {
+            return inst.op == ir::Op::call;
+        });
+    };
+    scan(module.main);
+    std::for_each(module.functions.begin(), module.functions.end(), scan);
+    return count;
+}
+
+// Recursion `size` deep through small helpers, the recursive step in a
+// plain block of the body, and a doubly recursive Fibonacci whose additions
+// go through a helper.
+static std::string walk(size_t size) {
+    return "fn sq(x) { return(x * x); }\n"
+           "fn mix(a, b, c) { return(a * 31 + b / 3 - c); }\n"
+           "fn walk(n, acc) {\n"
+           "    {\n"
+           "        let s = sq(n);\n"
+           "        if (n) { return(walk(n - 1, mix(acc, s, n))); }\n"
+           "    }\n"
+           "    return(acc);\n"
+           "}\n"
+           "return(walk(" + std::to_string(size) + ", 7));\n";
+}
+
+static std::string fib(size_t n) {
+    return "fn add(a, b) { return(a + b); }\n"
+           "fn fib(n) {\n"
+           "    if (n) {\n"
+           "        if (n - 1) { return(add(fib(n - 1), fib(n - 2))); }\n"
+           "        return(1);\n"
+           "    }\n"
+           "    return(0);\n"
+           "}\n"
+           "return(fib(" + std::to_string(n) + "));\n";
+}
+
+int main(int argc, char* argv[]) {
+    const size_t size = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+    const size_t runs = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 50;
+
+    struct Program {
+        std::string name;
+        std::string source;
+    };
+    const std::vector<Program> programs {
+        { "walk", walk(size) },
+        { "fib", fib(std::min<size_t>(size / 100 + 2, 24)) },
+    };
+
+    std::cout << std::left << std::setw(12) << "program" << std::setw(8) << "inline" << std::right
+              << std::setw(12) << "native_ns" << std::setw(12) << "interp_ns" << std::setw(8) << "calls"
+              << std::setw(12) << "code_bytes" << '\n';
+    for (const Program& program : programs) {
+        std::optional<uint64_t> expected;
+        for (const bool inline_calls : { false, true }) {
+            const ir::Module module = lower(program.source, inline_calls);
+            const Options options { .opt_level = 1, .jit = true };
+            Stats stats;
+            Generator generator(module, true);
+            const std::vector<uint8_t> code = encode_prog(generator, options, stats);
+            const JitCode jit(code);
+            if (!jit.ok()) {
+                std::cerr << "Could not map executable memory" << std::endl;
+                return EXIT_FAILURE;
+            }
+            const bytecode::Program bytecode = bytecode::Generator(module).generate();
+
+            std::optional<uint64_t> native_status;
+            std::optional<uint64_t> interp_status;
+            const double native_ns = workload::best_of(runs, [&] {
+                native_status = jit.run();
+            }) * 1e9;
+            Interpreter interpreter(bytecode);
+            const double interp_ns = workload::best_of(runs, [&] {
+                interp_status = interpreter.run();
+            }) * 1e9;
+            if (interp_status != native_status || (expected && native_status != expected)) {
+                std::cerr << program.name << ": the runs disagree" << std::endl;
+                return EXIT_FAILURE;
+            }
+            expected = native_status;
+
+            std::cout << std::left << std::setw(12) << program.name << std::setw(8) << (inline_calls ? "yes" : "no")
+                      << std::right << std::fixed << std::setprecision(0) << std::setw(12) << native_ns
+                      << std::setw(12) << interp_ns << std::setw(8) << calls(module) << std::setw(12) << code.size() << '\n';
+        }
+    }
+    return EXIT_SUCCESS;
+}
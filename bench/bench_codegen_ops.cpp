@@ -0,0 +1,132 @@
+// Static instruction and stack memory operation counts of the code Generator
+// emits for a small corpus of expression-heavy programs, before and after the
+// peephole optimizer, and how often each peephole rule fired.
+//
+//     g++ -std=c++20 -O2 -Isrc bench/bench_codegen_ops.cpp -o bench_codegen_ops
+//     ./bench_codegen_ops
+
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "tokenizer.hpp"
+#include "parser.hpp"
+#include "lower.hpp"
+#include "ir_opt.hpp"
+#include "generator.hpp"
+#include "peephole.hpp"
+
+struct Counts {
+    size_t instrs = 0;
+    size_t mem_ops = 0;
+};
+
+static Counts count(const std::string& code) {
+    Counts counts;
+    std::istringstream lines(code);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.rfind("    ", 0) != 0) {
+            continue;
+        }
+        counts.instrs++;
+        if (line.find("push") != std::string::npos || line.find("pop") != std::string::npos ||
+            line.find('[') != std::string::npos) {
+            counts.mem_ops++;
+        }
+    }
+    return counts;
+}
+
+static std::string chain(size_t n) {
+    std::string src = "let a = 1;\nlet b = 2;\n";
+    for (size_t i = 0; i < n; i++) {
+        src += "a = a + " + std::to_string(i) + " * b - (b + 3) * (a - " + std::to_string(i) + ");\n";
+    }
+    return src + "return(a);\n";
+}
+
+static std::string nested(size_t depth) {
+    std::string expr = "1";
+    for (size_t i = 0; i < depth; i++) {
+        expr = "(" + expr + " + " + std::to_string(i) + ") * (" + std::to_string(i) + " - " + expr + ")";
+        if (expr.size() > 100000) {
+            break;
+        }
+    }
+    return "let x = " + expr + ";\nreturn(x);\n";
+}
+
+static std::string lets(size_t n) {
+    std::string src = "let v0 = 7;\n";
+    for (size_t i = 1; i < n; i++) {
+        src += "let v" + std::to_string(i) + " = v" + std::to_string(i - 1) + " * 3 + " + std::to_string(i) + ";\n";
+        if (i % 3 == 0) {
+            src += "if (v" + std::to_string(i) + " - 5) { v" + std::to_string(i) + " = 1 + 2; }\n";
+        }
+    }
+    return src + "return(v0);\n";
+}
+
+// Right-nested operations on products of parameters, whose values are
+// unknown: lowered left to right, every product would stay live until the
+// innermost operation.
+static std::string right_deep(size_t depth) {
+    std::string expr = "a";
+    for (size_t i = 0; i < depth; i++) {
+        expr = std::string(1, "bcdef"[i % 5]) + " * a " + (i % 2 ? "- (" : "+ (") + expr + ")";
+    }
+    return "fn f(a, b, c, d, e, f) {\n    return(" + expr + ");\n}\nreturn(f(1, 2, 3, 4, 5, 6));\n";
+}
+
+int main() {
+    const std::vector<std::pair<std::string, std::string>> corpus {
+        { "literal", "let x = 1 + 2;\nreturn(x);\n" },
+        { "chain", chain(200) },
+        { "nested", nested(10) },
+        { "lets", lets(500) },
+        { "right_deep", right_deep(40) },
+    };
+    Counts total;
+    Counts total_peephole;
+    std::vector<uint64_t> hits(peephole::default_rules.size(), 0);
+    for (const auto& [name, src] : corpus) {
+        Tokenizer tokenizer(src);
+        ArenaAllocator allocator;
+        Parser parser(tokenizer, allocator);
+        ir::Module module = Lowering(parser.parse_prog().value()).lower();
+        ir::Optimizer().optimize(module.main);
+        for (ir::Function& fn : module.functions) {
+            ir::Optimizer().optimize(fn);
+        }
+        Generator generator(std::move(module));
+        const Counts counts = count(generator.gen_prog());
+
+        OutputBuffer buffer;
+        {
+            AsmPrinter printer(buffer);
+            peephole::Optimizer optimizer(printer);
+            generator.gen_prog(optimizer);
+            optimizer.finish();
+            for (size_t i = 0; i < hits.size(); i++) {
+                hits[i] += optimizer.hits()[i];
+            }
+        }
+        const Counts after = count(buffer.str());
+
+        total.instrs += counts.instrs;
+        total.mem_ops += counts.mem_ops;
+        total_peephole.instrs += after.instrs;
+        total_peephole.mem_ops += after.mem_ops;
+        std::cout << name << ": " << counts.instrs << " instructions, " << counts.mem_ops << " memory ops; after peephole "
+                  << after.instrs << ", " << after.mem_ops << std::endl;
+    }
+    std::cout << "total: " << total.instrs << " instructions, " << total.mem_ops << " memory ops; after peephole "
+              << total_peephole.instrs << ", " << total_peephole.mem_ops << std::endl;
+    for (size_t i = 0; i < hits.size(); i++) {
+        std::cout << "    " << peephole::default_rules[i].name << ": " << hits[i] << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,194 @@
+// Run time of generated programs made of long dependent chains of divisions
+// and multiplications: by a power of two, by other constants and by a value
+// only known at run time (a phi of two constants, so the generator has to use
+// div or a register imul). Each program is compiled without the AST
+// optimizer, which would fold the whole chain.
+//
+// "cold" runs the program as a fresh executable `runs` times and reports the
+// best wall time minus that of an empty program. Every instruction executes
+// once, so this is mostly instruction fetch and favours short code. "hot"
+// copies the code into an executable mapping between a prologue and an
+// epilogue that stand in for the exit syscall, and reports the best of `runs`
+// in-process calls with the code already in cache.
+//
+//     g++ -std=c++20 -O2 -Isrc bench/bench_div.cpp -o bench_div
+//     ./bench_div [operations] [runs]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "tokenizer.hpp"
+#include "parser.hpp"
+#include "lower.hpp"
+#include "ir_opt.hpp"
+#include "generator.hpp"
+#include "encoder.hpp"
+#include "elf.hpp"
+#include "workload.hpp"
+
+// `ops` statements `x = x <op> k + c;`, cycling through `operands`. With
+// `opaque` every k is replaced by a variable that holds it on one side of an
+// if and something else on the other.
+static std::string make_source(size_t ops, char op, const std::vector<std::string>& operands, bool opaque) {
+    std::string src = "let x = 18446744073709551557;\nlet s = x - 1;\n";
+    std::vector<std::string> names;
+    for (size_t i = 0; i < operands.size(); i++) {
+        names.push_back(opaque ? "k" + std::to_string(i) : operands[i]);
+        if (opaque) {
+            src += "let k" + std::to_string(i) + " = 1;\nif (s) {\n    k" + std::to_string(i) + " = " + operands[i] + ";\n}\n";
+        }
+    }
+    for (size_t i = 0; i < ops; i++) {
+        src += std::string("x = x ") + op + " " + names[i % names.size()] + " + 1234567891;\n";
+    }
+    return src + "return(x);\n";
+}
+
+static double run_best(const std::string& path, int runs) {
+    double best = 1e30;
+    for (int i = 0; i < runs; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        const pid_t pid = fork();
+        if (pid == 0) {
+            execl(path.c_str(), path.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        int status = 0;
+        waitpid(pid, &status, 0);
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+            std::cerr << path << " did not run" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+// Generated code ends in `mov rdi, status; mov rax, 60; syscall`. The
+// prologue saves the callee-saved registers and rsp (the code may move it for
+// spill slots) and falls into the code, whose final syscall is replaced by an
+// epilogue that restores them and returns the status.
+class HotCode {
+    public:
+        inline explicit HotCode(const std::vector<uint8_t>& code) {
+            std::vector<uint8_t> bytes {
+                0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,  // push rbx, rbp, r12-r15
+            };
+            mov_saved_address(bytes);
+            bytes.insert(bytes.end(), { 0x48, 0x89, 0x20 });                   // mov [rax], rsp
+            bytes.insert(bytes.end(), code.begin(), code.end() - 2);
+            mov_saved_address(bytes);
+            bytes.insert(bytes.end(), {
+                0x48, 0x8b, 0x20,                                              // mov rsp, [rax]
+                0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41, 0x5c, 0x5d, 0x5b,    // pop r15-r12, rbp, rbx
+                0x48, 0x89, 0xf8,                                              // mov rax, rdi
+                0xc3,                                                          // ret
+            });
+            size = bytes.size();
+            void* mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) {
+                std::cerr << "mmap failed" << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            std::copy(bytes.begin(), bytes.end(), static_cast<uint8_t*>(mem));
+            mprotect(mem, size, PROT_READ | PROT_EXEC);
+            entry = mem;
+        }
+
+        inline HotCode(const HotCode& other) = delete;
+        inline HotCode operator = (const HotCode& other) = delete;
+
+        inline ~HotCode() {
+            munmap(entry, size);
+        }
+
+        inline uint64_t operator () () const {
+            return reinterpret_cast<uint64_t (*)()>(entry)();
+        }
+
+    private:
+        // mov rax, &saved_rsp
+        inline void mov_saved_address(std::vector<uint8_t>& bytes) {
+            const uint64_t address = reinterpret_cast<uint64_t>(&saved_rsp);
+            bytes.insert(bytes.end(), { 0x48, 0xb8 });
+            for (int i = 0; i < 8; i++) {
+                bytes.push_back(static_cast<uint8_t>(address >> (i * 8)));
+            }
+        }
+
+        void* entry = nullptr;
+        size_t size = 0;
+        uint64_t saved_rsp = 0;
+};
+
+static std::vector<uint8_t> compile(const std::string& src) {
+    Tokenizer tokenizer(src);
+    ArenaAllocator allocator;
+    Parser parser(tokenizer, allocator);
+    ir::Function fn = Lowering(parser.parse_prog().value()).lower().main;
+    ir::Optimizer().optimize(fn);
+    Encoder encoder;
+    Generator(std::move(fn)).gen_prog(encoder);
+    return encoder.finish();
+}
+
+int main(int argc, char* argv[]) {
+    const size_t ops = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+    const int runs = argc > 2 ? std::atoi(argv[2]) : 31;
+    const std::string path = "/tmp/bench_div_" + std::to_string(getpid());
+
+    struct Program {
+        std::string name;
+        char op;
+        std::vector<std::string> operands;
+        bool opaque;
+    };
+    const std::vector<std::string> odd { "3", "7", "10", "641", "1000003" };
+    const std::vector<Program> programs {
+        { "div_pow2", '/', { "2", "8", "64" }, false },
+        { "div_const", '/', odd, false },
+        { "div_runtime", '/', odd, true },
+        { "mul_pow2", '*', { "2", "8", "64" }, false },
+        { "mul_const", '*', odd, false },
+        { "mul_runtime", '*', odd, true },
+    };
+
+    if (!elf::write_executable(path, compile("return(0);\n"))) {
+        std::cerr << "Could not write " << path << std::endl;
+        return EXIT_FAILURE;
+    }
+    const double empty = run_best(path, runs);
+
+    std::cout << std::left << std::setw(14) << "program" << std::right << std::setw(12) << "code KB"
+              << std::setw(14) << "cold ns/op" << std::setw(13) << "hot ns/op" << '\n';
+    for (const Program& program : programs) {
+        const std::vector<uint8_t> code = compile(make_source(ops, program.op, program.operands, program.opaque));
+        if (!elf::write_executable(path, code)) {
+            std::cerr << "Could not write " << path << std::endl;
+            return EXIT_FAILURE;
+        }
+        const double cold = run_best(path, runs) - empty;
+        const HotCode hot_code(code);
+        uint64_t status = 0;
+        const double hot = workload::best_of(runs, [&] {
+            status = hot_code();
+        });
+        static_cast<void>(status);
+        std::cout << std::left << std::setw(14) << program.name << std::right << std::fixed
+                  << std::setprecision(1) << std::setw(12) << static_cast<double>(code.size()) / 1024
+                  << std::setprecision(2) << std::setw(14) << cold * 1e9 / static_cast<double>(ops)
+                  << std::setw(13) << hot * 1e9 / static_cast<double>(ops) << '\n';
+    }
+    unlink(path.c_str());
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,88 @@
+// Assembly emission throughput: the whole Generator pass over a large program,
+// reported as MB of nasm text produced per second, once into an in-memory
+// buffer and once streamed to a file descriptor (default /dev/null). The last
+// line times AsmPrinter alone over a recorded instruction stream.
+//
+//     g++ -std=c++20 -O2 -Isrc bench/bench_emit.cpp -o bench_emit
+//     ./bench_emit [statements] [output path]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "tokenizer.hpp"
+#include "parser.hpp"
+#include "lower.hpp"
+#include "ir_opt.hpp"
+#include "generator.hpp"
+#include "workload.hpp"
+
+static std::string make_source(size_t stmts) {
+    std::string src = "let a = 1;\nlet b = 2;\n";
+    for (size_t i = 0; i < stmts; i++) {
+        const std::string v = "v" + std::to_string(i);
+        src += "{\n    let " + v + " = (a + " + std::to_string(i) + ") * b - a * (b + 3);\n";
+        src += "    if (" + v + ") {\n        a = " + v + " + b;\n    } else {\n        b = a - " + v + ";\n    }\n}\n";
+    }
+    src += "return(a);\n";
+    return src;
+}
+
+struct Recorder : AsmSink {
+    std::vector<Instr> instrs;
+    void emit(const Instr& instr) override {
+        instrs.push_back(instr);
+    }
+};
+
+int main(int argc, char* argv[]) {
+    const size_t stmts = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+    const char* path = argc > 2 ? argv[2] : "/dev/null";
+
+    Tokenizer tokenizer(make_source(stmts));
+    ArenaAllocator allocator;
+    Parser parser(tokenizer, allocator);
+    const ir::Function prog = Lowering(parser.parse_prog().value()).lower().main;
+
+    size_t bytes = 0;
+    const double in_memory = workload::best_of(5, [&] {
+        Generator generator(prog);
+        bytes = generator.gen_prog().size();
+    });
+
+    const double streamed = workload::best_of(5, [&] {
+        const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            std::cerr << "Could not open " << path << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        OutputBuffer buffer(fd);
+        AsmPrinter printer(buffer);
+        Generator generator(prog);
+        generator.gen_prog(printer);
+        buffer.flush();
+        close(fd);
+    });
+
+    Recorder recorder;
+    Generator(prog).gen_prog(recorder);
+    const double formatting = workload::best_of(5, [&] {
+        OutputBuffer buffer;
+        AsmPrinter printer(buffer);
+        for (const Instr& instr : recorder.instrs) {
+            printer.emit(instr);
+        }
+    });
+
+    const double mb = static_cast<double>(bytes) / (1024 * 1024);
+    std::cout << "asm size:  " << mb << " MB" << std::endl;
+    std::cout << "in memory: " << in_memory * 1e3 << " ms, " << mb / in_memory << " MB/s" << std::endl;
+    std::cout << "streamed:  " << streamed * 1e3 << " ms, " << mb / streamed << " MB/s" << std::endl;
+    std::cout << "printer:   " << formatting * 1e3 << " ms, " << mb / formatting << " MB/s" << std::endl;
+    return EXIT_SUCCESS;
+}
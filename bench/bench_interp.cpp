@@ -0,0 +1,76 @@
+// Cost of interpreting bytecode instead of running native code. Each workload
+// is compiled at -O1 without the AST optimizer, which would fold most of it
+// to a constant, and then run `runs` times three ways: as machine code in
+// an executable mapping (JitCode), by the Interpreter, and by the Interpreter
+// on bytecode generated without superinstructions. Reports the best time per
+// run of each, how much slower the interpreter is, and the size of the
+// machine code and of the bytecode. All three must return the same exit code.
+//
+//     g++ -std=c++20 -O2 -Isrc bench/bench_interp.cpp -o bench_interp
+//     ./bench_interp [size] [runs]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "driver.hpp"
+#include "workload.hpp"
+
+int main(int argc, char* argv[]) {
+    const size_t size = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+    const size_t runs = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200;
+
+    std::cout << std::left << std::setw(16) << "program" << std::right << std::setw(12) << "native_ns"
+              << std::setw(12) << "interp_ns" << std::setw(12) << "plain_ns" << std::setw(9) << "slower"
+              << std::setw(12) << "code_bytes" << std::setw(12) << "bc_bytes" << std::setw(12) << "plain_bytes" << '\n';
+    for (const workload::Kind kind : workload::kinds) {
+        const std::string source = workload::generate(kind, size);
+        Tokenizer tokenizer(source);
+        ArenaAllocator allocator;
+        Parser parser(tokenizer, allocator);
+        const Options options { .opt_level = 1, .jit = true };
+        Stats stats;
+        const ir::Module module = lower_prog(parser.parse_prog().value(), options, stats);
+
+        Generator generator(module, true);
+        const std::vector<uint8_t> code = encode_prog(generator, options, stats);
+        const JitCode jit(code);
+        const bytecode::Program program = bytecode::Generator(module).generate();
+        const bytecode::Program plain = bytecode::Generator(module, false).generate();
+        if (!jit.ok()) {
+            std::cerr << "Could not map executable memory" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::optional<uint64_t> native_status;
+        std::optional<uint64_t> interp_status;
+        std::optional<uint64_t> plain_status;
+        const double native_ns = workload::best_of(runs, [&] {
+            native_status = jit.run();
+        }) * 1e9;
+        Interpreter interpreter(program);
+        const double interp_ns = workload::best_of(runs, [&] {
+            interp_status = interpreter.run();
+        }) * 1e9;
+        Interpreter plain_interpreter(plain);
+        const double plain_ns = workload::best_of(runs, [&] {
+            plain_status = plain_interpreter.run();
+        }) * 1e9;
+        if (interp_status != native_status || plain_status != native_status) {
+            std::cerr << workload::kind_name(kind) << ": the interpreter and native code disagree" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        std::cout << std::left << std::setw(16) << workload::kind_name(kind) << std::right << std::fixed
+                  << std::setprecision(0) << std::setw(12) << native_ns << std::setw(12) << interp_ns
+                  << std::setw(12) << plain_ns << std::setprecision(1) << std::setw(8) << interp_ns / native_ns << 'x'
+                  << std::setw(12) << code.size() << std::setw(12) << program.code.size() * 4
+                  << std::setw(12) << plain.code.size() * 4 << '\n';
+    }
+    return EXIT_SUCCESS;
+}
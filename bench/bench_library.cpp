@@ -0,0 +1,172 @@
+// Throughput of compile() on small programs: calls per second on one thread
+// and on `threads` threads sharing nothing but the sources, checking that
+// every call returns the same code, and of compiling with Options::jit and
+// running each program in this process. Given the path of a built `main`,
+// also times testing each program the old way, compiling it to an executable
+// and running that, and with `main --run`; both pay process startup every
+// time, and all three must agree on every exit code.
+//
+//     g++ -std=c++20 -O2 -Isrc bench/bench_library.cpp -o bench_library -lpthread
+//     ./bench_library [programs] [threads] [path/to/main]
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "compiler.hpp"
+#include "jit.hpp"
+#include "workload.hpp"
+
+// Compiles every source `rounds` times on each of `threads` threads and
+// returns the wall time, or a negative value when some result differs from
+// `expected`.
+static double run_threads(const std::vector<std::string>& sources, const std::vector<Result>& expected,
+                          size_t threads, size_t rounds) {
+    std::vector<int> mismatches(threads, 0);
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            for (size_t round = 0; round < rounds; round++) {
+                for (size_t i = 0; i < sources.size(); i++) {
+                    const Result result = compile(sources[i]);
+                    mismatches[t] += !result.ok() || result.code != expected[i].code;
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    for (const int count : mismatches) {
+        if (count != 0) {
+            return -1;
+        }
+    }
+    return elapsed.count();
+}
+
+// Compiles and runs every source `rounds` times in this process, checking
+// the exit codes against `statuses`.
+static double run_jit(const std::vector<std::string>& sources, const std::vector<int>& statuses, size_t rounds) {
+    const Options options { .jit = true };
+    int mismatches = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < sources.size(); i++) {
+            const Result result = compile(sources[i], options);
+            const JitCode jit(result.code);
+            mismatches += !jit.ok() || static_cast<int>(jit.run() & 0xff) != statuses[i];
+        }
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return mismatches == 0 ? elapsed.count() : -1;
+}
+
+// Runs `path` with `args` in `dir` and returns its exit status, or -1.
+static int spawn(const std::string& dir, const std::string& path, const std::vector<std::string>& args) {
+    const pid_t pid = fork();
+    if (pid == 0) {
+        std::vector<char*> argv { const_cast<char*>(path.c_str()) };
+        for (const std::string& arg : args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        if (chdir(dir.c_str()) == 0) {
+            execv(path.c_str(), argv.data());
+        }
+        _exit(127);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Tests every program with one `main` process each: with `run`, through
+// `main --run`, otherwise by writing an executable and running it. Fills in
+// `statuses` when it is empty and checks against it otherwise.
+static double run_processes(const std::string& main_path, const std::vector<std::string>& sources, bool run,
+                            std::vector<int>& statuses) {
+    const std::string dir = "/tmp/bench_library_" + std::to_string(getpid());
+    const std::string input = dir + "/input.ps";
+    const std::string work = dir + "/work";
+    if (system(("mkdir -p " + work).c_str()) != 0) {
+        return -1;
+    }
+    const bool record = statuses.empty();
+    double total = 0;
+    for (size_t i = 0; i < sources.size(); i++) {
+        std::ofstream(input) << sources[i];
+        const auto start = std::chrono::steady_clock::now();
+        int status = -1;
+        if (run) {
+            status = spawn(work, main_path, { "--run", input });
+        } else if (spawn(work, main_path, { "--output=program", input }) == 0) {
+            status = spawn(work, work + "/program", {});
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (status < 0) {
+            return -1;
+        }
+        if (record) {
+            statuses.push_back(status);
+        } else if (statuses[i] != status) {
+            return -1;
+        }
+        total += elapsed.count();
+    }
+    static_cast<void>(system(("rm -rf " + dir).c_str()));
+    return total;
+}
+
+int main(int argc, char* argv[]) {
+    const size_t programs = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200;
+    const size_t threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : std::max(2u, std::thread::hardware_concurrency());
+    const std::string main_path = argc > 3 ? argv[3] : "";
+
+    std::vector<std::string> sources;
+    std::vector<Result> expected;
+    for (size_t i = 0; i < programs; i++) {
+        const workload::Kind kind = workload::kinds[i % workload::kinds.size()];
+        sources.push_back(workload::generate(kind, 64, i));
+        expected.push_back(compile(sources.back()));
+        if (!expected.back().ok()) {
+            std::cerr << "program " << i << ": " << expected.back().diagnostics[0].message << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    std::cout << std::left << std::setw(22) << "mode" << std::right << std::setw(14) << "programs/s" << '\n';
+    const auto report = [&](const std::string& mode, double seconds, size_t compiles) {
+        if (seconds < 0) {
+            std::cerr << mode << ": results differ or a compile failed" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        std::cout << std::left << std::setw(22) << mode << std::right << std::fixed << std::setprecision(0)
+                  << std::setw(14) << static_cast<double>(compiles) / seconds << '\n';
+    };
+    const size_t rounds = 5;
+    report("compile() x1", run_threads(sources, expected, 1, rounds), programs * rounds);
+    report("compile() x" + std::to_string(threads), run_threads(sources, expected, threads, rounds), programs * rounds * threads);
+    std::vector<int> statuses;
+    if (!main_path.empty()) {
+        report("main + executable", run_processes(main_path, sources, false, statuses), programs);
+        report("main --run", run_processes(main_path, sources, true, statuses), programs);
+    } else {
+        for (const std::string& source : sources) {
+            const JitCode jit(compile(source, { .jit = true }).code);
+            statuses.push_back(jit.ok() ? static_cast<int>(jit.run() & 0xff) : -1);
+        }
+    }
+    report("compile() + run", run_jit(sources, statuses, rounds), programs * rounds);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,124 @@
+// Per-stage compile times over every synthetic workload: Tokenizer::tokenize,
+// Parser::parse_prog (which lexes as it goes), lowering plus Generator::gen_prog
+// to nasm text, the same into the in-process Encoder plus ELF image, and
+// nasm + ld when both are on PATH.
+// Each stage reports the best of `runs` and results are written as JSON for
+// bench/compare.py.
+//
+//     bench_stages [output.json] [scale] [runs]
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tokenizer.hpp"
+#include "parser.hpp"
+#include "lower.hpp"
+#include "ir_opt.hpp"
+#include "generator.hpp"
+#include "encoder.hpp"
+#include "elf.hpp"
+#include "workload.hpp"
+
+static ir::Function lower(const Ast& prog) {
+    ir::Function fn = Lowering(prog).lower().main;
+    ir::Optimizer().optimize(fn);
+    return fn;
+}
+
+struct Stage {
+    std::string_view name;
+    double seconds;
+};
+
+static bool have_nasm() {
+    return system("command -v nasm > /dev/null 2>&1 && command -v ld > /dev/null 2>&1") == 0;
+}
+
+int main(int argc, char* argv[]) {
+    const char* json_path = argc > 1 ? argv[1] : "bench_results.json";
+    const size_t scale = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1;
+    const int runs = argc > 3 ? std::atoi(argv[3]) : 7;
+    const bool nasm = have_nasm();
+    if (!nasm) {
+        std::cerr << "nasm or ld not found, skipping the assemble/link stage" << std::endl;
+    }
+
+    // Sizes keep each workload in the tens of milliseconds per stage at scale 1.
+    const std::vector<std::pair<workload::Kind, size_t>> workloads {
+        { workload::Kind::expr_chain, 256 * 1024 },
+        { workload::Kind::nested_scopes, 2000 },
+        { workload::Kind::elif_ladder, 64 * 1024 },
+        { workload::Kind::many_lets, 128 * 1024 },
+        { workload::Kind::comment_heavy, 64 * 1024 },
+        { workload::Kind::deep_nesting, 32 * 1024 },
+    };
+
+    std::ofstream json(json_path);
+    if (!json) {
+        std::cerr << "Could not write " << json_path << std::endl;
+        return EXIT_FAILURE;
+    }
+    json << "{\n  \"runs\": " << runs << ",\n  \"scale\": " << scale << ",\n  \"workloads\": [";
+
+    for (size_t w = 0; w < workloads.size(); w++) {
+        const auto [kind, base_size] = workloads[w];
+        const size_t size = base_size * scale;
+        const std::string src = workload::generate(kind, size);
+
+        std::vector<Stage> stages;
+        stages.push_back({ "tokenize", workload::best_of(runs, [&] {
+            Tokenizer tokenizer(src);
+            static_cast<void>(tokenizer.tokenize());
+        }) });
+        stages.push_back({ "parse", workload::best_of(runs, [&] {
+            Tokenizer tokenizer(src);
+            ArenaAllocator allocator;
+            Parser parser(tokenizer, allocator);
+            static_cast<void>(parser.parse_prog());
+        }) });
+
+        Tokenizer tokenizer(src);
+        ArenaAllocator allocator;
+        Parser parser(tokenizer, allocator);
+        const Ast prog = parser.parse_prog().value();
+        std::string asm_text;
+        stages.push_back({ "gen_prog", workload::best_of(runs, [&] {
+            asm_text = Generator(lower(prog)).gen_prog();
+        }) });
+        stages.push_back({ "encode", workload::best_of(runs, [&] {
+            Encoder encoder;
+            Generator(lower(prog)).gen_prog(encoder);
+            static_cast<void>(elf::image(encoder.finish()));
+        }) });
+        if (nasm) {
+            {
+                std::ofstream out("bench_stage.asm");
+                out << asm_text;
+            }
+            stages.push_back({ "assemble_link", workload::best_of(runs, [&] {
+                if (system("nasm -felf64 bench_stage.asm -o bench_stage.o && ld -o bench_stage bench_stage.o") != 0) {
+                    std::cerr << "nasm/ld failed" << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+            }) });
+        }
+
+        const double mb = static_cast<double>(src.size()) / (1024 * 1024);
+        std::cout << workload::kind_name(kind) << " (size " << size << ", " << mb << " MB)" << std::endl;
+        json << (w ? ",\n" : "\n") << "    {\"name\": \"" << workload::kind_name(kind) << "\", \"size\": " << size
+             << ", \"source_bytes\": " << src.size() << ", \"stages\": {";
+        for (size_t s = 0; s < stages.size(); s++) {
+            const Stage& stage = stages[s];
+            std::cout << "    " << stage.name << ": " << stage.seconds * 1e3 << " ms, " << mb / stage.seconds << " MB/s" << std::endl;
+            json << (s ? ", " : "") << "\"" << stage.name << "\": {\"ms\": " << stage.seconds * 1e3
+                 << ", \"mb_per_s\": " << mb / stage.seconds << "}";
+        }
+        json << "}}";
+    }
+    json << "\n  ]\n}\n";
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,47 @@
+// Lowering and code generation time against the number of live variables. Each `let`
+// reads two earlier variables and every few statements one is reassigned, so
+// symbol lookups dominate; time per variable should stay flat as N grows.
+//
+//     g++ -std=c++20 -O2 -Isrc bench/bench_symbols.cpp -o bench_symbols
+//     ./bench_symbols [max_vars]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "tokenizer.hpp"
+#include "parser.hpp"
+#include "lower.hpp"
+#include "ir_opt.hpp"
+#include "generator.hpp"
+
+static std::string make_source(size_t vars) {
+    std::string src = "let v0 = 1;\n";
+    for (size_t i = 1; i < vars; i++) {
+        src += "let v" + std::to_string(i) + " = v" + std::to_string(i / 2) + " + v" + std::to_string(i - 1) + ";\n";
+        if (i % 4 == 0) {
+            src += "v" + std::to_string(i / 3) + " = v" + std::to_string(i) + ";\n";
+        }
+    }
+    src += "return(v0);\n";
+    return src;
+}
+
+int main(int argc, char* argv[]) {
+    const size_t max_vars = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+    for (size_t vars = 1000; vars <= max_vars; vars *= 10) {
+        Tokenizer tokenizer(make_source(vars));
+        ArenaAllocator allocator;
+        Parser parser(tokenizer, allocator);
+        const Ast prog = parser.parse_prog().value();
+
+        const auto start = std::chrono::steady_clock::now();
+        Generator generator(Lowering(prog).lower());
+        const std::string code = generator.gen_prog();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << vars << " vars: " << elapsed.count() * 1e3 << " ms, "
+                  << elapsed.count() * 1e9 / vars << " ns/var" << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,65 @@
+// Lexing throughput of Tokenizer::tokenize and of a TokenStream pulling from
+// the Tokenizer, for each scan kernel set.
+//
+//     g++ -std=c++20 -O2 -Isrc bench/bench_tokenizer.cpp -o bench_tokenizer
+//     ./bench_tokenizer [megabytes]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "tokenizer.hpp"
+
+static std::string make_source(size_t bytes) {
+    std::string src;
+    src.reserve(bytes + 256);
+    size_t step = 0;
+    while (src.size() < bytes) {
+        const size_t i = step++ % 4096;
+        src += "// running total of the generated accumulator chain, step " + std::to_string(i) + "\n";
+        src += "let accumulator" + std::to_string(i) + " = (accumulatorSeed * 1234567 + " + std::to_string(i) + ") / 3;\n";
+        src += "if (accumulator" + std::to_string(i) + " - 42) {\n";
+        src += "        accumulator" + std::to_string(i) + " = accumulator" + std::to_string(i) + " - 1;\n";
+        src += "} else {\n    /* nothing to see\n       here */\n}\n";
+    }
+    return src;
+}
+
+int main(int argc, char* argv[]) {
+    const size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    const std::string src = make_source(megabytes * 1024 * 1024);
+
+    for (scan::Isa isa : { scan::Isa::scalar, scan::Isa::sse2, scan::Isa::avx2 }) {
+        if (!scan::supported(isa)) {
+            std::cout << scan::isa_name(isa) << ": unsupported on this cpu" << std::endl;
+            continue;
+        }
+        double best_vector = 0;
+        double best_stream = 0;
+        size_t token_count = 0;
+        for (int run = 0; run < 5; run++) {
+            {
+                Tokenizer tokenizer(src, scan::kernels_for(isa));
+                const auto start = std::chrono::steady_clock::now();
+                const std::vector<Token> tokens = tokenizer.tokenize();
+                const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                token_count = tokens.size();
+                best_vector = std::max(best_vector, src.size() / elapsed.count() / (1024 * 1024));
+            }
+            {
+                Tokenizer tokenizer(src, scan::kernels_for(isa));
+                TokenStream stream(tokenizer);
+                const auto start = std::chrono::steady_clock::now();
+                while (stream.peek()) {
+                    stream.consume();
+                }
+                const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                best_stream = std::max(best_stream, src.size() / elapsed.count() / (1024 * 1024));
+            }
+        }
+        std::cout << scan::isa_name(isa) << ": " << best_vector << " MB/s into a vector, "
+                  << best_stream << " MB/s streamed, " << token_count << " tokens" << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
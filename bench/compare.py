@@ -0,0 +1,132 @@
+#!/usr/bin/env python3
+"""Compares bench_stages JSON files against a baseline and flags stages that
+got slower.
+
+    compare.py baseline.json current.json... [--threshold PERCENT]
+               [--min-ms MS] [--save summary.json]
+
+Every stage is summarised over the current files by its median and by its
+fastest run. Both are first divided by the host factor, the median ratio to
+the baseline over all stages, since a shared host can run everything 30-50%
+slower for minutes at a time. Exits with status 1 when any workload/stage
+present in both is then more than PERCENT (default 15) slower than the
+baseline by both measures: a real regression moves the whole distribution,
+while noise comes in bursts that rarely reach a stage's fastest run and its
+median at once. A change that slows every stage alike only moves the host
+factor, which is printed for that reason. Stages whose baseline median is
+under MS milliseconds (default 2) are listed but never flagged, since timer
+and scheduler noise dominates them. --save writes the summary in the same
+format, with the fastest run as "best_ms", ready to be copied over the
+baseline.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        return json.load(f)
+
+
+def stage_times(data, field="ms"):
+    return {
+        (w["name"], stage): values.get(field, values["ms"])
+        for w in data["workloads"]
+        for stage, values in w["stages"].items()
+    }
+
+
+def summarise(runs):
+    """Returns the first run with every stage replaced by its median over all
+    runs that have it, plus the fastest of them as best_ms."""
+    times = {}
+    for data in runs:
+        for key, ms in stage_times(data).items():
+            times.setdefault(key, []).append(ms)
+    summary = json.loads(json.dumps(runs[0]))
+    for w in summary["workloads"]:
+        mb = w["source_bytes"] / (1024 * 1024)
+        for stage, values in w["stages"].items():
+            samples = times[(w["name"], stage)]
+            values["ms"] = statistics.median(samples)
+            values["best_ms"] = min(samples)
+            values["mb_per_s"] = mb / (values["ms"] / 1e3) if values["ms"] > 0 else 0.0
+    return summary
+
+
+def save(data, path):
+    with open(path, "w") as f:
+        f.write("{\n")
+        f.write(f'  "runs": {data["runs"]},\n  "scale": {data["scale"]},\n  "workloads": [')
+        for i, w in enumerate(data["workloads"]):
+            stages = ", ".join(
+                f'"{stage}": {{"ms": {values["ms"]:.6g}, "best_ms": {values["best_ms"]:.6g}, '
+                f'"mb_per_s": {values["mb_per_s"]:.6g}}}'
+                for stage, values in w["stages"].items()
+            )
+            f.write(f'{"," if i else ""}\n    {{"name": "{w["name"]}", "size": {w["size"]}, '
+                    f'"source_bytes": {w["source_bytes"]}, "stages": {{{stages}}}}}')
+        f.write("\n  ]\n}\n")
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("baseline")
+    parser.add_argument("current", nargs="+")
+    parser.add_argument("--threshold", type=float, default=15.0)
+    parser.add_argument("--min-ms", type=float, default=2.0)
+    parser.add_argument("--save")
+    args = parser.parse_args()
+
+    summary = summarise([load(path) for path in args.current])
+    if args.save:
+        save(summary, args.save)
+
+    if not os.path.exists(args.baseline):
+        source = args.save or args.current[0]
+        print(f"no baseline at {args.baseline}; copy {source} there to create one")
+        return 0
+
+    baseline_data = load(args.baseline)
+    baseline = stage_times(baseline_data)
+    baseline_best = stage_times(baseline_data, "best_ms")
+    current = stage_times(summary)
+    current_best = stage_times(summary, "best_ms")
+
+    def change(before, after, factor=1.0):
+        return (after / factor - before) / before * 100 if before > 0 else 0.0
+
+    timed = [key for key in baseline.keys() & current.keys() if baseline[key] >= args.min_ms and baseline_best[key] > 0]
+    host = statistics.median(current[key] / baseline[key] for key in timed) if timed else 1.0
+    host_best = statistics.median(current_best[key] / baseline_best[key] for key in timed) if timed else 1.0
+    print(f"host factor {host:.2f} (median), {host_best:.2f} (fastest run)")
+
+    regressions = 0
+    print(f"{'workload':<16}{'stage':<16}{'baseline ms':>12}{'current ms':>12}{'change':>10}{'adjusted':>10}{'best adj.':>11}")
+    for key in sorted(baseline.keys() & current.keys()):
+        before, after = baseline[key], current[key]
+        adjusted = change(before, after, host)
+        best_adjusted = change(baseline_best[key], current_best[key], host_best)
+        flag = ""
+        if before < args.min_ms:
+            flag = "  (too short)"
+        elif adjusted > args.threshold and best_adjusted > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        print(f"{key[0]:<16}{key[1]:<16}{before:>12.3f}{after:>12.3f}{change(before, after):>+9.1f}%"
+              f"{adjusted:>+9.1f}%{best_adjusted:>+10.1f}%{flag}")
+    for key in sorted(baseline.keys() - current.keys()):
+        print(f"{key[0]:<16}{key[1]:<16}missing from current results")
+
+    if regressions:
+        print(f"{regressions} stage(s) regressed by more than {args.threshold:g}%")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,25 @@
+// Writes a synthetic .ps program to stdout.
+//
+//     gen_workload <expr_chain|nested_scopes|elif_ladder|many_lets|comment_heavy|deep_nesting> <size> [seed]
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include "workload.hpp"
+
+int main(int argc, char* argv[]) {
+    workload::Kind kind;
+    if (argc < 3 || !workload::parse_kind(argv[1], kind)) {
+        std::cerr << "Correct Usage : gen_workload <";
+        for (size_t i = 0; i < workload::kinds.size(); i++) {
+            std::cerr << (i ? "|" : "") << workload::kind_name(workload::kinds[i]);
+        }
+        std::cerr << "> <size> [seed]" << std::endl;
+        return EXIT_FAILURE;
+    }
+    const size_t size = std::strtoul(argv[2], nullptr, 10);
+    const uint64_t seed = argc > 3 ? std::strtoull(argv[3], nullptr, 10) : 1;
+    std::cout << workload::generate(kind, size, seed);
+    return EXIT_SUCCESS;
+}
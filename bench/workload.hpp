@@ -0,0 +1,237 @@
+#pragma once
+
+// Synthetic .ps programs for the benchmarks. Every generator is deterministic
+// for a given size and seed and produces a valid program ending in a return.
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <string_view>
+
+namespace workload {
+
+enum class Kind {
+    expr_chain,
+    nested_scopes,
+    elif_ladder,
+    many_lets,
+    comment_heavy,
+    deep_nesting,
+};
+
+inline constexpr std::array<Kind, 6> kinds {
+    Kind::expr_chain, Kind::nested_scopes, Kind::elif_ladder, Kind::many_lets, Kind::comment_heavy, Kind::deep_nesting,
+};
+
+inline std::string_view kind_name(Kind kind) {
+    static constexpr std::array<std::string_view, 6> names {
+        "expr_chain", "nested_scopes", "elif_ladder", "many_lets", "comment_heavy", "deep_nesting",
+    };
+    return names[static_cast<size_t>(kind)];
+}
+
+inline bool parse_kind(std::string_view name, Kind& kind) {
+    for (Kind k : kinds) {
+        if (kind_name(k) == name) {
+            kind = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+class Writer {
+    public:
+        inline explicit Writer(uint64_t seed) : rng(seed) {}
+
+        inline uint64_t below(uint64_t n) {
+            return std::uniform_int_distribution<uint64_t>(0, n - 1)(rng);
+        }
+
+        inline char op() {
+            static constexpr char ops[] = { '+', '-', '*', '/' };
+            return ops[below(4)];
+        }
+
+        // A literal, or one of the first `vars` variables named `prefix`N.
+        inline void operand(std::string_view prefix, size_t vars) {
+            if (vars == 0 || below(3) == 0) {
+                src += std::to_string(1 + below(999));
+            } else {
+                src += prefix;
+                src += std::to_string(below(vars));
+            }
+        }
+
+        // `terms` operands joined by random operators, with the occasional
+        // parenthesised pair. Divisors are always nonzero literals.
+        inline void chain(std::string_view prefix, size_t vars, size_t terms) {
+            operand(prefix, vars);
+            for (size_t i = 1; i < terms; i++) {
+                const char c = op();
+                src += ' ';
+                src += c;
+                src += ' ';
+                if (c == '/') {
+                    src += std::to_string(1 + below(9));
+                } else if (below(8) == 0 && i + 1 < terms) {
+                    src += '(';
+                    operand(prefix, vars);
+                    src += " + ";
+                    operand(prefix, vars);
+                    src += ')';
+                    i++;
+                } else {
+                    operand(prefix, vars);
+                }
+            }
+        }
+
+        // Indentation stops growing past 8 levels so deep nesting stays linear in size.
+        inline void indent(size_t depth) {
+            src.append(std::min<size_t>(depth, 8) * 4, ' ');
+        }
+
+        std::string src;
+
+    private:
+        std::mt19937_64 rng;
+};
+
+// `size` operands spread over lets of 64-term chains.
+inline std::string expr_chain(size_t size, Writer& w) {
+    constexpr size_t terms = 64;
+    const size_t lets = std::max<size_t>(1, (size + terms - 1) / terms);
+    for (size_t i = 0; i < lets; i++) {
+        w.src += "let c" + std::to_string(i) + " = ";
+        w.chain("c", i, terms);
+        w.src += ";\n";
+    }
+    w.src += "return(c" + std::to_string(lets - 1) + ");\n";
+    return std::move(w.src);
+}
+
+// Scopes nested `size` deep, each declaring one variable from its parent's.
+inline std::string nested_scopes(size_t size, Writer& w) {
+    w.src += "let n0 = 1;\n";
+    for (size_t depth = 1; depth <= size; depth++) {
+        w.indent(depth - 1);
+        w.src += "{\n";
+        w.indent(depth);
+        w.src += "let n" + std::to_string(depth) + " = n" + std::to_string(depth - 1) + " + " + std::to_string(w.below(10)) + ";\n";
+        w.indent(depth);
+        w.src += "n0 = n" + std::to_string(depth) + ";\n";
+    }
+    for (size_t depth = size; depth > 0; depth--) {
+        w.indent(depth - 1);
+        w.src += "}\n";
+    }
+    w.src += "return(n0);\n";
+    return std::move(w.src);
+}
+
+// if/elif/else ladders with `size` arms in total, 256 arms per ladder.
+inline std::string elif_ladder(size_t size, Writer& w) {
+    constexpr size_t arms = 256;
+    w.src += "let x = 7;\nlet y = 0;\n";
+    for (size_t done = 0; done < size; done += arms) {
+        for (size_t arm = 0; arm < arms && done + arm < size; arm++) {
+            w.src += arm == 0 ? "if (x - " : "} elif (x - ";
+            w.src += std::to_string(done + arm) + ") {\n    y = y + " + std::to_string(w.below(100)) + ";\n";
+        }
+        w.src += "} else {\n    y = y - 1;\n}\n";
+    }
+    w.src += "return(y);\n";
+    return std::move(w.src);
+}
+
+// `size` lets, each reading up to four earlier ones, with periodic reassignments.
+inline std::string many_lets(size_t size, Writer& w) {
+    w.src += "let v0 = 1;\n";
+    for (size_t i = 1; i < size; i++) {
+        w.src += "let v" + std::to_string(i) + " = ";
+        w.chain("v", i, 1 + w.below(4));
+        w.src += ";\n";
+        if (i % 8 == 0) {
+            w.src += "v" + std::to_string(w.below(i)) + " = v" + std::to_string(i) + ";\n";
+        }
+    }
+    w.src += "return(v0);\n";
+    return std::move(w.src);
+}
+
+// `size` statements, each buried in line and block comments.
+inline std::string comment_heavy(size_t size, Writer& w) {
+    w.src += "/*\n * Generated comment-heavy workload.\n */\nlet k0 = 1;\n";
+    for (size_t i = 1; i < size; i++) {
+        w.src += "// statement " + std::to_string(i) + ": keeps the running value of the previous one\n";
+        w.src += "// and folds in a small constant so the optimizer has something to do\n";
+        w.src += "let k" + std::to_string(i) + " = /* previous */ k" + std::to_string(i - 1) + " + " + std::to_string(w.below(10)) + ";\n";
+        if (i % 16 == 0) {
+            w.src += "/* a longer block comment that spans\n   several lines, like a doc comment\n   ahead of a group of statements */\n";
+        }
+    }
+    w.src += "return(k" + std::to_string(size ? size - 1 : 0) + "); // done\n";
+    return std::move(w.src);
+}
+
+// An expression in `size` nested parentheses, ifs nested `size` deep and one
+// if chain of `size` arms, without indentation.
+inline std::string deep_nesting(size_t size, Writer& w) {
+    w.src += "let x = 7;\nlet y = ";
+    w.src.append(size, '(');
+    w.src += "x";
+    for (size_t i = 0; i < size; i++) {
+        w.src += " + " + std::to_string(w.below(10)) + ")";
+    }
+    w.src += ";\n";
+    for (size_t i = 0; i < size; i++) {
+        w.src += "if (y - " + std::to_string(i) + ") {\ny = y + 1;\n";
+    }
+    for (size_t i = 0; i < size; i++) {
+        w.src += "}\n";
+    }
+    for (size_t arm = 0; arm < size; arm++) {
+        w.src += arm == 0 ? "if (x - " : "} elif (x - ";
+        w.src += std::to_string(arm) + ") {\ny = y + " + std::to_string(w.below(100)) + ";\n";
+    }
+    w.src += "}\nreturn(y);\n";
+    return std::move(w.src);
+}
+
+// Best wall time of `runs` calls of `f`, in seconds.
+template<typename F>
+inline double best_of(size_t runs, F&& f) {
+    double best = 1e30;
+    for (size_t i = 0; i < runs; i++) {
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+inline std::string generate(Kind kind, size_t size, uint64_t seed = 1) {
+    Writer w(seed);
+    switch (kind) {
+        case Kind::expr_chain:
+            return expr_chain(size, w);
+        case Kind::nested_scopes:
+            return nested_scopes(size, w);
+        case Kind::elif_ladder:
+            return elif_ladder(size, w);
+        case Kind::many_lets:
+            return many_lets(size, w);
+        case Kind::comment_heavy:
+            return comment_heavy(size, w);
+        case Kind::deep_nesting:
+            return deep_nesting(size, w);
+    }
+    return {};
+}
+
+}
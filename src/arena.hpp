@@ -1,29 +1,208 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Bump allocator over a list of chunks that grow geometrically. Objects are
+// placement-constructed; those with non-trivial destructors are recorded and
+// destroyed, newest first, on reset() or when the arena goes away.
 class ArenaAllocator {
     public:
-        inline explicit ArenaAllocator(size_t bytes) : size(bytes) {
-            buffer = static_cast<std::byte*>(malloc(size));
-            offset = buffer;
+        inline explicit ArenaAllocator(size_t first_chunk = 64 * 1024) : next_chunk_size(first_chunk) {}
+
+        template<typename T, typename... Args>
+        inline T* alloc(Args&&... args) {
+            void* mem = allocate(sizeof(T), alignof(T));
+            T* obj = new (mem) T(std::forward<Args>(args)...);
+            if constexpr (!std::is_trivially_destructible_v<T>) {
+                Dtor* dtor = new (allocate(sizeof(Dtor), alignof(Dtor))) Dtor {
+                    .destroy = [](void* p) { static_cast<T*>(p)->~T(); },
+                    .obj = obj,
+                    .next = dtors,
+                };
+                dtors = dtor;
+            }
+            return obj;
         }
 
+        // Uninitialized storage for `count` trivially constructible elements.
         template<typename T>
-        inline T* alloc() {
-            void* curr_offset = offset;
-            offset += sizeof(T);
-            return static_cast<T*>(curr_offset);
+        inline T* alloc_array(size_t count) {
+            static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_destructible_v<T>);
+            if (count > SIZE_MAX / sizeof(T)) {
+                throw std::bad_alloc();
+            }
+            return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+        }
+
+        inline void* allocate(size_t bytes, size_t align) {
+            uintptr_t start = (reinterpret_cast<uintptr_t>(offset) + align - 1) & ~(uintptr_t(align) - 1);
+            if (!head || start > reinterpret_cast<uintptr_t>(limit) || bytes > reinterpret_cast<uintptr_t>(limit) - start) {
+                new_chunk(bytes, align);
+                start = (reinterpret_cast<uintptr_t>(offset) + align - 1) & ~(uintptr_t(align) - 1);
+            }
+            used += start + bytes - reinterpret_cast<uintptr_t>(offset);
+            offset = reinterpret_cast<std::byte*>(start + bytes);
+            return reinterpret_cast<void*>(start);
+        }
+
+        // Destroys everything allocated so far and keeps only the newest (largest)
+        // chunk for reuse.
+        inline void reset() {
+            run_dtors();
+            if (head) {
+                while (Chunk* prev = head->prev) {
+                    head->prev = prev->prev;
+                    chunks--;
+                    free(prev);
+                }
+                offset = head->data();
+            }
+            used = 0;
+        }
+
+        [[nodiscard]] inline size_t bytes_used() const {
+            return used;
+        }
+
+        [[nodiscard]] inline size_t bytes_reserved() const {
+            size_t total = 0;
+            for (const Chunk* chunk = head; chunk; chunk = chunk->prev) {
+                total += chunk->size;
+            }
+            return total;
+        }
+
+        [[nodiscard]] inline size_t chunk_count() const {
+            return chunks;
+        }
+
+        [[nodiscard]] inline size_t chunks_allocated() const {
+            return total_chunks;
         }
 
         inline ArenaAllocator(const ArenaAllocator& other) = delete;
         inline ArenaAllocator operator = (const ArenaAllocator& other) = delete;
 
         inline ~ArenaAllocator() {
-            free(buffer);
+            run_dtors();
+            while (head) {
+                Chunk* prev = head->prev;
+                free(head);
+                head = prev;
+            }
         }
 
 
     private:
-        size_t size;
-        std::byte* buffer;
-        std::byte* offset;
+        struct Chunk {
+            Chunk* prev;
+            size_t size;
+
+            inline std::byte* data() {
+                return reinterpret_cast<std::byte*>(this + 1);
+            }
+        };
+
+        struct Dtor {
+            void (*destroy)(void*);
+            void* obj;
+            Dtor* next;
+        };
+
+        inline void new_chunk(size_t bytes, size_t align) {
+            if (bytes > SIZE_MAX / 2 - align - sizeof(Chunk)) {
+                throw std::bad_alloc();
+            }
+            const size_t size = std::max(next_chunk_size, bytes + align);
+            Chunk* chunk = static_cast<Chunk*>(malloc(sizeof(Chunk) + size));
+            if (!chunk) {
+                throw std::bad_alloc();
+            }
+            chunk->prev = head;
+            chunk->size = size;
+            head = chunk;
+            offset = chunk->data();
+            limit = offset + size;
+            next_chunk_size = size * 2;
+            chunks++;
+            total_chunks++;
+        }
+
+        inline void run_dtors() {
+            while (dtors) {
+                Dtor* next = dtors->next;
+                dtors->destroy(dtors->obj);
+                dtors = next;
+            }
+        }
+
+        size_t next_chunk_size;
+        Chunk* head = nullptr;
+        std::byte* offset = nullptr;
+        std::byte* limit = nullptr;
+        Dtor* dtors = nullptr;
+        size_t used = 0;
+        size_t chunks = 0;
+        size_t total_chunks = 0;
+};
+
+// Growable array whose storage lives in an ArenaAllocator. Growing abandons the
+// old block inside the arena, so at most half of the storage is ever dead.
+template<typename T>
+class ArenaVector {
+    public:
+        inline void push_back(ArenaAllocator& arena, T value) {
+            if (count == capacity) {
+                const uint32_t next_capacity = capacity ? capacity * 2 : 4;
+                T* next = arena.alloc_array<T>(next_capacity);
+                if (count) {
+                    std::memcpy(next, items, sizeof(T) * count);
+                }
+                items = next;
+                capacity = next_capacity;
+            }
+            items[count++] = value;
+        }
+
+        // Replaces the contents with a copy of `values` in a block of exactly that size.
+        inline void assign(ArenaAllocator& arena, const T* values, size_t n) {
+            items = arena.alloc_array<T>(n);
+            if (n) {
+                std::memcpy(items, values, sizeof(T) * n);
+            }
+            count = static_cast<uint32_t>(n);
+            capacity = count;
+        }
+
+        [[nodiscard]] inline size_t size() const {
+            return count;
+        }
+
+        [[nodiscard]] inline bool empty() const {
+            return count == 0;
+        }
+
+        inline T& operator[](size_t i) const {
+            return items[i];
+        }
+
+        inline T* begin() const {
+            return items;
+        }
+
+        inline T* end() const {
+            return items + count;
+        }
+
+    private:
+        T* items = nullptr;
+        uint32_t count = 0;
+        uint32_t capacity = 0;
 };
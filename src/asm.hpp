@@ -0,0 +1,197 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "./output_buffer.hpp"
+
+enum class Reg : uint8_t {
+    rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+    r8, r9, r10, r11, r12, r13, r14, r15,
+};
+
+inline std::string_view reg_name(Reg reg) {
+    static constexpr std::array<std::string_view, 16> names {
+        "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+        "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+    };
+    return names[static_cast<size_t>(reg)];
+}
+
+enum class Mnemonic : uint8_t {
+    label,
+    mov,
+    push,
+    pop,
+    add,
+    sub,
+    mul,
+    div,
+    imul,
+    shl,
+    shr,
+    lea,
+    xor_,
+    test,
+    cmp,
+    jz,
+    jnz,
+    jmp,
+    syscall,
+    ret,
+    call,
+};
+
+inline std::string_view mnemonic_name(Mnemonic mnemonic) {
+    static constexpr std::array<std::string_view, 21> names {
+        "", "mov", "push", "pop", "add", "sub", "mul", "div", "imul", "shl", "shr", "lea", "xor",
+        "test", "cmp", "jz", "jnz", "jmp", "syscall", "ret", "call",
+    };
+    return names[static_cast<size_t>(mnemonic)];
+}
+
+// A register, an immediate, a QWORD at [base + disp] or a label id. A memory
+// operand with a non-zero `scale` is [base + index * scale + disp], which only
+// lea takes.
+struct Operand {
+    enum class Kind : uint8_t {
+        none,
+        reg,
+        imm,
+        mem,
+        label,
+    } kind = Kind::none;
+    Reg reg = Reg::rax;
+    Reg index = Reg::rax;
+    uint8_t scale = 0;
+    int32_t disp = 0;
+    uint64_t imm = 0;
+
+    static inline Operand r(Reg reg) {
+        return { .kind = Kind::reg, .reg = reg };
+    }
+
+    static inline Operand i(uint64_t value) {
+        return { .kind = Kind::imm, .imm = value };
+    }
+
+    static inline Operand m(Reg base, int32_t disp) {
+        return { .kind = Kind::mem, .reg = base, .disp = disp };
+    }
+
+    static inline Operand m(Reg base, Reg index, uint8_t scale, int32_t disp = 0) {
+        return { .kind = Kind::mem, .reg = base, .index = index, .scale = scale, .disp = disp };
+    }
+
+    static inline Operand l(uint32_t label) {
+        return { .kind = Kind::label, .imm = label };
+    }
+
+    inline bool operator == (const Operand& other) const = default;
+};
+
+struct Instr {
+    Mnemonic mnemonic;
+    Operand dst {};
+    Operand src {};
+};
+
+// Receives the instruction stream produced by the Generator.
+class AsmSink {
+    public:
+        virtual ~AsmSink() = default;
+        virtual void emit(const Instr& instr) = 0;
+};
+
+// Formats the instruction stream as nasm source into an OutputBuffer. Register
+// and mnemonic spellings come from fixed tables, so formatting an instruction
+// never allocates.
+class AsmPrinter : public AsmSink {
+    public:
+        inline explicit AsmPrinter(OutputBuffer& out) : out(out) {
+            out.append("global _start\n_start:\n");
+        }
+
+        inline void emit(const Instr& instr) override {
+            if (instr.mnemonic == Mnemonic::label) {
+                append(instr.dst);
+                out.append(":\n");
+                return;
+            }
+            out.append(line_prefix[static_cast<size_t>(instr.mnemonic)]);
+            if (instr.dst.kind != Operand::Kind::none) {
+                out.append(' ');
+                append(instr.dst);
+            }
+            if (instr.src.kind != Operand::Kind::none) {
+                out.append(", ");
+                append(instr.src);
+            }
+            out.append('\n');
+        }
+
+    private:
+        static constexpr std::array<std::string_view, 21> line_prefix {
+            "", "    mov", "    push", "    pop", "    add", "    sub", "    mul", "    div",
+            "    imul", "    shl", "    shr", "    lea", "    xor", "    test", "    cmp", "    jz", "    jnz",
+            "    jmp", "    syscall", "    ret", "    call",
+        };
+
+        static constexpr std::array<std::string_view, 16> mem_prefix {
+            "QWORD [rax + ", "QWORD [rcx + ", "QWORD [rdx + ", "QWORD [rbx + ",
+            "QWORD [rsp + ", "QWORD [rbp + ", "QWORD [rsi + ", "QWORD [rdi + ",
+            "QWORD [r8 + ", "QWORD [r9 + ", "QWORD [r10 + ", "QWORD [r11 + ",
+            "QWORD [r12 + ", "QWORD [r13 + ", "QWORD [r14 + ", "QWORD [r15 + ",
+        };
+
+        inline void append(const Operand& op) {
+            switch (op.kind) {
+                case Operand::Kind::reg:
+                    out.append(reg_name(op.reg));
+                    break;
+                case Operand::Kind::imm:
+                    out.append_uint(op.imm);
+                    break;
+                case Operand::Kind::mem:
+                    if (op.scale != 0) {
+                        out.append('[');
+                        out.append(reg_name(op.reg));
+                        out.append(" + ");
+                        out.append(reg_name(op.index));
+                        out.append('*');
+                        out.append_uint(op.scale);
+                        out.append(" + ");
+                    } else {
+                        out.append(mem_prefix[static_cast<size_t>(op.reg)]);
+                    }
+                    out.append_int(op.disp);
+                    out.append(']');
+                    break;
+                case Operand::Kind::label:
+                    out.append("label");
+                    out.append_uint(op.imm);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        OutputBuffer& out;
+};
+
+// Passes the instruction stream on to two sinks.
+class AsmTee : public AsmSink {
+    public:
+        inline AsmTee(AsmSink& first, AsmSink& second) : first(first), second(second) {}
+
+        inline void emit(const Instr& instr) override {
+            first.emit(instr);
+            second.emit(instr);
+        }
+
+    private:
+        AsmSink& first;
+        AsmSink& second;
+};
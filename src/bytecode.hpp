@@ -0,0 +1,579 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "./ir.hpp"
+#include "./error.hpp"
+
+// Register-based bytecode for the Interpreter, generated from the same SSA
+// form as the x86-64 backend. An instruction is a run of 32-bit words: the
+// first holds the opcode in its low byte and the first operand above it, and
+// a 64-bit immediate k takes the last two words, low half first. d, a and b
+// are registers and t is a word offset into the code.
+//
+//   mov d a            movk d k
+//   add d a b          addk d a k         (also sub, mul and div)
+//   rsubk d a k        d = k - a          rdivk d a k    d = k / a
+//   jmp - t            jz a t             jnz a t
+//   jeq a b t          jne a b t          jeqk a t k     jnek a t k
+//   ret a              retk - k
+//   call d f n a1 .. an
+//
+// The k forms and the compare-and-branch forms are superinstructions: without
+// them a constant is first loaded with movk and a branch on a difference
+// tests the result of a sub.
+//
+// The top-level code comes first, then each function in turn. A function has
+// registers of its own, the first of which hold its parameters; `call` passes
+// registers a1 to an of the caller as the n arguments of function f and puts
+// what the callee's ret returns into d.
+namespace bytecode {
+
+enum class Op : uint8_t {
+    mov,
+    movk,
+    add,
+    sub,
+    mul,
+    div,
+    addk,
+    subk,
+    mulk,
+    divk,
+    rsubk,
+    rdivk,
+    jmp,
+    jz,
+    jnz,
+    jeq,
+    jne,
+    jeqk,
+    jnek,
+    ret,
+    retk,
+    call,
+};
+
+inline constexpr size_t op_count = static_cast<size_t>(Op::call) + 1;
+
+// Length of each instruction in words; a call takes one more per argument.
+inline constexpr std::array<uint8_t, op_count> lengths {
+    2, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 2, 2, 2, 3, 3, 4, 4, 1, 3, 3,
+};
+
+inline constexpr uint32_t max_operand = (1u << 24) - 1;
+
+// Where a function's code starts, how many registers it uses and how many of
+// those are parameters. Its code ends where the next function's starts.
+struct Function {
+    uint32_t entry;
+    uint32_t registers;
+    uint32_t params;
+};
+
+// `registers` is what the top-level code uses.
+struct Program {
+    uint32_t registers = 0;
+    std::vector<uint32_t> code;
+    std::vector<Function> functions {};
+};
+
+static_assert(sizeof(Function) == 12);
+
+// Serialized form: the magic, a version word, the register count, the number
+// of functions, the code length in words, the entry, register count and
+// parameter count of each function, and the code, all little-endian.
+inline constexpr std::string_view magic = "PSBC";
+inline constexpr uint32_t version = 2;
+
+template<typename T>
+inline void put(std::vector<uint8_t>& out, T value) {
+    const size_t at = out.size();
+    out.resize(at + sizeof(T));
+    std::memcpy(out.data() + at, &value, sizeof(T));
+}
+
+[[nodiscard]] inline std::vector<uint8_t> serialize(const Program& program) {
+    std::vector<uint8_t> out(magic.begin(), magic.end());
+    out.reserve(20 + program.functions.size() * 12 + program.code.size() * 4);
+    put<uint32_t>(out, version);
+    put<uint32_t>(out, program.registers);
+    put<uint32_t>(out, static_cast<uint32_t>(program.functions.size()));
+    put<uint32_t>(out, static_cast<uint32_t>(program.code.size()));
+    for (const Function& function : program.functions) {
+        put<uint32_t>(out, function.entry);
+        put<uint32_t>(out, function.registers);
+        put<uint32_t>(out, function.params);
+    }
+    for (const uint32_t word : program.code) {
+        put<uint32_t>(out, word);
+    }
+    return out;
+}
+
+[[nodiscard]] inline bool is_bytecode(std::string_view bytes) {
+    return bytes.starts_with(magic);
+}
+
+// Checks every register, call and jump target, and that control cannot run
+// off the end of the top-level code or of a function, so the Interpreter may
+// trust a program that passes.
+[[nodiscard]] inline bool valid(const Program& program) {
+    const std::vector<uint32_t>& code = program.code;
+    const std::vector<Function>& functions = program.functions;
+    if (program.registers > max_operand) {
+        return false;
+    }
+    for (size_t f = 0; f < functions.size(); f++) {
+        const uint32_t begin = f == 0 ? 0 : functions[f - 1].entry;
+        if (functions[f].entry <= begin || functions[f].entry >= code.size() || functions[f].params > functions[f].registers
+            || functions[f].registers > max_operand) {
+            return false;
+        }
+    }
+    std::vector<bool> starts(code.size(), false);
+    // Each jump target with the end of the code it must stay in.
+    std::vector<std::pair<uint32_t, size_t>> targets;
+    size_t at = 0;
+    size_t function = 0;
+    size_t begin = 0;
+    size_t end = functions.empty() ? code.size() : functions[0].entry;
+    uint32_t registers = program.registers;
+    Op last = Op::mov;
+    while (at < code.size()) {
+        if (at == end) {
+            if (last != Op::jmp && last != Op::ret && last != Op::retk) {
+                return false;
+            }
+            begin = end;
+            end = ++function < functions.size() ? functions[function].entry : code.size();
+            registers = functions[function - 1].registers;
+        }
+        const uint32_t op = code[at] & 0xff;
+        if (op >= op_count || at + lengths[op] > end) {
+            return false;
+        }
+        const size_t length = op == static_cast<uint32_t>(Op::call) ? lengths[op] + size_t { code[at + 2] } : lengths[op];
+        if (at + length > end) {
+            return false;
+        }
+        starts[at] = true;
+        last = static_cast<Op>(op);
+        const uint32_t first = code[at] >> 8;
+        const auto reg = [&](uint32_t r) {
+            return r < registers;
+        };
+        const auto target = [&](uint32_t t) {
+            targets.push_back({ t, end });
+            return t >= begin;
+        };
+        bool ok = true;
+        switch (last) {
+            case Op::mov:
+                ok = reg(first) && reg(code[at + 1]);
+                break;
+            case Op::movk:
+            case Op::ret:
+                ok = reg(first);
+                break;
+            case Op::add:
+            case Op::sub:
+            case Op::mul:
+            case Op::div:
+                ok = reg(first) && reg(code[at + 1]) && reg(code[at + 2]);
+                break;
+            case Op::addk:
+            case Op::subk:
+            case Op::mulk:
+            case Op::divk:
+            case Op::rsubk:
+            case Op::rdivk:
+                ok = reg(first) && reg(code[at + 1]);
+                break;
+            case Op::jmp:
+                ok = target(code[at + 1]);
+                break;
+            case Op::jz:
+            case Op::jnz:
+            case Op::jeqk:
+            case Op::jnek:
+                ok = reg(first) && target(code[at + 1]);
+                break;
+            case Op::jeq:
+            case Op::jne:
+                ok = reg(first) && reg(code[at + 1]) && target(code[at + 2]);
+                break;
+            case Op::retk:
+                break;
+            case Op::call:
+                ok = reg(first) && code[at + 1] < functions.size() && code[at + 2] == functions[code[at + 1]].params;
+                for (size_t i = 0; i < code[at + 2] && ok; i++) {
+                    ok = reg(code[at + 3 + i]);
+                }
+                break;
+        }
+        if (!ok) {
+            return false;
+        }
+        at += length;
+    }
+    for (const auto& [target, limit] : targets) {
+        if (target >= limit || !starts[target]) {
+            return false;
+        }
+    }
+    return function == functions.size() && !code.empty() && (last == Op::jmp || last == Op::ret || last == Op::retk);
+}
+
+// Returns nothing unless `bytes` hold a valid program of this version.
+[[nodiscard]] inline std::optional<Program> deserialize(std::string_view bytes) {
+    const size_t header = magic.size() + 16;
+    if (!is_bytecode(bytes) || bytes.size() < header) {
+        return std::nullopt;
+    }
+    uint32_t fields[4];
+    std::memcpy(fields, bytes.data() + magic.size(), sizeof(fields));
+    const size_t table = static_cast<size_t>(fields[2]) * sizeof(Function);
+    if (fields[0] != version || bytes.size() - header != table + static_cast<size_t>(fields[3]) * 4) {
+        return std::nullopt;
+    }
+    Program program {
+        .registers = fields[1],
+        .code = std::vector<uint32_t>(fields[3]),
+        .functions = std::vector<Function>(fields[2]),
+    };
+    std::memcpy(program.functions.data(), bytes.data() + header, table);
+    std::memcpy(program.code.data(), bytes.data() + header + table, bytes.size() - header - table);
+    if (!valid(program)) {
+        return std::nullopt;
+    }
+    return program;
+}
+
+inline bool write_file(const std::string& path, const std::vector<uint8_t>& bytes) {
+    std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+    return static_cast<bool>(file);
+}
+
+// Lowers an SSA module to a Program. Every value that needs one gets its
+// own register, so the moves for phis never overwrite a value still to be
+// read; a copy shares the register of its source. With superinstructions,
+// arithmetic on two immediates other than division is folded. Blocks keep
+// their topological order and a jump to the next block is left out.
+class Generator {
+    public:
+        inline explicit Generator(const ir::Module& module, bool superinstructions = true)
+            : module(module), superinstructions(superinstructions) {}
+
+        [[nodiscard]] inline Program generate() {
+            program.registers = gen_function(module.main);
+            for (const ir::Function& function : module.functions) {
+                const uint32_t entry = static_cast<uint32_t>(program.code.size());
+                const uint32_t registers = gen_function(function);
+                program.functions.push_back({ .entry = entry, .registers = registers, .params = function.params });
+            }
+            return std::move(program);
+        }
+
+    private:
+        struct Fixup {
+            size_t at;
+            ir::BlockId block;
+        };
+
+        // Appends the code of `function` and returns its register count. The
+        // parameters take the first registers.
+        inline uint32_t gen_function(const ir::Function& function) {
+            fn = &function;
+            regs.assign(fn->insts.size(), ir::none);
+            folded.assign(fn->insts.size(), false);
+            values.assign(fn->insts.size(), 0);
+            fixups.clear();
+            registers = fn->params;
+            for (ir::Value v = 0; v < fn->insts.size(); v++) {
+                if (fn->insts[v].op == ir::Op::param) {
+                    regs[v] = static_cast<uint32_t>(fn->insts[v].imm);
+                }
+            }
+            count_uses();
+            std::vector<ir::BlockId> order;
+            for (ir::BlockId b = 0; b < fn->blocks.size(); b++) {
+                if (fn->blocks[b].reachable) {
+                    order.push_back(b);
+                }
+            }
+            std::vector<uint32_t> offsets(fn->blocks.size(), 0);
+            for (size_t i = 0; i < order.size(); i++) {
+                const ir::BlockId b = order[i];
+                offsets[b] = static_cast<uint32_t>(program.code.size());
+                const ir::Block& block = fn->blocks[b];
+                for (ir::Value v = block.first; v < block.end; v++) {
+                    gen_inst(v, block);
+                }
+                gen_term(b, i + 1 < order.size() ? order[i + 1] : ir::none);
+            }
+            for (const Fixup& fix : fixups) {
+                program.code[fix.at] = offsets[fix.block];
+            }
+            if (registers > max_operand) {
+                throw CompileError("Program has too many values for bytecode");
+            }
+            return registers;
+        }
+
+        inline void count_uses() {
+            uses.assign(fn->insts.size(), 0);
+            for (ir::Value v = 0; v < fn->insts.size(); v++) {
+                fn->for_each_operand(v, [this](ir::Value operand) {
+                    uses[operand]++;
+                });
+            }
+            for (const ir::Block& block : fn->blocks) {
+                if (block.term.value != ir::none) {
+                    uses[block.term.value]++;
+                }
+            }
+        }
+
+        [[nodiscard]] inline ir::Value resolve(ir::Value v) const {
+            while (fn->insts[v].op == ir::Op::copy) {
+                v = fn->insts[v].a;
+            }
+            return v;
+        }
+
+        // Whether `v` goes into the instruction as an immediate: a constant,
+        // or arithmetic on immediates that was folded.
+        [[nodiscard]] inline bool imm(ir::Value v) const {
+            v = resolve(v);
+            return superinstructions && (fn->insts[v].op == ir::Op::const_ || folded[v]);
+        }
+
+        [[nodiscard]] inline uint64_t value_of(ir::Value v) const {
+            v = resolve(v);
+            return folded[v] ? values[v] : fn->insts[v].imm;
+        }
+
+        [[nodiscard]] inline uint32_t reg(ir::Value v) {
+            v = resolve(v);
+            if (regs[v] == ir::none) {
+                regs[v] = registers++;
+            }
+            return regs[v];
+        }
+
+        // A branch condition computed by a sub in the branch's own block and
+        // read nowhere else becomes a compare-and-branch on the sub's operands.
+        [[nodiscard]] inline bool fused(ir::Value v, const ir::Block& block) const {
+            return superinstructions && block.term.kind == ir::Term::Kind::branch && block.term.value == v
+                && v >= block.first && v < block.end && fn->insts[v].op == ir::Op::sub && uses[v] == 1;
+        }
+
+        inline void gen_inst(ir::Value v, const ir::Block& block) {
+            const ir::Inst& inst = fn->insts[v];
+            switch (inst.op) {
+                case ir::Op::const_:
+                    if (!superinstructions && uses[v] > 0) {
+                        emit(Op::movk, reg(v));
+                        emit_k(inst.imm);
+                    }
+                    break;
+                case ir::Op::add:
+                case ir::Op::sub:
+                case ir::Op::mul:
+                case ir::Op::div:
+                    if (!fused(v, block)) {
+                        gen_arith(v, inst);
+                    }
+                    break;
+                case ir::Op::call:
+                    gen_call(v, inst);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // Arguments are passed in registers, so immediates are loaded first.
+        inline void gen_call(ir::Value v, const ir::Inst& inst) {
+            const std::span<const ir::Value> args = fn->args_of(v);
+            for (const ir::Value arg : args) {
+                if (imm(arg)) {
+                    emit(Op::movk, reg(arg));
+                    emit_k(value_of(arg));
+                }
+            }
+            emit(Op::call, reg(v));
+            emit_word(static_cast<uint32_t>(inst.imm));
+            emit_word(static_cast<uint32_t>(args.size()));
+            for (const ir::Value arg : args) {
+                emit_word(reg(arg));
+            }
+        }
+
+        inline void gen_arith(ir::Value v, const ir::Inst& inst) {
+            const size_t index = static_cast<size_t>(inst.op) - static_cast<size_t>(ir::Op::add);
+            static constexpr std::array<Op, 4> reg_ops { Op::add, Op::sub, Op::mul, Op::div };
+            static constexpr std::array<Op, 4> imm_ops { Op::addk, Op::subk, Op::mulk, Op::divk };
+            static constexpr std::array<Op, 4> swapped_ops { Op::addk, Op::rsubk, Op::mulk, Op::rdivk };
+            // As the peephole optimizer does for native code. Division is left
+            // alone so that dividing by zero still traps at run time.
+            if (imm(inst.a) && imm(inst.b) && inst.op != ir::Op::div) {
+                const uint64_t a = value_of(inst.a);
+                const uint64_t b = value_of(inst.b);
+                values[v] = inst.op == ir::Op::add ? a + b : inst.op == ir::Op::sub ? a - b : a * b;
+                folded[v] = true;
+                return;
+            }
+            const uint32_t d = reg(v);
+            if (!imm(inst.a) && !imm(inst.b)) {
+                emit(reg_ops[index], d);
+                emit_word(reg(inst.a));
+                emit_word(reg(inst.b));
+            } else if (!imm(inst.a)) {
+                emit(imm_ops[index], d);
+                emit_word(reg(inst.a));
+                emit_k(value_of(inst.b));
+            } else if (!imm(inst.b)) {
+                emit(swapped_ops[index], d);
+                emit_word(reg(inst.b));
+                emit_k(value_of(inst.a));
+            } else {
+                emit(Op::movk, d);
+                emit_k(value_of(inst.a));
+                emit(imm_ops[index], d);
+                emit_word(d);
+                emit_k(value_of(inst.b));
+            }
+        }
+
+        inline void gen_term(ir::BlockId b, ir::BlockId next) {
+            const ir::Block& block = fn->blocks[b];
+            const ir::Term& term = block.term;
+            switch (term.kind) {
+                case ir::Term::Kind::exit:
+                    if (imm(term.value)) {
+                        emit(Op::retk, 0);
+                        emit_k(value_of(term.value));
+                    } else {
+                        emit(Op::ret, reg(term.value));
+                    }
+                    break;
+                case ir::Term::Kind::jump:
+                    gen_phi_moves(b, term.target);
+                    if (term.target != next) {
+                        emit_jump(Op::jmp, 0, term.target);
+                    }
+                    break;
+                case ir::Term::Kind::branch:
+                    gen_phi_moves(b, term.target);
+                    gen_phi_moves(b, term.other);
+                    gen_branch(term, fused(term.value, block), next);
+                    break;
+            }
+        }
+
+        // Jumps to `target` when the condition holds, to `other` otherwise,
+        // testing whichever way lets the other successor fall through.
+        inline void gen_branch(const ir::Term& term, bool fuse, ir::BlockId next) {
+            const bool invert = term.other != next;
+            const ir::BlockId taken = invert ? term.other : term.target;
+            if (imm(term.value) || (fuse && imm(fn->insts[term.value].a) && imm(fn->insts[term.value].b))) {
+                const ir::Inst& cond = fn->insts[term.value];
+                const bool holds = fuse ? value_of(cond.a) != value_of(cond.b) : value_of(term.value) != 0;
+                const ir::BlockId succ = holds ? term.target : term.other;
+                if (succ != next) {
+                    emit_jump(Op::jmp, 0, succ);
+                }
+                return;
+            }
+            if (!fuse) {
+                emit_jump(invert ? Op::jz : Op::jnz, reg(term.value), taken);
+            } else {
+                const ir::Inst& sub = fn->insts[term.value];
+                if (!imm(sub.a) && !imm(sub.b)) {
+                    emit(invert ? Op::jeq : Op::jne, reg(sub.a));
+                    emit_word(reg(sub.b));
+                    fixup(taken);
+                } else {
+                    // Only equality matters, so the constant may be either operand.
+                    const bool left = imm(sub.a);
+                    emit_jump(invert ? Op::jeqk : Op::jnek, reg(left ? sub.b : sub.a), taken);
+                    emit_k(value_of(left ? sub.a : sub.b));
+                }
+            }
+            if (invert && term.target != next) {
+                emit_jump(Op::jmp, 0, term.target);
+            }
+        }
+
+        inline void gen_phi_moves(ir::BlockId b, ir::BlockId succ) {
+            const ir::Block& block = fn->blocks[succ];
+            const std::span<const ir::BlockId> preds = fn->preds_of(succ);
+            uint32_t edge = 0;
+            while (preds[edge] != b) {
+                edge++;
+            }
+            for (ir::Value v = block.first; v < block.end; v++) {
+                if (fn->insts[v].op == ir::Op::phi) {
+                    const ir::Value arg = fn->args_of(v)[edge];
+                    if (imm(arg)) {
+                        emit(Op::movk, reg(v));
+                        emit_k(value_of(arg));
+                    } else if (reg(arg) != reg(v)) {
+                        emit(Op::mov, reg(v));
+                        emit_word(reg(arg));
+                    }
+                } else if (fn->insts[v].op != ir::Op::nop) {
+                    break;
+                }
+            }
+        }
+
+        inline void emit(Op op, uint32_t first) {
+            program.code.push_back(static_cast<uint32_t>(op) | first << 8);
+        }
+
+        inline void emit_word(uint32_t word) {
+            program.code.push_back(word);
+        }
+
+        inline void emit_k(uint64_t k) {
+            program.code.push_back(static_cast<uint32_t>(k));
+            program.code.push_back(static_cast<uint32_t>(k >> 32));
+        }
+
+        inline void emit_jump(Op op, uint32_t first, ir::BlockId target) {
+            emit(op, first);
+            fixup(target);
+        }
+
+        inline void fixup(ir::BlockId target) {
+            fixups.push_back({ .at = program.code.size(), .block = target });
+            program.code.push_back(0);
+        }
+
+        const ir::Module& module;
+        const bool superinstructions;
+        Program program {};
+        // The function being generated and its register count so far.
+        const ir::Function* fn = nullptr;
+        uint32_t registers = 0;
+        std::vector<uint32_t> regs {};
+        std::vector<bool> folded {};
+        std::vector<uint64_t> values {};
+        std::vector<uint32_t> uses {};
+        std::vector<Fixup> fixups {};
+};
+
+}
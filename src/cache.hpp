@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+// 128-bit digest of a byte string: two 64-bit lanes, each folding 8-byte words
+// through a full 64x64->128 multiply. Not cryptographic, but fast and well
+// mixed enough to key a cache of source files.
+struct Digest {
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+
+    [[nodiscard]] inline std::string hex() const {
+        static constexpr char digits[] = "0123456789abcdef";
+        std::string out(32, '0');
+        for (int i = 0; i < 16; i++) {
+            out[15 - i] = digits[(hi >> (i * 4)) & 15];
+            out[31 - i] = digits[(lo >> (i * 4)) & 15];
+        }
+        return out;
+    }
+};
+
+class Hasher {
+    public:
+        inline void update(std::string_view data) {
+            const char* p = data.data();
+            size_t n = data.size();
+            total += n;
+            for (; n >= 16; p += 16, n -= 16) {
+                uint64_t a;
+                uint64_t b;
+                std::memcpy(&a, p, 8);
+                std::memcpy(&b, p + 8, 8);
+                lo = mix(lo ^ a, 0xe7037ed1a0b428dbull);
+                hi = mix(hi ^ b, 0x8ebc6af09c88c6e3ull);
+            }
+            uint64_t tail[2] = {};
+            std::memcpy(tail, p, n);
+            lo = mix(lo ^ tail[0] ^ n, 0xa0761d6478bd642full);
+            hi = mix(hi ^ tail[1] ^ lo, 0x589965cc75374cc3ull);
+        }
+
+        [[nodiscard]] inline Digest digest() const {
+            const uint64_t a = mix(lo ^ total, 0x1d8e4e27c47d124full);
+            return { .lo = a, .hi = mix(hi ^ a, 0x9e3779b97f4a7c15ull) };
+        }
+
+    private:
+        static inline uint64_t mix(uint64_t x, uint64_t k) {
+            const __uint128_t m = static_cast<__uint128_t>(x ^ k) * (k | 1);
+            return static_cast<uint64_t>(m) ^ static_cast<uint64_t>(m >> 64);
+        }
+
+        uint64_t lo = 0x243f6a8885a308d3ull;
+        uint64_t hi = 0x13198a2e03707344ull;
+        uint64_t total = 0;
+};
+
+// On-disk store of finished executables keyed by Digest. Entries are written
+// to a temporary file and renamed into place, so concurrent compiles (threads
+// or processes) never observe a partial entry. Reads bump an entry's mtime and
+// stores evict the least recently used entries once `max_bytes` is exceeded.
+class CompileCache {
+    public:
+        inline CompileCache(std::filesystem::path dir, uint64_t max_bytes) : dir(std::move(dir)), max_bytes(max_bytes) {
+            std::error_code ec;
+            std::filesystem::create_directories(this->dir, ec);
+        }
+
+        // Copies the entry for `key` to `output_path`. Returns false on a miss.
+        inline bool fetch(const Digest& key, const std::string& output_path) {
+            const std::filesystem::path entry = entry_path(key);
+            std::error_code ec;
+            if (!std::filesystem::exists(entry, ec) || !copy_atomic(entry, output_path, 0755)) {
+                misses++;
+                return false;
+            }
+            std::filesystem::last_write_time(entry, std::filesystem::file_time_type::clock::now(), ec);
+            hits++;
+            return true;
+        }
+
+        // Adds `file` as the entry for `key`, then trims the cache to size.
+        inline void store(const Digest& key, const std::string& file) {
+            const std::filesystem::path entry = entry_path(key);
+            std::error_code ec;
+            std::filesystem::create_directories(entry.parent_path(), ec);
+            if (!copy_atomic(file, entry, 0644)) {
+                return;
+            }
+            stores++;
+            const uint64_t size = std::filesystem::file_size(entry, ec);
+            std::lock_guard lock(mutex);
+            // The directory is only rescanned to seed the running total and when
+            // it goes over the limit; other processes' stores show up then.
+            if (!total_bytes.has_value() || total_bytes.value() + size > max_bytes) {
+                total_bytes = evict();
+            } else {
+                total_bytes.value() += size;
+            }
+        }
+
+        [[nodiscard]] inline uint64_t hit_count() const {
+            return hits;
+        }
+
+        [[nodiscard]] inline uint64_t miss_count() const {
+            return misses;
+        }
+
+        [[nodiscard]] inline uint64_t store_count() const {
+            return stores;
+        }
+
+        [[nodiscard]] inline uint64_t eviction_count() const {
+            return evictions;
+        }
+
+    private:
+        struct Entry {
+            std::filesystem::path path;
+            std::filesystem::file_time_type used;
+            uint64_t size;
+        };
+
+        [[nodiscard]] inline std::filesystem::path entry_path(const Digest& key) const {
+            const std::string name = key.hex();
+            return dir / name.substr(0, 2) / name.substr(2);
+        }
+
+        // Copies `from` over `to` through a uniquely named sibling and rename(2).
+        inline bool copy_atomic(const std::filesystem::path& from, const std::filesystem::path& to, mode_t mode) {
+            const std::filesystem::path tmp = to.string() + ".tmp." + std::to_string(getpid()) + "."
+                + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + "." + std::to_string(temp_id++);
+            {
+                std::ifstream in(from, std::ios::binary);
+                std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+                if (!in || !out || !(out << in.rdbuf())) {
+                    out.close();
+                    std::error_code ec;
+                    std::filesystem::remove(tmp, ec);
+                    return false;
+                }
+            }
+            std::error_code ec;
+            if (chmod(tmp.c_str(), mode) == 0) {
+                std::filesystem::rename(tmp, to, ec);
+                if (!ec) {
+                    return true;
+                }
+            }
+            std::filesystem::remove(tmp, ec);
+            return false;
+        }
+
+        // Removes least recently used entries until the cache fits, returns its size.
+        inline uint64_t evict() {
+            std::vector<Entry> entries;
+            uint64_t total = 0;
+            std::error_code ec;
+            for (auto it = std::filesystem::recursive_directory_iterator(dir, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+                // Entries may vanish under a concurrent eviction; skip those.
+                std::error_code entry_ec;
+                if (!it->is_regular_file(entry_ec) || it->path().filename().string().find(".tmp.") != std::string::npos) {
+                    continue;
+                }
+                const uint64_t size = it->file_size(entry_ec);
+                const std::filesystem::file_time_type used = it->last_write_time(entry_ec);
+                if (entry_ec) {
+                    continue;
+                }
+                entries.push_back({ .path = it->path(), .used = used, .size = size });
+                total += size;
+            }
+            if (total <= max_bytes) {
+                return total;
+            }
+            std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+                return a.used < b.used;
+            });
+            for (const Entry& entry : entries) {
+                if (total <= max_bytes) {
+                    break;
+                }
+                std::error_code entry_ec;
+                if (std::filesystem::remove(entry.path, entry_ec)) {
+                    evictions++;
+                }
+                total -= entry.size;
+            }
+            return total;
+        }
+
+        const std::filesystem::path dir;
+        const uint64_t max_bytes;
+        std::atomic<uint64_t> hits = 0;
+        std::atomic<uint64_t> misses = 0;
+        std::atomic<uint64_t> stores = 0;
+        std::atomic<uint64_t> evictions = 0;
+        std::atomic<uint64_t> temp_id = 0;
+        std::mutex mutex;
+        std::optional<uint64_t> total_bytes;
+};
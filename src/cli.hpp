@@ -0,0 +1,193 @@
+#pragma once
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <new>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "./driver.hpp"
+
+// Parsed command line, shared by the compiler itself, the compile server and
+// its client.
+struct CommandLine {
+    Options options;
+    bool time_passes = false;
+    bool print_stats = false;
+    bool dump_ir = false;
+    // Runs the program in this process instead of writing an executable; its
+    // exit code becomes the exit status.
+    bool run = false;
+    std::string json_path;
+    // Executable written in single-file mode, relative to the working directory.
+    std::string output_path = "../output";
+    std::string out_dir;
+    std::string cache_dir;
+    uint64_t cache_mb = 256;
+    size_t jobs = ThreadPool::default_threads();
+    std::vector<std::string> inputs;
+
+    bool server = false;
+    bool server_stats = false;
+    bool server_stop = false;
+    std::string socket_path;
+
+    bool valid = true;
+};
+
+inline CommandLine parse_command_line(const std::vector<std::string>& args) {
+    CommandLine cmd;
+    for (size_t i = 0; i < args.size(); i++) {
+        const std::string& arg = args[i];
+        if (arg == "-O0" || arg == "-O1") {
+            cmd.options.opt_level = arg[2] - '0';
+        } else if (arg == "--nasm") {
+            cmd.options.use_nasm = true;
+        } else if (arg == "--time-passes") {
+            cmd.time_passes = true;
+        } else if (arg == "--stats") {
+            cmd.print_stats = true;
+        } else if (arg == "--dump-ir") {
+            cmd.dump_ir = true;
+        } else if (arg == "--run") {
+            cmd.run = true;
+        } else if (arg == "--bytecode") {
+            cmd.options.bytecode = true;
+        } else if (arg.starts_with("--stats-json=")) {
+            cmd.json_path = arg.substr(13);
+        } else if (arg.starts_with("--cache-dir=")) {
+            cmd.cache_dir = arg.substr(12);
+        } else if (arg.starts_with("--cache-size=")) {
+            cmd.cache_mb = std::strtoull(arg.c_str() + 13, nullptr, 10);
+        } else if (arg.starts_with("--output=")) {
+            cmd.output_path = arg.substr(9);
+        } else if (arg == "-o" && i + 1 < args.size()) {
+            cmd.out_dir = args[++i];
+        } else if (arg == "-j" && i + 1 < args.size()) {
+            cmd.jobs = std::strtoul(args[++i].c_str(), nullptr, 10);
+            cmd.valid &= cmd.jobs > 0;
+        } else if (arg == "--server") {
+            cmd.server = true;
+        } else if (arg == "--server-stats") {
+            cmd.server_stats = true;
+        } else if (arg == "--server-stop") {
+            cmd.server_stop = true;
+        } else if (arg.starts_with("--socket=")) {
+            cmd.socket_path = arg.substr(9);
+        } else if (arg == "-" || (!arg.empty() && arg[0] != '-')) {
+            cmd.inputs.push_back(arg);
+        } else {
+            cmd.valid = false;
+        }
+    }
+    const bool server_command = cmd.server || cmd.server_stats || cmd.server_stop;
+    if (!server_command && (cmd.inputs.empty() || (cmd.inputs.size() > 1 && cmd.out_dir.empty()))) {
+        cmd.valid = false;
+    }
+    // Dumps from a parallel batch would interleave.
+    if (cmd.dump_ir && !cmd.out_dir.empty()) {
+        cmd.valid = false;
+    }
+    if (cmd.run && (!cmd.out_dir.empty() || cmd.options.use_nasm)) {
+        cmd.valid = false;
+    }
+    if (cmd.options.bytecode && cmd.options.use_nasm) {
+        cmd.valid = false;
+    }
+    return cmd;
+}
+
+inline void print_usage(std::ostream& err) {
+    err << "Incorrect Usage!" << std::endl;
+    err << "Correct Usage : ./main.exe [-O0|-O1] [--nasm|--bytecode] [--dump-ir] [--time-passes] [--stats] [--stats-json=<file|->] [--cache-dir=<dir>] [--cache-size=<MB>] [--output=<file>] <input.ps|->" << std::endl;
+    err << "                ./main.exe [-O0|-O1] [--bytecode] [--dump-ir] [--time-passes] [--stats] [--stats-json=<file|->] --run <input.ps|input.psb|->" << std::endl;
+    err << "                ./main.exe [-O0|-O1] [--nasm|--bytecode] [--time-passes] [--stats] [--stats-json=<file|->] [--cache-dir=<dir>] [--cache-size=<MB>] [-j <jobs>] -o <dir> <input.ps>..." << std::endl;
+    err << "                ./main.exe --server|--server-stats|--server-stop [--socket=<path>]" << std::endl;
+}
+
+// Runs a compile command line. Relative paths are taken relative to `cwd`
+// (the process's own directory when empty); diagnostics go to `err` and
+// --stats-json=- to `out`. Returns the exit status.
+inline int run_command(CommandLine cmd, const std::filesystem::path& cwd, std::ostream& out, std::ostream& err,
+                       ArenaAllocator& allocator) {
+    const auto resolve = [&cwd](const std::string& path) {
+        return (cwd / path).string();
+    };
+
+    Stats stats(cmd.time_passes || cmd.print_stats || !cmd.json_path.empty());
+    bool failed = false;
+    int status = EXIT_SUCCESS;
+
+    std::optional<CompileCache> cache;
+    if (!cmd.cache_dir.empty()) {
+        cache.emplace(resolve(cmd.cache_dir), cmd.cache_mb * 1024 * 1024);
+        cmd.options.cache = &cache.value();
+    }
+    for (std::string& input : cmd.inputs) {
+        if (input != "-") {
+            input = resolve(input);
+        }
+    }
+
+    if (!cmd.out_dir.empty()) {
+        std::vector<FileResult> results;
+        {
+            const Stats::Timer timer = stats.time("batch");
+            results = compile_batch(cmd.inputs, resolve(cmd.out_dir), cmd.options, stats, cmd.jobs);
+        }
+        size_t failures = 0;
+        for (const FileResult& result : results) {
+            if (!result.ok()) {
+                err << result.input << ": " << result.error << std::endl;
+                failures++;
+            }
+        }
+        stats.count("files", results.size());
+        stats.count("failed", failures);
+        failed = failures > 0;
+    } else {
+        if (cmd.dump_ir) {
+            cmd.options.dump_ir = &out;
+        }
+        try {
+            if (cmd.run) {
+                status = static_cast<int>(run_file(cmd.inputs[0], cmd.options, allocator, stats) & 0xff);
+            } else {
+                compile_file(cmd.inputs[0], resolve(cmd.output_path), cmd.options, allocator, stats);
+            }
+        } catch (const CompileError& error) {
+            err << error.what() << std::endl;
+            return EXIT_FAILURE;
+        } catch (const std::bad_alloc&) {
+            err << "Out of memory" << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (stats.enabled()) {
+        if (cache.has_value()) {
+            stats.count("cache.hits", cache->hit_count());
+            stats.count("cache.misses", cache->miss_count());
+            stats.count("cache.stores", cache->store_count());
+            stats.count("cache.evictions", cache->eviction_count());
+        }
+        stats.count("peak_rss_kb", Stats::peak_rss_kb());
+        if (cmd.time_passes) {
+            stats.print_phases(err);
+        }
+        if (cmd.print_stats) {
+            stats.print_counters(err);
+        }
+        if (cmd.json_path == "-") {
+            stats.write_json(out);
+        } else if (!cmd.json_path.empty()) {
+            std::ofstream json(resolve(cmd.json_path));
+            stats.write_json(json);
+        }
+    }
+
+    return failed ? EXIT_FAILURE : status;
+}
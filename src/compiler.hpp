@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "./driver.hpp"
+
+// Library entry point. compile() turns a program held in memory into x86-64
+// machine code without touching the file system or exiting; errors come back
+// as diagnostics. Calls share no mutable state, so any number of threads may
+// compile at once as long as they do not share the streams set in Options.
+// Options::use_nasm and Options::cache only apply to compile_file.
+
+struct Diagnostic {
+    std::string message;
+    // 0 when the error is not tied to a source line.
+    uint32_t line = 0;
+};
+
+struct Result {
+    // Runs from its first byte and ends in the exit syscall or, with
+    // Options::jit, returns the exit code to a JitCode caller. With
+    // Options::bytecode, serialized bytecode for bytecode::deserialize.
+    std::vector<uint8_t> code;
+    std::vector<Diagnostic> diagnostics;
+
+    [[nodiscard]] inline bool ok() const {
+        return diagnostics.empty();
+    }
+
+    // The code wrapped in the static ELF executable compile_file writes.
+    [[nodiscard]] inline std::vector<uint8_t> executable() const {
+        return elf::image(code);
+    }
+};
+
+[[nodiscard]] inline Result compile(std::string_view source, const Options& options = {}) {
+    Result result;
+    ArenaAllocator allocator;
+    Stats stats;
+    try {
+        result.code = compile_code(source, options, allocator, stats);
+    } catch (const CompileError& error) {
+        result.diagnostics.push_back({ .message = error.what(), .line = error.line() });
+    } catch (const std::bad_alloc&) {
+        result.diagnostics.push_back({ .message = "Out of memory" });
+    }
+    return result;
+}
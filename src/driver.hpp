@@ -0,0 +1,371 @@
+#pragma once
+
+#include <cstdlib>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "./tokenizer.hpp"
+#include "./parser.hpp"
+#include "./optimizer.hpp"
+#include "./lower.hpp"
+#include "./ir_opt.hpp"
+#include "./inliner.hpp"
+#include "./generator.hpp"
+#include "./peephole.hpp"
+#include "./encoder.hpp"
+#include "./elf.hpp"
+#include "./jit.hpp"
+#include "./bytecode.hpp"
+#include "./interpreter.hpp"
+#include "./error.hpp"
+#include "./source.hpp"
+#include "./stats.hpp"
+#include "./cache.hpp"
+#include "./thread_pool.hpp"
+
+// Part of every cache key; __DATE__/__TIME__ make a rebuilt compiler miss
+// entries left by the previous build.
+inline constexpr std::string_view compiler_version = "0.1 (" __DATE__ " " __TIME__ ")";
+
+struct Options {
+    int opt_level = 1;
+    bool use_nasm = false;
+    // Generates a function that returns the exit code, for JitCode, instead
+    // of an entry point that ends in the exit syscall.
+    bool jit = false;
+    // Generates serialized bytecode for the Interpreter instead of machine
+    // code.
+    bool bytecode = false;
+    CompileCache* cache = nullptr;
+    // Receives the optimized IR of every compiled program when set.
+    std::ostream* dump_ir = nullptr;
+    // Receives the nasm source of every program encoded to machine code
+    // when set.
+    std::ostream* listing = nullptr;
+};
+
+[[nodiscard]] inline Digest cache_key(std::string_view source, const Options& options) {
+    Hasher hasher;
+    hasher.update(compiler_version);
+    const char flags[] = {
+        static_cast<char>('0' + options.opt_level), options.use_nasm ? 'n' : 'e', options.jit ? 'j' : 'x',
+        options.bytecode ? 'b' : 'm',
+    };
+    hasher.update(std::string_view(flags, sizeof(flags)));
+    hasher.update(source);
+    return hasher.digest();
+}
+
+// Parses the program behind `parser` and runs the AST passes selected by `options`.
+inline Ast parse_source(Parser& parser, const Options& options, ArenaAllocator& allocator, Stats& stats) {
+    std::optional<Ast> prog;
+    {
+        // The parser pulls tokens from the tokenizer as it goes, so lexing is
+        // timed with it: timing each refill would cost more than lexing a
+        // token.
+        const Stats::Timer timer = stats.time("lex+parse");
+        prog = parser.parse_prog();
+    }
+
+    if (!prog.has_value()) {
+        throw CompileError("No return statement found");
+    }
+    stats.count("tokens", parser.token_count());
+    stats.count_nodes(prog.value());
+
+    if (options.opt_level > 0) {
+        const Stats::Timer timer = stats.time("optimize");
+        Optimizer optimizer;
+        optimizer.optimize(prog.value());
+    }
+    stats.count("arena_bytes_used", allocator.bytes_used());
+    stats.count("arena_bytes_reserved", allocator.bytes_reserved());
+    return prog.value();
+}
+
+// Lowers `prog` to SSA form and runs the IR passes selected by `options`:
+// at -O1 every function is optimized and has the calls worth it inlined.
+inline ir::Module lower_prog(const Ast& prog, const Options& options, Stats& stats) {
+    ir::Module module;
+    {
+        const Stats::Timer timer = stats.time("lower");
+        module = Lowering(prog).lower();
+    }
+    size_t insts = module.main.insts.size();
+    size_t blocks = module.main.blocks.size();
+    for (const ir::Function& fn : module.functions) {
+        insts += fn.insts.size();
+        blocks += fn.blocks.size();
+    }
+    stats.count("ir.insts", insts);
+    stats.count("ir.blocks", blocks);
+    stats.count("ir.functions", module.functions.size());
+
+    if (options.opt_level > 0) {
+        const Stats::Timer timer = stats.time("ir_opt");
+        ir::Optimizer optimizer;
+        ir::Inliner inliner(optimizer);
+        inliner.run(module);
+        stats.count("ir.copies_propagated", optimizer.copies_propagated());
+        stats.count("ir.constants_folded", optimizer.constants_folded());
+        stats.count("ir.dead_removed", optimizer.dead_removed());
+        stats.count("ir.branches_folded", optimizer.branches_folded());
+        stats.count("ir.jumps_threaded", optimizer.jumps_threaded());
+        stats.count("ir.calls_inlined", inliner.calls_inlined());
+        stats.count("ir.functions_removed", inliner.functions_removed());
+    }
+    if (options.dump_ir) {
+        ir::print(*options.dump_ir, module);
+    }
+    return module;
+}
+
+// Generates code into `out`, through the peephole optimizer unless at -O0.
+inline void gen_code(Generator& generator, AsmSink& out, const Options& options, Stats& stats) {
+    if (options.opt_level == 0) {
+        generator.gen_prog(out);
+    } else {
+        peephole::Optimizer peephole(out);
+        generator.gen_prog(peephole);
+        peephole.finish();
+        for (size_t i = 0; i < peephole.rule_set().size(); i++) {
+            stats.count(peephole.rule_set()[i].name, peephole.hits()[i]);
+        }
+    }
+    stats.count("labels", generator.labels());
+}
+
+inline std::vector<uint8_t> encode_prog(Generator& generator, const Options& options, Stats& stats) {
+    const Stats::Timer timer = stats.time("codegen");
+    Encoder encoder;
+    if (options.listing) {
+        OutputBuffer buffer;
+        AsmPrinter printer(buffer);
+        AsmTee tee(encoder, printer);
+        gen_code(generator, tee, options, stats);
+        *options.listing << buffer.str();
+    } else {
+        gen_code(generator, encoder, options, stats);
+    }
+    std::vector<uint8_t> code = encoder.finish();
+    stats.count("code_bytes", code.size());
+    return code;
+}
+
+// Compiles source text to bytecode for the Interpreter.
+inline bytecode::Program compile_bytecode(std::string_view source, const Options& options, ArenaAllocator& allocator,
+                                          Stats& stats) {
+    Tokenizer tokenizer(source);
+    Parser parser(tokenizer, allocator);
+    const ir::Module module = lower_prog(parse_source(parser, options, allocator, stats), options, stats);
+    const Stats::Timer timer = stats.time("codegen");
+    bytecode::Program program = bytecode::Generator(module).generate();
+    stats.count("bytecode_words", program.code.size());
+    stats.count("bytecode_registers", program.registers);
+    return program;
+}
+
+// Compiles source text straight to machine code for elf::write_executable,
+// or to serialized bytecode with Options::bytecode.
+inline std::vector<uint8_t> compile_code(std::string_view source, const Options& options, ArenaAllocator& allocator, Stats& stats) {
+    if (options.bytecode) {
+        return bytecode::serialize(compile_bytecode(source, options, allocator, stats));
+    }
+    Tokenizer tokenizer(source);
+    Parser parser(tokenizer, allocator);
+    Generator generator(lower_prog(parse_source(parser, options, allocator, stats), options, stats), options.jit);
+    return encode_prog(generator, options, stats);
+}
+
+// Opens `input_path` into `file` and returns its text. Throws CompileError.
+inline std::string_view read_source(std::optional<SourceFile>& file, const std::string& input_path, Stats& stats) {
+    {
+        const Stats::Timer timer = stats.time("read");
+        file.emplace(input_path);
+        if (!file->ok()) {
+            throw CompileError("Could not read " + input_path);
+        }
+    }
+    stats.count("source_bytes", file->text().size());
+    return file->text();
+}
+
+// Compiles one .ps file ("-" for standard input) into the executable
+// `output_path`; with use_nasm the assembly goes through `output_path`.asm
+// and .o on the way. The source is mapped rather than copied (see
+// SourceFile). The AST lives in `allocator`, which the caller may reset
+// afterwards. With a cache, a hit copies the stored executable and skips
+// every later phase. Throws CompileError.
+inline void compile_file(const std::string& input_path, const std::string& output_path, const Options& options,
+                         ArenaAllocator& allocator, Stats& stats) {
+    std::optional<SourceFile> file;
+    const std::string_view contents = read_source(file, input_path, stats);
+
+    std::optional<Digest> key;
+    if (options.cache && !options.dump_ir && !options.listing) {
+        const Stats::Timer timer = stats.time("cache");
+        key = cache_key(contents, options);
+        if (options.cache->fetch(key.value(), output_path)) {
+            return;
+        }
+    }
+
+    if (options.use_nasm) {
+        Tokenizer tokenizer(contents);
+        Parser parser(tokenizer, allocator);
+        Generator generator(lower_prog(parse_source(parser, options, allocator, stats), options, stats));
+        const std::string asm_path = output_path + ".asm";
+        const std::string obj_path = output_path + ".o";
+        const int fd = open(asm_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            throw CompileError("Could not write " + asm_path);
+        }
+        {
+            const Stats::Timer timer = stats.time("codegen");
+            OutputBuffer buffer(fd);
+            AsmPrinter printer(buffer);
+            gen_code(generator, printer, options, stats);
+            const bool flushed = buffer.flush();
+            close(fd);
+            if (!flushed) {
+                throw CompileError("Could not write " + asm_path);
+            }
+            stats.count("asm_bytes", buffer.size());
+        }
+
+        {
+            const Stats::Timer timer = stats.time("nasm");
+            if (system(("nasm -felf64 " + asm_path + " -o " + obj_path).c_str()) != 0) {
+                throw CompileError("nasm failed on " + asm_path);
+            }
+        }
+        {
+            const Stats::Timer timer = stats.time("ld");
+            if (system(("ld -o " + output_path + " " + obj_path).c_str()) != 0) {
+                throw CompileError("ld failed on " + obj_path);
+            }
+        }
+    } else {
+        const std::vector<uint8_t> code = compile_code(contents, options, allocator, stats);
+        const Stats::Timer timer = stats.time("write");
+        const bool written = options.bytecode ? bytecode::write_file(output_path, code) : elf::write_executable(output_path, code);
+        if (!written) {
+            throw CompileError("Could not write " + output_path);
+        }
+    }
+
+    if (key.has_value()) {
+        options.cache->store(key.value(), output_path);
+    }
+}
+
+inline uint64_t interpret(const bytecode::Program& program, Stats& stats) {
+    const Stats::Timer timer = stats.time("run");
+    Interpreter interpreter(program);
+    const std::optional<uint64_t> status = interpreter.run();
+    if (!status.has_value()) {
+        throw CompileError(interpreter.trap() == Interpreter::Trap::stack_overflow ? "Stack overflow" : "Division by zero");
+    }
+    return status.value();
+}
+
+// Compiles one .ps file ("-" for standard input) as a function and runs it
+// in this process, without the cache, an executable or the linker. With
+// Options::bytecode, or when the file holds bytecode written earlier, the
+// Interpreter runs it instead. Returns the program's exit code. Throws
+// CompileError, also when an interpreted program traps.
+inline uint64_t run_file(const std::string& input_path, Options options, ArenaAllocator& allocator, Stats& stats) {
+    std::optional<SourceFile> file;
+    const std::string_view contents = read_source(file, input_path, stats);
+    if (bytecode::is_bytecode(contents)) {
+        const std::optional<bytecode::Program> program = bytecode::deserialize(contents);
+        if (!program.has_value()) {
+            throw CompileError("Invalid bytecode in " + input_path);
+        }
+        return interpret(program.value(), stats);
+    }
+    if (options.bytecode) {
+        return interpret(compile_bytecode(contents, options, allocator, stats), stats);
+    }
+    options.jit = true;
+    const std::vector<uint8_t> code = compile_code(contents, options, allocator, stats);
+    const JitCode jit(code);
+    if (!jit.ok()) {
+        throw CompileError("Could not map executable memory");
+    }
+    const Stats::Timer timer = stats.time("run");
+    return jit.run();
+}
+
+struct FileResult {
+    std::string input;
+    std::string output;
+    std::string error;
+
+    [[nodiscard]] inline bool ok() const {
+        return error.empty();
+    }
+};
+
+// Compiles every input into `out_dir`/<stem> on a work-stealing pool. Each
+// worker reuses one ArenaAllocator across its files and builds a fresh
+// Tokenizer, Parser and Generator per file; failures are recorded in the
+// returned results, which keep the order of `inputs`. When `stats` is
+// enabled, every file's phases and counters are added into it.
+inline std::vector<FileResult> compile_batch(const std::vector<std::string>& inputs, const std::string& out_dir,
+                                             const Options& options, Stats& stats,
+                                             size_t threads = ThreadPool::default_threads()) {
+    std::vector<FileResult> results(inputs.size());
+    std::error_code ec;
+    std::filesystem::create_directories(out_dir, ec);
+    if (ec) {
+        for (size_t i = 0; i < inputs.size(); i++) {
+            results[i] = { .input = inputs[i], .output = {}, .error = "Could not create " + out_dir + ": " + ec.message() };
+        }
+        return results;
+    }
+
+    std::unordered_set<std::string> outputs;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        results[i].input = inputs[i];
+        results[i].output = (std::filesystem::path(out_dir) / std::filesystem::path(inputs[i]).stem()).string();
+        if (!outputs.insert(results[i].output).second) {
+            results[i].error = "Output " + results[i].output + " is already produced by another input";
+        }
+    }
+
+    ThreadPool pool(std::min(threads, std::max<size_t>(inputs.size(), 1)));
+    std::vector<std::unique_ptr<ArenaAllocator>> arenas(pool.size());
+    for (std::unique_ptr<ArenaAllocator>& arena : arenas) {
+        arena = std::make_unique<ArenaAllocator>();
+    }
+    std::vector<Stats> file_stats(inputs.size(), Stats(stats.enabled()));
+    for (size_t i = 0; i < results.size(); i++) {
+        if (!results[i].ok()) {
+            continue;
+        }
+        pool.submit([&result = results[i], &stats = file_stats[i], &arenas, &options](size_t worker) {
+            ArenaAllocator& allocator = *arenas[worker];
+            try {
+                compile_file(result.input, result.output, options, allocator, stats);
+            } catch (const CompileError& error) {
+                result.error = error.what();
+            } catch (const std::bad_alloc&) {
+                result.error = "Out of memory";
+            }
+            allocator.reset();
+        });
+    }
+    pool.wait();
+    for (const Stats& file : file_stats) {
+        stats.merge(file);
+    }
+    return results;
+}
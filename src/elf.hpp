@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+// Minimal static ELF64 executable for x86-64 Linux: the headers and the code
+// share one read+execute PT_LOAD segment and execution starts at the first
+// byte of code.
+namespace elf {
+
+inline constexpr uint64_t base_addr = 0x400000;
+inline constexpr size_t ehdr_size = 64;
+inline constexpr size_t phdr_size = 56;
+inline constexpr size_t code_offset = ehdr_size + phdr_size;
+
+template<typename T>
+inline uint8_t* put(uint8_t* at, T value) {
+    std::memcpy(at, &value, sizeof(T));
+    return at + sizeof(T);
+}
+
+[[nodiscard]] inline std::vector<uint8_t> image(const std::vector<uint8_t>& code) {
+    const uint64_t file_size = code_offset + code.size();
+    std::vector<uint8_t> out(file_size);
+    uint8_t* p = out.data();
+
+    const uint8_t ident[16] = { 0x7f, 'E', 'L', 'F', 2, 1, 1, 0 };
+    std::memcpy(p, ident, sizeof(ident));
+    p += sizeof(ident);
+    p = put<uint16_t>(p, 2);                       // e_type: ET_EXEC
+    p = put<uint16_t>(p, 62);                      // e_machine: EM_X86_64
+    p = put<uint32_t>(p, 1);                       // e_version
+    p = put<uint64_t>(p, base_addr + code_offset); // e_entry
+    p = put<uint64_t>(p, ehdr_size);               // e_phoff
+    p = put<uint64_t>(p, 0);                       // e_shoff
+    p = put<uint32_t>(p, 0);                       // e_flags
+    p = put<uint16_t>(p, ehdr_size);               // e_ehsize
+    p = put<uint16_t>(p, phdr_size);               // e_phentsize
+    p = put<uint16_t>(p, 1);                       // e_phnum
+    p = put<uint16_t>(p, 0);                       // e_shentsize
+    p = put<uint16_t>(p, 0);                       // e_shnum
+    p = put<uint16_t>(p, 0);                       // e_shstrndx
+
+    p = put<uint32_t>(p, 1);                       // p_type: PT_LOAD
+    p = put<uint32_t>(p, 5);                       // p_flags: R + X
+    p = put<uint64_t>(p, 0);                       // p_offset
+    p = put<uint64_t>(p, base_addr);               // p_vaddr
+    p = put<uint64_t>(p, base_addr);               // p_paddr
+    p = put<uint64_t>(p, file_size);               // p_filesz
+    p = put<uint64_t>(p, file_size);               // p_memsz
+    p = put<uint64_t>(p, 0x1000);                  // p_align
+
+    if (!code.empty()) {
+        std::memcpy(p, code.data(), code.size());
+    }
+    return out;
+}
+
+// Writes an executable file at `path`, returns false when it cannot be written.
+inline bool write_executable(const std::string& path, const std::vector<uint8_t>& code) {
+    const std::vector<uint8_t> bytes = image(code);
+    {
+        std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file) {
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+        if (!file) {
+            return false;
+        }
+    }
+    return chmod(path.c_str(), 0755) == 0;
+}
+
+}
@@ -0,0 +1,259 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#include "./asm.hpp"
+#include "./error.hpp"
+
+// Encodes the Generator's instruction stream straight into x86-64 machine code.
+// Jumps and calls are emitted with 32-bit displacements and patched once
+// every label is known, in finish().
+class Encoder : public AsmSink {
+    public:
+        inline void emit(const Instr& instr) override {
+            const Operand& dst = instr.dst;
+            const Operand& src = instr.src;
+            switch (instr.mnemonic) {
+                case Mnemonic::label:
+                    define_label(static_cast<uint32_t>(dst.imm));
+                    break;
+                case Mnemonic::mov:
+                    if (dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::imm) {
+                        mov_imm(dst.reg, src.imm);
+                    } else if (src.kind == Operand::Kind::reg) {
+                        rm(0x89, src.reg, dst);
+                    } else {
+                        rm(0x8b, dst.reg, src);
+                    }
+                    break;
+                case Mnemonic::push:
+                    if (dst.kind == Operand::Kind::reg) {
+                        short_reg(0x50, dst.reg);
+                    } else {
+                        rm(0xff, 6, dst, false);
+                    }
+                    break;
+                case Mnemonic::pop:
+                    short_reg(0x58, dst.reg);
+                    break;
+                case Mnemonic::add:
+                    arith(0x01, 0, dst, src);
+                    break;
+                case Mnemonic::sub:
+                    arith(0x29, 5, dst, src);
+                    break;
+                case Mnemonic::mul:
+                    rm(0xf7, 4, dst);
+                    break;
+                case Mnemonic::div:
+                    rm(0xf7, 6, dst);
+                    break;
+                case Mnemonic::imul:
+                    if (src.kind == Operand::Kind::imm) {
+                        const int64_t value = static_cast<int64_t>(src.imm);
+                        if (value >= INT8_MIN && value <= INT8_MAX) {
+                            rm(0x6b, dst.reg, dst);
+                            code.push_back(static_cast<uint8_t>(value));
+                        } else {
+                            rm(0x69, dst.reg, dst);
+                            imm32(static_cast<uint32_t>(value));
+                        }
+                    } else {
+                        rm(0x0faf, dst.reg, src);
+                    }
+                    break;
+                case Mnemonic::shl:
+                    rm(0xc1, 4, dst);
+                    code.push_back(static_cast<uint8_t>(src.imm));
+                    break;
+                case Mnemonic::shr:
+                    rm(0xc1, 5, dst);
+                    code.push_back(static_cast<uint8_t>(src.imm));
+                    break;
+                case Mnemonic::lea:
+                    rm(0x8d, dst.reg, src);
+                    break;
+                case Mnemonic::xor_:
+                    arith(0x31, 6, dst, src);
+                    break;
+                case Mnemonic::test:
+                    rm(0x85, src.reg, dst);
+                    break;
+                case Mnemonic::cmp:
+                    arith(0x39, 7, dst, src);
+                    break;
+                case Mnemonic::jz:
+                    code.push_back(0x0f);
+                    code.push_back(0x84);
+                    fixup(static_cast<uint32_t>(dst.imm));
+                    break;
+                case Mnemonic::jnz:
+                    code.push_back(0x0f);
+                    code.push_back(0x85);
+                    fixup(static_cast<uint32_t>(dst.imm));
+                    break;
+                case Mnemonic::jmp:
+                    code.push_back(0xe9);
+                    fixup(static_cast<uint32_t>(dst.imm));
+                    break;
+                case Mnemonic::syscall:
+                    code.push_back(0x0f);
+                    code.push_back(0x05);
+                    break;
+                case Mnemonic::ret:
+                    code.push_back(0xc3);
+                    break;
+                case Mnemonic::call:
+                    code.push_back(0xe8);
+                    fixup(static_cast<uint32_t>(dst.imm));
+                    break;
+            }
+        }
+
+        // Resolves jump targets and returns the finished code.
+        inline const std::vector<uint8_t>& finish() {
+            for (const Fixup& fix : fixups) {
+                if (fix.label >= labels.size() || labels[fix.label] == unbound) {
+                    throw CompileError("Undefined label: label" + std::to_string(fix.label));
+                }
+                const int32_t rel = static_cast<int32_t>(labels[fix.label] - (fix.at + 4));
+                for (int i = 0; i < 4; i++) {
+                    code[fix.at + i] = static_cast<uint8_t>(rel >> (i * 8));
+                }
+            }
+            fixups.clear();
+            return code;
+        }
+
+    private:
+        static constexpr int64_t unbound = -1;
+
+        struct Fixup {
+            size_t at;
+            uint32_t label;
+        };
+
+        static inline uint8_t low(Reg reg) {
+            return static_cast<uint8_t>(reg) & 7;
+        }
+
+        static inline bool high(Reg reg) {
+            return static_cast<uint8_t>(reg) >= 8;
+        }
+
+        inline void define_label(uint32_t label) {
+            if (label >= labels.size()) {
+                labels.resize(label + 1, unbound);
+            }
+            labels[label] = static_cast<int64_t>(code.size());
+        }
+
+        inline void fixup(uint32_t label) {
+            fixups.push_back({ .at = code.size(), .label = label });
+            code.insert(code.end(), 4, 0);
+        }
+
+        inline void imm32(uint32_t value) {
+            for (int i = 0; i < 4; i++) {
+                code.push_back(static_cast<uint8_t>(value >> (i * 8)));
+            }
+        }
+
+        inline void short_reg(uint8_t opcode, Reg reg) {
+            if (high(reg)) {
+                code.push_back(0x41);
+            }
+            code.push_back(opcode + low(reg));
+        }
+
+        inline void mov_imm(Reg reg, uint64_t value) {
+            if (value <= UINT32_MAX) {
+                short_reg(0xb8, reg);
+                imm32(static_cast<uint32_t>(value));
+            } else if (static_cast<int64_t>(value) >= INT32_MIN && static_cast<int64_t>(value) < 0) {
+                rm(0xc7, 0, Operand::r(reg));
+                imm32(static_cast<uint32_t>(value));
+            } else {
+                code.push_back(0x48 | high(reg));
+                code.push_back(0xb8 + low(reg));
+                for (int i = 0; i < 8; i++) {
+                    code.push_back(static_cast<uint8_t>(value >> (i * 8)));
+                }
+            }
+        }
+
+        // `op r/m, r` with `opcode`, `op r, r/m` with opcode + 2 and `op r/m, imm`
+        // through 0x83/0x81 with `ext` in the reg field.
+        inline void arith(uint8_t opcode, uint8_t ext, const Operand& dst, const Operand& src) {
+            if (src.kind == Operand::Kind::imm) {
+                const int64_t value = static_cast<int64_t>(src.imm);
+                if (value >= INT8_MIN && value <= INT8_MAX) {
+                    rm(0x83, ext, dst);
+                    code.push_back(static_cast<uint8_t>(value));
+                } else {
+                    rm(0x81, ext, dst);
+                    imm32(static_cast<uint32_t>(value));
+                }
+            } else if (src.kind == Operand::Kind::reg) {
+                rm(opcode, src.reg, dst);
+            } else {
+                rm(opcode + 2, dst.reg, src);
+            }
+        }
+
+        inline void rm(uint16_t opcode, Reg reg, const Operand& operand, bool wide = true) {
+            rm(opcode, static_cast<uint8_t>(reg), operand, wide);
+        }
+
+        // REX prefix, opcode and ModRM/SIB/displacement for a register, [base + disp]
+        // or [base + index * scale + disp]. An opcode above 0xff is a 0x0f escape
+        // followed by its low byte.
+        inline void rm(uint16_t opcode, uint8_t reg, const Operand& operand, bool wide = true) {
+            const Reg base = operand.reg;
+            const bool indexed = operand.kind == Operand::Kind::mem && operand.scale != 0;
+            const uint8_t rex = (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | (indexed && high(operand.index) ? 0x02 : 0)
+                | (high(base) ? 0x01 : 0);
+            if (rex) {
+                code.push_back(0x40 | rex);
+            }
+            if (opcode > 0xff) {
+                code.push_back(static_cast<uint8_t>(opcode >> 8));
+            }
+            code.push_back(static_cast<uint8_t>(opcode));
+            const uint8_t reg_bits = static_cast<uint8_t>((reg & 7) << 3);
+            if (operand.kind == Operand::Kind::reg) {
+                code.push_back(0xc0 | reg_bits | low(base));
+                return;
+            }
+            const int32_t disp = operand.disp;
+            uint8_t mod;
+            if (disp == 0 && low(base) != 5) {
+                mod = 0x00;
+            } else if (disp >= INT8_MIN && disp <= INT8_MAX) {
+                mod = 0x40;
+            } else {
+                mod = 0x80;
+            }
+            if (indexed) {
+                static constexpr uint8_t scale_bits[] = { 0, 0, 1, 0, 2, 0, 0, 0, 3 };
+                code.push_back(mod | reg_bits | 4);
+                code.push_back(static_cast<uint8_t>(scale_bits[operand.scale] << 6 | low(operand.index) << 3 | low(base)));
+            } else {
+                code.push_back(mod | reg_bits | low(base));
+                if (low(base) == 4) {
+                    code.push_back(0x24);
+                }
+            }
+            if (mod == 0x40) {
+                code.push_back(static_cast<uint8_t>(disp));
+            } else if (mod == 0x80) {
+                imm32(static_cast<uint32_t>(disp));
+            }
+        }
+
+        std::vector<uint8_t> code;
+        std::vector<int64_t> labels;
+        std::vector<Fixup> fixups;
+};
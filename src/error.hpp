@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+// A diagnostic that ends the compilation of one input. The driver reports it
+// and moves on to the next file (batch mode) or exits (single-file mode);
+// compile() returns it as a Diagnostic. `line` is 0 when the error is not
+// tied to a source line.
+class CompileError : public std::runtime_error {
+    public:
+        inline explicit CompileError(const std::string& message, uint32_t line = 0)
+            : std::runtime_error(message), error_line(line) {}
+
+        [[nodiscard]] inline uint32_t line() const {
+            return error_line;
+        }
+
+    private:
+        uint32_t error_line;
+};
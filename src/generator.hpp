@@ -1,248 +1,785 @@
-#pragma once
-
-#include <vector>
-#include <sstream>
-#include <map>
-#include <algorithm>
-
-#include "./tokenizer.hpp"
-#include "./parser.hpp"
-
-class Generator {
-    public:
-        inline explicit Generator(const NodeProg prog) : prog(std::move(prog)) {}
-        
-        inline void gen_term(const NodeTerm* term) {
-            struct TermVisitor {
-                Generator& gen;
-                void operator()(const NodeTermInt* term_int) {
-                    gen.output << "    mov rax, " << term_int->_int.value.value() << "\n";
-                    gen.push("rax");
-                }
-                void operator()(const NodeTermIdent* term_ident) {
-                auto itr = std::find_if(
-                            gen.vars.cbegin(),
-                            gen.vars.cend(),
-                            [&](const Var& var) { return var.name == term_ident->ident.value.value(); });
-                    if (itr == gen.vars.cend()) {
-                            std::cerr << "Identifier does not exist: " << term_ident->ident.value.value() << std::endl;
-                            exit(EXIT_FAILURE);
-                    }
-                    std::stringstream offset;
-                    offset << "QWORD [rsp + " << (gen.stack_size - (*itr).stack_loc - 1) * 8 << "]";
-                    gen.push(offset.str());
-                }
-                void operator()(const NodeTermParen* term_paren) {
-                    gen.gen_expr(term_paren->expr);
-                }
-            };
-            TermVisitor visitor { .gen = *this };
-            std::visit(visitor, term->var);
-        }
-
-        inline void gen_bin_expr(const NodeBinExpr* bin_expr) {
-            struct BinExprVisitor {
-                Generator& gen;
-                void operator()(const NodeBinExprSub* sub) const {
-                    gen.gen_expr(sub->rhs);
-                    gen.gen_expr(sub->lhs);
-                    gen.pop("rax");
-                    gen.pop("rbx");
-                    gen.output << "    sub rax, rbx\n";
-                    gen.push("rax");
-                }
-                void operator()(const NodeBinExprDiv* div) const {
-                    gen.gen_expr(div->rhs);
-                    gen.gen_expr(div->lhs);
-                    gen.pop("rax");
-                    gen.pop("rbx");
-                    gen.output << "    div rbx\n";
-                    gen.push("rax");
-                }
-                void operator()(const NodeBinExprAdd* add) const {
-                    gen.gen_expr(add->rhs);
-                    gen.gen_expr(add->lhs);
-                    gen.pop("rax");
-                    gen.pop("rbx");
-                    gen.output << "    add rax, rbx\n";
-                    gen.push("rax");
-                }
-                void operator()(const NodeBinExprMult* mult) const {
-                    gen.gen_expr(mult->rhs);
-                    gen.gen_expr(mult->lhs);
-                    gen.pop("rax");
-                    gen.pop("rbx");
-                    gen.output << "    mul rbx\n";
-                    gen.push("rax");
-                }
-
-            };
-            BinExprVisitor visitor { .gen = *this };
-            std::visit(visitor, bin_expr->var);
-        }
-
-        inline void gen_expr(const NodeExpr* expr) {
-            struct ExprVisitor {
-                Generator& gen;
-                void operator()(const NodeTerm* term) const {
-                    gen.gen_term(term);
-                }
-
-                void operator()(const NodeBinExpr* bin_expr) const {
-                    gen.gen_bin_expr(bin_expr);
-                }
-            };
-            ExprVisitor visitor { .gen = *this };
-            std::visit(visitor, expr->var);
-        };
-
-        void gen_scope(const NodeScope* scope) {
-            begin_scope();
-            for (NodeStmt* stmt : scope->stmts) {
-                gen_stmt(stmt);
-            }
-            end_scope();
-        }
-
-        void gen_if_pred(const NodeIfPred* if_pred, const std::string& end_label) {
-            struct IfPredVisitor {
-                Generator& gen;
-                const std::string& end_label;
-
-                void operator()(const NodeIfPredElif* elif) const {
-                    gen.gen_expr(elif->expr);
-                    gen.pop("rax");
-                    std::string label = gen.gen_label();
-                    gen.output << "    test rax, rax\n";
-                    gen.output << "    jz " << label << "\n";
-                    gen.gen_scope(elif->scope);
-                    gen.output << "    jmp " << end_label << "\n";
-                    if (elif->pred.has_value()) {
-                        gen.output << label << ":\n";
-                        gen.gen_if_pred(elif->pred.value(), end_label);
-                    }
-
-                }
-                void operator()(const NodeIfPredElse* else_) {
-                    gen.gen_scope(else_->scope);
-                }
-            };
-            IfPredVisitor visitor { .gen = *this, .end_label = end_label };
-            std::visit(visitor, if_pred->var);
-        }
-
-        inline void gen_stmt(const NodeStmt* stmt) {
-            struct StmtVisitor {
-                Generator& gen;
-                void operator()(const NodeStmtRet* stmt_ret) const {
-                    gen.gen_expr(stmt_ret->expr);
-                    gen.output << "    mov rax, 60\n";
-                    gen.pop("rdi");
-                    gen.output << "    syscall\n";
-                }
-
-                void operator()(const NodeStmtLet* stmt_let) const {
-                    auto itr = std::find_if(
-                        gen.vars.cbegin(),
-                        gen.vars.cend(),
-                        [&](const Var& var) { return var.name == stmt_let->ident.value.value(); });
-                    if (itr != gen.vars.cend()) {
-                        std::cerr << "Identifier already declared: " << stmt_let->ident.value.value() << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-                    gen.vars.push_back({ .name = stmt_let->ident.value.value(), .stack_loc = gen.stack_size });
-                    gen.gen_expr(stmt_let->expr);
-                }
-                void operator()(const NodeScope* scope) const {
-                    gen.gen_scope(scope);
-                }
-                void operator()(const NodeStmtIf* stmt_if) const {
-                    gen.gen_expr(stmt_if->expr);
-                    gen.pop("rax");
-                    std::string label = gen.gen_label();
-                    gen.output << "    test rax, rax\n";
-                    gen.output << "    jz " << label << "\n";
-                    gen.gen_scope(stmt_if->scope);
-                    if (stmt_if->pred.has_value()) {
-                        const std::string end_label = gen.gen_label();
-                        gen.output << "    jmp " << end_label << "\n";
-                        gen.output << label << ":\n";
-                        gen.gen_if_pred(stmt_if->pred.value(), end_label);
-                        gen.output << end_label;
-                    } else {
-                        gen.output << label << ":\n";
-                    }
-                }
-                void operator()(const NodeStmtAssign* stmt_assign) const {
-                    auto itr = std::find_if(
-                        gen.vars.cbegin(),
-                        gen.vars.cend(),
-                        [&](const Var& var) { return var.name == stmt_assign->ident.value.value(); });
-                    if (itr == gen.vars.cend()) {
-                        std::cerr << "Undeclared Identifier: " << stmt_assign->ident.value.value() << std::endl;
-                        exit(EXIT_FAILURE);
-                    }
-                    gen.gen_expr(stmt_assign->expr);
-                    gen.output << "    mov [rsp + " << (gen.stack_size - itr->stack_loc - 1) * 8 << "], rax\n";
-                }
-            };
-            StmtVisitor visitor { .gen = *this };
-            std::visit(visitor, stmt->var);
-        }
-
-        [[nodiscard]] inline std::string gen_prog() {
-            output << "global _start\n_start:\n";
-
-            for (const NodeStmt* stmt : prog.stmts) {
-                gen_stmt(stmt);
-            }
-
-            output << "    mov rax, 60\n";
-            output << "    mov rdi, 0\n";
-            output << "    syscall\n";
-            return output.str();
-        }
-
-    private:
-        void push(std::string reg) {
-            output << "    push " << reg << "\n";
-            stack_size++;
-        }
-
-        void pop(std::string reg) {
-            output << "    pop " << reg << "\n";
-            stack_size--;            
-        }
-
-        void begin_scope() {
-            scopes.push_back(vars.size());
-        }
-
-        void end_scope() {
-            size_t pop_count = vars.size() - scopes.back();
-            output << "    add rsp, " << pop_count * 8 << "\n";
-            stack_size -= pop_count;
-            for (int i = 0; i < pop_count; i++) {
-                vars.pop_back();
-            }
-            scopes.pop_back();
-        }
-
-        std::string gen_label() {
-            std::stringstream ss;
-            ss << "label" << label_count++;
-            return ss.str();
-        }
-
-        struct Var {
-            std::string name;
-            size_t stack_loc;
-        };
-        const NodeProg prog;
-        std::stringstream output;
-        size_t stack_size = 0;
-        std::vector<Var> vars {};
-        std::vector<size_t> scopes {};
-        int label_count = 0;
-};
-
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <functional>
+#include <queue>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "./ir.hpp"
+#include "./regalloc.hpp"
+#include "./asm.hpp"
+
+// x86-64 backend for an SSA function. Blocks are laid out in a topological
+// order that lets as many edges as possible fall through, and every value
+// lives in one place for its whole lifetime: LinearScan picks a register or a
+// stack slot over the intervals of that linear order, which is exact here
+// because the IR has no back edges. Constants are used as immediates where an
+// instruction allows one. Phis become moves at the end of each predecessor. A
+// branch on a difference that nothing else reads becomes a cmp of its
+// operands.
+//
+// rax and rdx never hold values: `mul` and `div` need them, and otherwise
+// they serve as the work register for a spilled result and as scratch for
+// moves between two stack slots or of a 64-bit immediate.
+//
+// Multiplication and division by a constant never reach `mul r` or `div`:
+// they become shifts, lea, imul with an immediate or, for division, a
+// multiplication by a fixed-point reciprocal.
+//
+// With `returns` set the program is a function for the SysV ABI instead of an
+// entry point: it saves the callee-saved registers, keeps the caller's rsp in
+// rbp, and returns the exit code in rax where it would have made the exit
+// syscall.
+//
+// The functions of the module follow the program, each behind its own label,
+// and use the SysV calling convention: arguments arrive in rdi, rsi, rdx, rcx,
+// r8 and r9, the result leaves in rax, and rbx, rbp and r12 to r15 survive
+// the call. A function sets up a frame in rbp and saves the callee-saved
+// registers it allocates. Around a call the caller keeps the values that live
+// across it in caller-saved registers in stack slots of its own, after the
+// spill slots, and rsp is 16-byte aligned at every call.
+class Generator {
+    public:
+        inline explicit Generator(ir::Module module, bool returns = false) : module(std::move(module)), returns(returns) {}
+
+        inline explicit Generator(ir::Function fn, bool returns = false)
+            : Generator(ir::Module { .main = std::move(fn) }, returns) {}
+
+        inline void gen_prog(AsmSink& out) {
+            sink = &out;
+            label_count = 0;
+            first_entry = static_cast<uint32_t>(module.main.blocks.size());
+            for (const ir::Function& function : module.functions) {
+                first_entry += static_cast<uint32_t>(function.blocks.size());
+            }
+            uint32_t base = 0;
+            gen_function(module.main, base, ir::none);
+            for (uint32_t f = 0; f < module.functions.size(); f++) {
+                base += static_cast<uint32_t>((f == 0 ? module.main : module.functions[f - 1]).blocks.size());
+                gen_function(module.functions[f], base, f);
+            }
+            fn = nullptr;
+            sink = nullptr;
+        }
+
+        [[nodiscard]] inline std::string gen_prog() {
+            OutputBuffer buffer;
+            AsmPrinter printer(buffer);
+            gen_prog(printer);
+            return buffer.str();
+        }
+
+        [[nodiscard]] inline uint32_t labels() const {
+            return label_count;
+        }
+
+    private:
+        static inline bool fits_imm32(uint64_t value) {
+            return value <= INT32_MAX;
+        }
+
+        // Blocks of the function are labeled from `base` on; `index` is its
+        // place in Module::functions, or ir::none for the program itself.
+        inline void gen_function(const ir::Function& function, uint32_t base, uint32_t index) {
+            fn = &function;
+            label_base = base;
+            in_function = index != ir::none;
+            allocate();
+            uint32_t pushed = 0;
+            if (in_function) {
+                emit(Mnemonic::label, Operand::l(first_entry + index));
+                emit(Mnemonic::push, Operand::r(Reg::rbp));
+                emit(Mnemonic::mov, Operand::r(Reg::rbp), Operand::r(Reg::rsp));
+                for (const Reg reg : saved) {
+                    emit(Mnemonic::push, Operand::r(reg));
+                }
+                // The return address and rbp.
+                pushed = 16 + static_cast<uint32_t>(saved.size()) * 8;
+            } else if (returns) {
+                for (const Reg reg : callee_saved) {
+                    emit(Mnemonic::push, Operand::r(reg));
+                }
+                emit(Mnemonic::mov, Operand::r(Reg::rbp), Operand::r(Reg::rsp));
+                pushed = 8 + static_cast<uint32_t>(callee_saved.size()) * 8;
+            }
+            frame_size = (spill_slots + save_slots) * 8;
+            if (!call_saves.empty() && (pushed + frame_size) % 16 != 0) {
+                frame_size += 8;
+            }
+            if (frame_size > 0) {
+                emit(Mnemonic::sub, Operand::r(Reg::rsp), Operand::i(frame_size));
+            }
+            if (in_function) {
+                gen_params();
+            }
+            next_call = 0;
+            for (size_t i = 0; i < order.size(); i++) {
+                const ir::BlockId b = order[i];
+                const ir::BlockId next = i + 1 < order.size() ? order[i + 1] : ir::none;
+                if (labeled[b]) {
+                    emit(Mnemonic::label, label(b));
+                }
+                const ir::Block& block = fn->blocks[b];
+                for (ir::Value v = block.first; v < block.end; v++) {
+                    gen_inst(v);
+                }
+                gen_term(b, next);
+            }
+        }
+
+        [[nodiscard]] inline Operand label(ir::BlockId b) const {
+            return Operand::l(label_base + b);
+        }
+
+        // Values that never get a location: removed instructions, constants
+        // every reader can take as an immediate or load into a scratch register,
+        // and conditions compiled into a cmp.
+        [[nodiscard]] inline bool has_location(ir::Value v) const {
+            const ir::Inst& inst = fn->insts[v];
+            return inst.op != ir::Op::nop && (inst.op != ir::Op::const_ || materialized[v]) && !fused[v];
+        }
+
+        // Places each block after all of its predecessors, right after the one
+        // just placed when that is its last unplaced predecessor (a branch's
+        // target before its other side), and otherwise picks the lowest
+        // numbered block that is ready.
+        inline void lay_out() {
+            std::vector<uint32_t> waiting(fn->blocks.size(), 0);
+            for (ir::BlockId b = 0; b < fn->blocks.size(); b++) {
+                for (const ir::BlockId pred : fn->preds_of(b)) {
+                    waiting[b] += fn->blocks[pred].reachable;
+                }
+            }
+            std::priority_queue<ir::BlockId, std::vector<ir::BlockId>, std::greater<>> ready;
+            order.clear();
+            ir::BlockId b = 0;
+            while (b != ir::none) {
+                order.push_back(b);
+                const ir::Term& term = fn->blocks[b].term;
+                ir::BlockId next = ir::none;
+                for (const ir::BlockId succ : { term.target, term.other }) {
+                    if (term.kind == ir::Term::Kind::exit || succ == ir::none || --waiting[succ] > 0) {
+                        continue;
+                    }
+                    if (next == ir::none) {
+                        next = succ;
+                    } else {
+                        ready.push(succ);
+                    }
+                }
+                if (next == ir::none && !ready.empty()) {
+                    next = ready.top();
+                    ready.pop();
+                }
+                b = next;
+            }
+        }
+
+        // Numbers instructions and terminators of the reachable blocks in
+        // layout order, builds an interval for every value with a location and
+        // runs LinearScan over them.
+        inline void allocate() {
+            lay_out();
+            labeled.assign(fn->blocks.size(), false);
+            for (size_t i = 0; i < order.size(); i++) {
+                const ir::Term& term = fn->blocks[order[i]].term;
+                const ir::BlockId next = i + 1 < order.size() ? order[i + 1] : ir::none;
+                if (term.kind == ir::Term::Kind::jump && term.target != next) {
+                    labeled[term.target] = true;
+                } else if (term.kind == ir::Term::Kind::branch) {
+                    labeled[term.target] = labeled[term.target] || term.target != next;
+                    labeled[term.other] = labeled[term.other] || term.other != next;
+                }
+            }
+            label_count += static_cast<uint32_t>(std::count(labeled.begin(), labeled.end(), true)) + in_function;
+
+            // Index of each block among the predecessors of its successors.
+            target_edge.assign(fn->blocks.size(), 0);
+            other_edge.assign(fn->blocks.size(), 0);
+            for (const ir::BlockId b : order) {
+                const std::span<const ir::BlockId> preds = fn->preds_of(b);
+                for (uint32_t i = 0; i < preds.size(); i++) {
+                    if (fn->blocks[preds[i]].term.target == b) {
+                        target_edge[preds[i]] = i;
+                    } else {
+                        other_edge[preds[i]] = i;
+                    }
+                }
+            }
+
+            // Division by the constant 0 must still trap, so that divisor goes
+            // through div from a register or memory.
+            materialized.assign(fn->insts.size(), false);
+            for (const ir::BlockId b : order) {
+                for (ir::Value v = fn->blocks[b].first; v < fn->blocks[b].end; v++) {
+                    const ir::Inst& inst = fn->insts[v];
+                    if (inst.op == ir::Op::div && fn->insts[inst.b].op == ir::Op::const_ && fn->insts[inst.b].imm == 0) {
+                        materialized[inst.b] = true;
+                    }
+                }
+            }
+
+            // A branch condition computed by a sub in the branch's own block and
+            // read nowhere else becomes a cmp of the sub's operands.
+            std::vector<uint32_t> uses(fn->insts.size(), 0);
+            for (const ir::BlockId b : order) {
+                const ir::Block& block = fn->blocks[b];
+                for (ir::Value v = block.first; v < block.end; v++) {
+                    fn->for_each_operand(v, [&uses](ir::Value operand) {
+                        uses[operand]++;
+                    });
+                }
+                if (block.term.value != ir::none) {
+                    uses[block.term.value]++;
+                }
+            }
+            fused.assign(fn->insts.size(), false);
+            for (const ir::BlockId b : order) {
+                const ir::Block& block = fn->blocks[b];
+                const ir::Value cond = block.term.value;
+                if (block.term.kind == ir::Term::Kind::branch && cond >= block.first && cond < block.end
+                    && fn->insts[cond].op == ir::Op::sub && uses[cond] == 1) {
+                    fused[cond] = true;
+                }
+            }
+
+            start.assign(fn->insts.size(), UINT32_MAX);
+            end.assign(fn->insts.size(), 0);
+            term_pos.assign(fn->blocks.size(), 0);
+            const auto use = [&](ir::Value v, uint32_t pos) {
+                end[v] = std::max(end[v], pos);
+            };
+            uint32_t pos = 0;
+            for (const ir::BlockId b : order) {
+                const ir::Block& block = fn->blocks[b];
+                for (ir::Value v = block.first; v < block.end; v++) {
+                    const ir::Inst& inst = fn->insts[v];
+                    if (inst.op == ir::Op::nop || inst.op == ir::Op::phi || fused[v]) {
+                        continue;
+                    }
+                    start[v] = pos;
+                    use(v, pos);
+                    fn->for_each_operand(v, [&](ir::Value operand) {
+                        use(operand, pos);
+                    });
+                    pos++;
+                }
+                term_pos[b] = pos;
+                if (block.term.value != ir::none && fused[block.term.value]) {
+                    use(fn->insts[block.term.value].a, pos);
+                    use(fn->insts[block.term.value].b, pos);
+                } else if (block.term.value != ir::none) {
+                    use(block.term.value, pos);
+                }
+                pos++;
+            }
+            // A phi is written at the end of each predecessor and its arguments
+            // are read there.
+            for (const ir::BlockId b : order) {
+                const ir::Block& block = fn->blocks[b];
+                const std::span<const ir::BlockId> preds = fn->preds_of(b);
+                for (ir::Value v = block.first; v < block.end; v++) {
+                    if (fn->insts[v].op != ir::Op::phi) {
+                        continue;
+                    }
+                    const std::span<const ir::Value> args = fn->args_of(v);
+                    for (size_t i = 0; i < preds.size(); i++) {
+                        start[v] = std::min(start[v], term_pos[preds[i]]);
+                        use(v, term_pos[preds[i]]);
+                        use(args[i], term_pos[preds[i]]);
+                    }
+                }
+            }
+
+            std::vector<ir::Value> values;
+            for (const ir::BlockId b : order) {
+                for (ir::Value v = fn->blocks[b].first; v < fn->blocks[b].end; v++) {
+                    if (has_location(v)) {
+                        values.push_back(v);
+                    }
+                }
+            }
+            std::stable_sort(values.begin(), values.end(), [this](ir::Value a, ir::Value b) {
+                return start[a] < start[b];
+            });
+            std::vector<uint32_t> interval_of(fn->insts.size(), UINT32_MAX);
+            for (uint32_t i = 0; i < values.size(); i++) {
+                interval_of[values[i]] = i;
+            }
+            std::vector<uint32_t> call_pos;
+            for (const ir::Value v : values) {
+                if (fn->insts[v].op == ir::Op::call) {
+                    call_pos.push_back(start[v]);
+                }
+            }
+            std::vector<LiveInterval> intervals;
+            intervals.reserve(values.size());
+            for (const ir::Value v : values) {
+                const ir::Inst& inst = fn->insts[v];
+                int32_t hint = -1;
+                if ((inst.op == ir::Op::add || inst.op == ir::Op::sub || inst.op == ir::Op::copy) && has_location(inst.a)) {
+                    hint = static_cast<int32_t>(interval_of[inst.a]);
+                }
+                const auto call = std::upper_bound(call_pos.begin(), call_pos.end(), start[v]);
+                intervals.push_back({
+                    .start = start[v],
+                    .end = end[v],
+                    .hint = hint,
+                    .across_call = call != call_pos.end() && *call < end[v],
+                });
+            }
+            const std::vector<Location> allocated = LinearScan().allocate(intervals, spill_slots);
+            locs.assign(fn->insts.size(), {});
+            std::array<bool, 16> used {};
+            for (uint32_t i = 0; i < values.size(); i++) {
+                locs[values[i]] = allocated[i];
+                used[static_cast<size_t>(allocated[i].reg)] |= !allocated[i].spilled;
+            }
+            saved.clear();
+            for (const Reg reg : callee_saved) {
+                if (reg != Reg::rbp && used[static_cast<size_t>(reg)]) {
+                    saved.push_back(reg);
+                }
+            }
+
+            // At each call, in layout order, the caller-saved registers whose
+            // value lives across it. The only value a register can hold at a
+            // position is the last one that started there before it.
+            call_saves.clear();
+            saved_across.clear();
+            save_slots = 0;
+            std::array<ir::Value, 16> holder;
+            holder.fill(ir::none);
+            size_t started = 0;
+            for (const ir::BlockId b : order) {
+                for (ir::Value v = fn->blocks[b].first; v < fn->blocks[b].end; v++) {
+                    if (fn->insts[v].op != ir::Op::call) {
+                        continue;
+                    }
+                    for (; started < values.size() && start[values[started]] < start[v]; started++) {
+                        if (!locs[values[started]].spilled) {
+                            holder[static_cast<size_t>(locs[values[started]].reg)] = values[started];
+                        }
+                    }
+                    const uint32_t first = static_cast<uint32_t>(saved_across.size());
+                    for (const Reg reg : caller_saved) {
+                        const ir::Value holding = holder[static_cast<size_t>(reg)];
+                        if (holding != ir::none && end[holding] > start[v]) {
+                            saved_across.push_back(reg);
+                        }
+                    }
+                    const uint32_t count = static_cast<uint32_t>(saved_across.size()) - first;
+                    call_saves.push_back({ .first = first, .count = count });
+                    save_slots = std::max(save_slots, count);
+                }
+            }
+        }
+
+        // Where `v` can be read from: its register or stack slot, or an
+        // immediate for a constant without a location.
+        inline Operand operand(ir::Value v) const {
+            if (!has_location(v)) {
+                return Operand::i(fn->insts[v].imm);
+            }
+            if (locs[v].spilled) {
+                return spill_slot(locs[v].slot);
+            }
+            return Operand::r(locs[v].reg);
+        }
+
+        inline void gen_inst(ir::Value v) {
+            const ir::Inst& inst = fn->insts[v];
+            if (fused[v]) {
+                return;
+            }
+            switch (inst.op) {
+                case ir::Op::const_:
+                    if (materialized[v]) {
+                        move(operand(v), Operand::i(inst.imm));
+                    }
+                    break;
+                case ir::Op::copy:
+                    move(operand(v), operand(inst.a));
+                    break;
+                case ir::Op::add:
+                case ir::Op::sub: {
+                    const Operand dst = operand(v);
+                    const Operand work = dst.kind == Operand::Kind::reg ? dst : Operand::r(Reg::rax);
+                    const Operand lhs = operand(inst.a);
+                    Operand rhs = operand(inst.b);
+                    if (rhs.kind == Operand::Kind::imm && !fits_imm32(rhs.imm)) {
+                        emit(Mnemonic::mov, Operand::r(Reg::rdx), rhs);
+                        rhs = Operand::r(Reg::rdx);
+                    }
+                    move(work, lhs);
+                    emit(inst.op == ir::Op::add ? Mnemonic::add : Mnemonic::sub, work, rhs);
+                    move(dst, work);
+                    break;
+                }
+                case ir::Op::mul:
+                    gen_mul(v);
+                    break;
+                case ir::Op::div:
+                    gen_div(v);
+                    break;
+                case ir::Op::call:
+                    gen_call(v);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // Saves what lives across the call, passes the arguments in the
+        // argument registers, and restores the saved registers before taking
+        // the result from rax.
+        inline void gen_call(ir::Value v) {
+            const CallSave save = call_saves[next_call++];
+            for (uint32_t i = 0; i < save.count; i++) {
+                emit(Mnemonic::mov, spill_slot(spill_slots + i), Operand::r(saved_across[save.first + i]));
+            }
+            const std::span<const ir::Value> args = fn->args_of(v);
+            std::vector<Move> moves;
+            for (size_t i = 0; i < args.size(); i++) {
+                moves.push_back({ .dst = Operand::r(arg_regs[i]), .src = operand(args[i]) });
+            }
+            parallel_move(moves);
+            emit(Mnemonic::call, Operand::l(first_entry + static_cast<uint32_t>(fn->insts[v].imm)));
+            for (uint32_t i = 0; i < save.count; i++) {
+                emit(Mnemonic::mov, Operand::r(saved_across[save.first + i]), spill_slot(spill_slots + i));
+            }
+            move(operand(v), Operand::r(Reg::rax));
+        }
+
+        // Moves each parameter from its argument register to its location. At
+        // -O0 an unused parameter is still there, but with an interval that
+        // ends where it starts, and may share its location with another.
+        inline void gen_params() {
+            std::vector<Move> moves;
+            for (ir::Value v = fn->blocks[0].first; v < fn->blocks[0].end; v++) {
+                if (fn->insts[v].op == ir::Op::param && end[v] > start[v]) {
+                    moves.push_back({ .dst = operand(v), .src = Operand::r(arg_regs[fn->insts[v].imm]) });
+                }
+            }
+            parallel_move(moves);
+        }
+
+        struct Move {
+            Operand dst;
+            Operand src;
+        };
+
+        // Performs `moves` as if all at once: a move goes as soon as no other
+        // still reads its destination, and a cycle of registers is broken by
+        // parking one of them in rax. Sources in memory never depend on the
+        // registers written, since only rsp addresses memory.
+        inline void parallel_move(std::vector<Move>& moves) {
+            std::erase_if(moves, [](const Move& m) {
+                return m.dst == m.src;
+            });
+            while (!moves.empty()) {
+                bool progress = false;
+                for (size_t i = 0; i < moves.size(); i++) {
+                    const bool blocked = std::any_of(moves.begin(), moves.end(), [&](const Move& other) {
+                        return other.src == moves[i].dst;
+                    });
+                    if (!blocked) {
+                        move(moves[i].dst, moves[i].src);
+                        moves.erase(moves.begin() + static_cast<ptrdiff_t>(i));
+                        progress = true;
+                        break;
+                    }
+                }
+                if (progress) {
+                    continue;
+                }
+                const Operand parked = moves[0].dst;
+                emit(Mnemonic::mov, Operand::r(Reg::rax), parked);
+                for (Move& m : moves) {
+                    if (m.src == parked) {
+                        m.src = Operand::r(Reg::rax);
+                    }
+                }
+            }
+        }
+
+        // Only the low 64 bits of a product are kept, which two-operand imul
+        // computes the same as mul without needing rax and rdx.
+        inline void gen_mul(ir::Value v) {
+            const ir::Inst& inst = fn->insts[v];
+            const Operand dst = operand(v);
+            const Operand work = dst.kind == Operand::Kind::reg ? dst : Operand::r(Reg::rax);
+            Operand lhs = operand(inst.a);
+            Operand rhs = operand(inst.b);
+            if (lhs.kind == Operand::Kind::imm) {
+                std::swap(lhs, rhs);
+            }
+            if (rhs.kind == Operand::Kind::imm) {
+                const uint64_t factor = rhs.imm;
+                if (factor == 0) {
+                    move(dst, Operand::i(0));
+                    return;
+                }
+                if (factor == 1) {
+                    move(dst, lhs);
+                    return;
+                }
+                if (!std::has_single_bit(factor) && factor != 3 && factor != 5 && factor != 9 && !fits_imm32(factor)) {
+                    emit(Mnemonic::mov, Operand::r(Reg::rdx), rhs);
+                    rhs = Operand::r(Reg::rdx);
+                }
+            }
+            move(work, lhs);
+            if (rhs.kind != Operand::Kind::imm) {
+                emit(Mnemonic::imul, work, rhs);
+            } else if (std::has_single_bit(rhs.imm)) {
+                emit(Mnemonic::shl, work, Operand::i(std::countr_zero(rhs.imm)));
+            } else if (rhs.imm == 3 || rhs.imm == 5 || rhs.imm == 9) {
+                emit(Mnemonic::lea, work, Operand::m(work.reg, work.reg, static_cast<uint8_t>(rhs.imm - 1)));
+            } else {
+                emit(Mnemonic::imul, work, rhs);
+            }
+            move(dst, work);
+        }
+
+        // Unsigned division. A power of two is a shift and any other constant
+        // a multiplication by its reciprocal; the rest goes through div with
+        // rdx cleared, as it holds the high half of the dividend.
+        inline void gen_div(ir::Value v) {
+            const ir::Inst& inst = fn->insts[v];
+            const Operand dst = operand(v);
+            const Operand lhs = operand(inst.a);
+            const Operand rhs = operand(inst.b);
+            const Operand rax = Operand::r(Reg::rax);
+            const Operand rdx = Operand::r(Reg::rdx);
+            if (rhs.kind != Operand::Kind::imm) {
+                move(rax, lhs);
+                emit(Mnemonic::xor_, rdx, rdx);
+                emit(Mnemonic::div, rhs);
+                move(dst, rax);
+                return;
+            }
+            const uint64_t divisor = rhs.imm;
+            if (divisor == 1) {
+                move(dst, lhs);
+                return;
+            }
+            if (std::has_single_bit(divisor)) {
+                const Operand work = dst.kind == Operand::Kind::reg ? dst : rax;
+                move(work, lhs);
+                emit(Mnemonic::shr, work, Operand::i(std::countr_zero(divisor)));
+                move(dst, work);
+                return;
+            }
+            // The high half of lhs * magic, shifted right, is the quotient. When
+            // the magic number needs 65 bits its top bit is added back as
+            // ((lhs - high) >> 1) + high, which cannot overflow.
+            const Reciprocal reciprocal = reciprocal_of(divisor);
+            move(rax, lhs);
+            emit(Mnemonic::mov, rdx, Operand::i(reciprocal.magic));
+            emit(Mnemonic::mul, rdx);
+            if (!reciprocal.add) {
+                emit(Mnemonic::shr, rdx, Operand::i(reciprocal.shift));
+                move(dst, rdx);
+                return;
+            }
+            move(rax, lhs);
+            emit(Mnemonic::sub, rax, rdx);
+            emit(Mnemonic::shr, rax, Operand::i(1));
+            emit(Mnemonic::add, rax, rdx);
+            emit(Mnemonic::shr, rax, Operand::i(reciprocal.shift));
+            move(dst, rax);
+        }
+
+        struct Reciprocal {
+            uint64_t magic;
+            uint32_t shift;
+            bool add;
+        };
+
+        // Granlund and Montgomery's round-up reciprocal of a divisor that is
+        // not a power of two, with the 65-bit case from libdivide.
+        static inline Reciprocal reciprocal_of(uint64_t divisor) {
+            const uint32_t log = static_cast<uint32_t>(std::bit_width(divisor) - 1);
+            const unsigned __int128 scaled = static_cast<unsigned __int128>(1) << (64 + log);
+            uint64_t magic = static_cast<uint64_t>(scaled / divisor);
+            const uint64_t rem = static_cast<uint64_t>(scaled % divisor);
+            if (divisor - rem < (uint64_t { 1 } << log)) {
+                return { .magic = magic + 1, .shift = log, .add = false };
+            }
+            magic += magic;
+            const uint64_t twice_rem = rem + rem;
+            if (twice_rem >= divisor || twice_rem < rem) {
+                magic++;
+            }
+            return { .magic = magic + 1, .shift = log, .add = true };
+        }
+
+        inline void gen_term(ir::BlockId b, ir::BlockId next) {
+            const ir::Term& term = fn->blocks[b].term;
+            switch (term.kind) {
+                case ir::Term::Kind::exit:
+                    if (in_function) {
+                        move(Operand::r(Reg::rax), operand(term.value));
+                        if (frame_size > 0) {
+                            emit(Mnemonic::add, Operand::r(Reg::rsp), Operand::i(frame_size));
+                        }
+                        for (auto reg = saved.rbegin(); reg != saved.rend(); reg++) {
+                            emit(Mnemonic::pop, Operand::r(*reg));
+                        }
+                        emit(Mnemonic::pop, Operand::r(Reg::rbp));
+                        emit(Mnemonic::ret);
+                        break;
+                    }
+                    if (returns) {
+                        move(Operand::r(Reg::rax), operand(term.value));
+                        emit(Mnemonic::mov, Operand::r(Reg::rsp), Operand::r(Reg::rbp));
+                        for (auto reg = callee_saved.rbegin(); reg != callee_saved.rend(); reg++) {
+                            emit(Mnemonic::pop, Operand::r(*reg));
+                        }
+                        emit(Mnemonic::ret);
+                        break;
+                    }
+                    move(Operand::r(Reg::rdi), operand(term.value));
+                    emit(Mnemonic::mov, Operand::r(Reg::rax), Operand::i(60));
+                    emit(Mnemonic::syscall);
+                    break;
+                case ir::Term::Kind::jump:
+                    gen_phi_moves(b, term.target);
+                    if (term.target != next) {
+                        emit(Mnemonic::jmp, label(term.target));
+                    }
+                    break;
+                case ir::Term::Kind::branch: {
+                    // Writing the phis of both successors here is safe: a phi's
+                    // interval starts at its first predecessor, so nothing on
+                    // the other path can be living in its location.
+                    gen_phi_moves(b, term.target);
+                    gen_phi_moves(b, term.other);
+                    if (fused[term.value]) {
+                        gen_compare(fn->insts[term.value]);
+                    } else {
+                        Operand cond = operand(term.value);
+                        if (cond.kind != Operand::Kind::reg) {
+                            emit(Mnemonic::mov, Operand::r(Reg::rax), cond);
+                            cond = Operand::r(Reg::rax);
+                        }
+                        emit(Mnemonic::test, cond, cond);
+                    }
+                    // ZF is set exactly when the condition is false.
+                    if (term.other == next) {
+                        emit(Mnemonic::jnz, label(term.target));
+                    } else {
+                        emit(Mnemonic::jz, label(term.other));
+                        if (term.target != next) {
+                            emit(Mnemonic::jmp, label(term.target));
+                        }
+                    }
+                    break;
+                }
+            }
+        }
+
+        // Sets ZF when the operands of `sub` are equal. Only equality matters,
+        // so an immediate may go on either side.
+        inline void gen_compare(const ir::Inst& sub) {
+            Operand lhs = operand(sub.a);
+            Operand rhs = operand(sub.b);
+            if (lhs.kind == Operand::Kind::imm) {
+                std::swap(lhs, rhs);
+            }
+            if (lhs.kind == Operand::Kind::imm || (lhs.kind == Operand::Kind::mem && rhs.kind == Operand::Kind::mem)) {
+                emit(Mnemonic::mov, Operand::r(Reg::rax), lhs);
+                lhs = Operand::r(Reg::rax);
+            }
+            if (rhs.kind == Operand::Kind::imm && !fits_imm32(rhs.imm)) {
+                emit(Mnemonic::mov, Operand::r(Reg::rdx), rhs);
+                rhs = Operand::r(Reg::rdx);
+            }
+            emit(Mnemonic::cmp, lhs, rhs);
+        }
+
+        // Moves the arguments for the edge b -> succ into succ's phis, which
+        // lead its block. No argument can sit in another phi's location, so
+        // the moves need no particular order.
+        inline void gen_phi_moves(ir::BlockId b, ir::BlockId succ) {
+            const ir::Block& block = fn->blocks[succ];
+            const uint32_t edge = succ == fn->blocks[b].term.target ? target_edge[b] : other_edge[b];
+            for (ir::Value v = block.first; v < block.end; v++) {
+                if (fn->insts[v].op == ir::Op::phi) {
+                    move(operand(v), operand(fn->args_of(v)[edge]));
+                } else if (fn->insts[v].op != ir::Op::nop) {
+                    break;
+                }
+            }
+        }
+
+        inline void move(const Operand& dst, const Operand& src) {
+            if (dst == src) {
+                return;
+            }
+            if (dst.kind == Operand::Kind::mem && src.kind != Operand::Kind::reg) {
+                emit(Mnemonic::mov, Operand::r(Reg::rdx), src);
+                emit(Mnemonic::mov, dst, Operand::r(Reg::rdx));
+                return;
+            }
+            emit(Mnemonic::mov, dst, src);
+        }
+
+        inline Operand spill_slot(uint32_t slot) const {
+            return Operand::m(Reg::rsp, static_cast<int32_t>(slot * 8));
+        }
+
+        inline void emit(Mnemonic mnemonic, Operand dst = {}, Operand src = {}) {
+            sink->emit({ .mnemonic = mnemonic, .dst = dst, .src = src });
+        }
+
+        static constexpr std::array<Reg, 6> callee_saved {
+            Reg::rbx, Reg::rbp, Reg::r12, Reg::r13, Reg::r14, Reg::r15,
+        };
+
+        // The registers of LinearScan's pool a callee may clobber.
+        static constexpr std::array<Reg, 7> caller_saved {
+            Reg::rcx, Reg::rsi, Reg::rdi, Reg::r8, Reg::r9, Reg::r10, Reg::r11,
+        };
+
+        static constexpr std::array<Reg, 6> arg_regs {
+            Reg::rdi, Reg::rsi, Reg::rdx, Reg::rcx, Reg::r8, Reg::r9,
+        };
+
+        struct CallSave {
+            uint32_t first;
+            uint32_t count;
+        };
+
+        const ir::Module module;
+        const bool returns;
+        // The function being generated and its place among all labels.
+        const ir::Function* fn = nullptr;
+        uint32_t label_base = 0;
+        uint32_t first_entry = 0;
+        bool in_function = false;
+        AsmSink* sink = nullptr;
+        std::vector<ir::BlockId> order {};
+        std::vector<bool> labeled {};
+        std::vector<bool> materialized {};
+        std::vector<bool> fused {};
+        std::vector<uint32_t> term_pos {};
+        std::vector<uint32_t> target_edge {};
+        std::vector<uint32_t> other_edge {};
+        std::vector<Location> locs {};
+        std::vector<uint32_t> start {};
+        std::vector<uint32_t> end {};
+        std::vector<Reg> saved {};
+        std::vector<CallSave> call_saves {};
+        std::vector<Reg> saved_across {};
+        size_t next_call = 0;
+        uint32_t spill_slots = 0;
+        uint32_t save_slots = 0;
+        uint32_t frame_size = 0;
+        uint32_t label_count = 0;
+};
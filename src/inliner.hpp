@@ -0,0 +1,315 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "./ir.hpp"
+#include "./ir_opt.hpp"
+
+namespace ir {
+
+// Replaces calls with a copy of the callee's body, then drops the functions
+// main no longer reaches. Callees are defined before their callers, so
+// functions are finished in definition order and main last: a callee has had
+// its own calls inlined and been optimized before any call to it is looked
+// at. A call is inlined when the callee costs at most `budget`, or when it is
+// the callee's only call left anywhere, so the copy replaces the original.
+// A function never inlines itself.
+class Inliner {
+    public:
+        static constexpr uint32_t default_budget = 24;
+
+        inline explicit Inliner(Optimizer& optimizer, uint32_t budget = default_budget)
+            : optimizer(optimizer), budget(budget) {}
+
+        inline void run(Module& module) {
+            sites.assign(module.functions.size(), 0);
+            cost.assign(module.functions.size(), 0);
+            count_calls(module.main);
+            for (const Function& fn : module.functions) {
+                count_calls(fn);
+            }
+            for (uint32_t f = 0; f < module.functions.size(); f++) {
+                finish(module, module.functions[f], f);
+                cost[f] = cost_of(module.functions[f]);
+            }
+            finish(module, module.main, none);
+            prune(module);
+        }
+
+        [[nodiscard]] inline uint64_t calls_inlined() const {
+            return inlined;
+        }
+
+        [[nodiscard]] inline uint64_t functions_removed() const {
+            return removed;
+        }
+
+    private:
+        inline void finish(Module& module, Function& fn, uint32_t self) {
+            optimizer.optimize(fn);
+            if (inline_calls(module, fn, self)) {
+                optimizer.optimize(fn, true);
+            }
+        }
+
+        // Instructions and blocks, roughly what the body adds to a caller.
+        [[nodiscard]] static inline uint32_t cost_of(const Function& fn) {
+            uint32_t cost = 0;
+            for (const Block& block : fn.blocks) {
+                if (!block.reachable) {
+                    continue;
+                }
+                cost++;
+                for (Value v = block.first; v < block.end; v++) {
+                    cost += fn.insts[v].op != Op::nop && fn.insts[v].op != Op::param;
+                }
+            }
+            return cost;
+        }
+
+        inline void count_calls(const Function& fn) {
+            for (const Block& block : fn.blocks) {
+                if (!block.reachable) {
+                    continue;
+                }
+                for (Value v = block.first; v < block.end; v++) {
+                    if (fn.insts[v].op == Op::call) {
+                        sites[fn.insts[v].imm]++;
+                    }
+                }
+            }
+        }
+
+        [[nodiscard]] inline bool inlinable(uint64_t callee, uint32_t self) const {
+            return callee != self && (cost[callee] <= budget || sites[callee] == 1);
+        }
+
+        // Rebuilds `fn` with every inlinable call spliced in. A block holding
+        // such calls is split at each one; `head` and `tail` map every old
+        // block to the first and last of its pieces, which take over its
+        // incoming and outgoing edges. Returns whether anything was inlined.
+        inline bool inline_calls(Module& module, Function& fn, uint32_t self) {
+            bool any = false;
+            for (const Block& block : fn.blocks) {
+                for (Value v = block.first; v < block.end && block.reachable; v++) {
+                    any |= fn.insts[v].op == Op::call && inlinable(fn.insts[v].imm, self);
+                }
+            }
+            if (!any) {
+                return false;
+            }
+
+            Function out { .name = fn.name, .params = fn.params };
+            std::vector<Value> map(fn.insts.size(), none);
+            std::vector<BlockId> head(fn.blocks.size(), none);
+            std::vector<BlockId> tail(fn.blocks.size(), none);
+            std::vector<BlockId> preds;
+            std::vector<Value> args;
+            for (BlockId b = 0; b < fn.blocks.size(); b++) {
+                const Block& block = fn.blocks[b];
+                if (!block.reachable) {
+                    continue;
+                }
+                preds.clear();
+                for (const BlockId pred : fn.preds_of(b)) {
+                    preds.push_back(tail[pred]);
+                }
+                head[b] = begin(out, preds);
+                for (Value v = block.first; v < block.end; v++) {
+                    const Inst& inst = fn.insts[v];
+                    if (inst.op == Op::nop) {
+                        continue;
+                    }
+                    if (inst.op != Op::call || !inlinable(inst.imm, self)) {
+                        map[v] = copy(out, fn, v, map);
+                        continue;
+                    }
+                    args.clear();
+                    for (const Value arg : fn.args_of(v)) {
+                        args.push_back(map[arg]);
+                    }
+                    sites[inst.imm]--;
+                    map[v] = splice(out, module.functions[inst.imm], args);
+                    inlined++;
+                }
+                Term term = block.term;
+                if (term.value != none) {
+                    term.value = map[term.value];
+                }
+                end(out, term);
+                tail[b] = static_cast<BlockId>(out.blocks.size() - 1);
+            }
+            for (BlockId b = 0; b < fn.blocks.size(); b++) {
+                if (tail[b] == none) {
+                    continue;
+                }
+                Term& term = out.blocks[tail[b]].term;
+                if (term.kind != Term::Kind::exit) {
+                    term.target = head[term.target];
+                }
+                if (term.kind == Term::Kind::branch) {
+                    term.other = head[term.other];
+                }
+            }
+            fn = std::move(out);
+            return true;
+        }
+
+        // Ends the current block of `out` with a jump into a copy of `callee`
+        // whose parameters take the values `args`, then starts the block all
+        // of the copy's exits jump to and returns the call's value there.
+        inline Value splice(Function& out, const Function& callee, std::span<const Value> args) {
+            const BlockId caller = static_cast<BlockId>(out.blocks.size() - 1);
+            end(out, { .kind = Term::Kind::jump, .target = caller + 1 });
+            std::vector<Value> map(callee.insts.size(), none);
+            std::vector<BlockId> block_of(callee.blocks.size(), none);
+            std::vector<BlockId> preds;
+            std::vector<BlockId> exits;
+            std::vector<Value> results;
+            for (BlockId b = 0; b < callee.blocks.size(); b++) {
+                const Block& block = callee.blocks[b];
+                if (!block.reachable) {
+                    continue;
+                }
+                preds.clear();
+                if (b == 0) {
+                    preds.push_back(caller);
+                }
+                for (const BlockId pred : callee.preds_of(b)) {
+                    preds.push_back(block_of[pred]);
+                }
+                block_of[b] = begin(out, preds);
+                for (Value v = block.first; v < block.end; v++) {
+                    const Inst& inst = callee.insts[v];
+                    if (inst.op == Op::param) {
+                        map[v] = args[inst.imm];
+                    } else if (inst.op != Op::nop) {
+                        map[v] = copy(out, callee, v, map);
+                        if (inst.op == Op::call) {
+                            sites[inst.imm]++;
+                        }
+                    }
+                }
+                Term term = block.term;
+                if (term.value != none) {
+                    term.value = map[term.value];
+                }
+                if (term.kind == Term::Kind::exit) {
+                    exits.push_back(block_of[b]);
+                    results.push_back(term.value);
+                    term = { .kind = Term::Kind::jump };
+                }
+                end(out, term);
+            }
+            for (BlockId b = 0; b < callee.blocks.size(); b++) {
+                if (block_of[b] == none || callee.blocks[b].term.kind == Term::Kind::exit) {
+                    continue;
+                }
+                Term& term = out.blocks[block_of[b]].term;
+                term.target = block_of[term.target];
+                if (term.kind == Term::Kind::branch) {
+                    term.other = block_of[term.other];
+                }
+            }
+            const BlockId join = begin(out, exits);
+            for (const BlockId exit : exits) {
+                out.blocks[exit].term.target = join;
+            }
+            if (results.size() == 1) {
+                return results[0];
+            }
+            const uint32_t first = static_cast<uint32_t>(out.args.size());
+            out.args.insert(out.args.end(), results.begin(), results.end());
+            out.insts.push_back({ .op = Op::phi, .a = first, .b = static_cast<uint32_t>(results.size()) });
+            return static_cast<Value>(out.insts.size() - 1);
+        }
+
+        // Appends instruction `v` of `src` to `out`, with its operands
+        // renamed through `map`.
+        [[nodiscard]] static inline Value copy(Function& out, const Function& src, Value v, const std::vector<Value>& map) {
+            Inst inst = src.insts[v];
+            if (inst.op == Op::phi || inst.op == Op::call) {
+                const uint32_t first = static_cast<uint32_t>(out.args.size());
+                for (const Value arg : src.args_of(v)) {
+                    out.args.push_back(map[arg]);
+                }
+                inst.a = first;
+            } else if (inst.op == Op::copy) {
+                inst.a = map[inst.a];
+            } else if (inst.op != Op::const_ && inst.op != Op::param) {
+                inst.a = map[inst.a];
+                inst.b = map[inst.b];
+            }
+            out.insts.push_back(inst);
+            return static_cast<Value>(out.insts.size() - 1);
+        }
+
+        static inline BlockId begin(Function& out, std::span<const BlockId> preds) {
+            out.blocks.push_back({
+                .first = static_cast<uint32_t>(out.insts.size()),
+                .pred_first = static_cast<uint32_t>(out.preds.size()),
+                .pred_count = static_cast<uint32_t>(preds.size()),
+            });
+            out.preds.insert(out.preds.end(), preds.begin(), preds.end());
+            return static_cast<BlockId>(out.blocks.size() - 1);
+        }
+
+        static inline void end(Function& out, const Term& term) {
+            out.blocks.back().term = term;
+            out.blocks.back().end = static_cast<uint32_t>(out.insts.size());
+        }
+
+        // Keeps the functions main still calls, directly or not, and
+        // renumbers the calls to them.
+        inline void prune(Module& module) {
+            std::vector<uint32_t> index(module.functions.size(), none);
+            std::vector<uint32_t> order;
+            const auto reach = [&](const Function& fn) {
+                for (const Block& block : fn.blocks) {
+                    for (Value v = block.first; v < block.end && block.reachable; v++) {
+                        if (fn.insts[v].op == Op::call && index[fn.insts[v].imm] == none) {
+                            index[fn.insts[v].imm] = 0;
+                            order.push_back(static_cast<uint32_t>(fn.insts[v].imm));
+                        }
+                    }
+                }
+            };
+            reach(module.main);
+            for (size_t i = 0; i < order.size(); i++) {
+                reach(module.functions[order[i]]);
+            }
+
+            std::vector<Function> kept;
+            for (uint32_t f = 0; f < module.functions.size(); f++) {
+                if (index[f] == none) {
+                    removed++;
+                    continue;
+                }
+                index[f] = static_cast<uint32_t>(kept.size());
+                kept.push_back(std::move(module.functions[f]));
+            }
+            module.functions = std::move(kept);
+            const auto renumber = [&](Function& fn) {
+                for (Inst& inst : fn.insts) {
+                    if (inst.op == Op::call) {
+                        inst.imm = index[inst.imm];
+                    }
+                }
+            };
+            renumber(module.main);
+            for (Function& fn : module.functions) {
+                renumber(fn);
+            }
+        }
+
+        Optimizer& optimizer;
+        const uint32_t budget;
+        std::vector<int> sites {};
+        std::vector<uint32_t> cost {};
+        uint64_t inlined = 0;
+        uint64_t removed = 0;
+};
+
+}
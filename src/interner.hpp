@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+// Maps identifier spellings to dense ids. The views must outlive the interner,
+// in practice they point into the tokenizer's source buffer.
+class Interner {
+    public:
+        inline uint32_t intern(std::string_view name) {
+            if ((names.size() + 1) * 4 > slots.size() * 3) {
+                grow();
+            }
+            const uint64_t h = hash(name);
+            size_t i = h & (slots.size() - 1);
+            while (slots[i] != 0) {
+                const uint32_t id = slots[i] - 1;
+                if (hashes[id] == h && names[id] == name) {
+                    return id;
+                }
+                i = (i + 1) & (slots.size() - 1);
+            }
+            const uint32_t id = static_cast<uint32_t>(names.size());
+            slots[i] = id + 1;
+            names.push_back(name);
+            hashes.push_back(h);
+            return id;
+        }
+
+        [[nodiscard]] inline std::string_view name(uint32_t id) const {
+            return names[id];
+        }
+
+        [[nodiscard]] inline size_t size() const {
+            return names.size();
+        }
+
+    private:
+        [[nodiscard]] static inline uint64_t hash(std::string_view name) {
+            uint64_t h = 0x9e3779b97f4a7c15ull ^ name.size();
+            size_t i = 0;
+            for (; i + 8 <= name.size(); i += 8) {
+                uint64_t word;
+                std::memcpy(&word, name.data() + i, 8);
+                h = (h ^ word) * 0xff51afd7ed558ccdull;
+                h ^= h >> 32;
+            }
+            for (; i < name.size(); i++) {
+                h = (h ^ static_cast<unsigned char>(name[i])) * 0x100000001b3ull;
+            }
+            h ^= h >> 29;
+            h *= 0xc4ceb9fe1a85ec53ull;
+            return h ^ (h >> 32);
+        }
+
+        inline void grow() {
+            std::vector<uint32_t> next(slots.empty() ? 64 : slots.size() * 2, 0);
+            for (uint32_t id = 0; id < names.size(); id++) {
+                size_t i = hashes[id] & (next.size() - 1);
+                while (next[i] != 0) {
+                    i = (i + 1) & (next.size() - 1);
+                }
+                next[i] = id + 1;
+            }
+            slots = std::move(next);
+        }
+
+        std::vector<uint32_t> slots;
+        std::vector<std::string_view> names;
+        std::vector<uint64_t> hashes;
+};
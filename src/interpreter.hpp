@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+#include "./bytecode.hpp"
+
+// Executes a bytecode::Program. Dispatch is threaded through computed gotos:
+// every handler ends by jumping straight to the handler of the next opcode,
+// so each instruction costs one indirect branch predicted from its own site
+// rather than one shared switch. The program must be valid (see
+// bytecode::valid); the Generator's output always is.
+//
+// The registers of all active calls are windows into one growing array, the
+// callee's right after its caller's.
+class Interpreter {
+    public:
+        enum class Trap : uint8_t {
+            none,
+            division_by_zero,
+            stack_overflow,
+        };
+
+        // Calls nested deeper than this trap, as native code would run out
+        // of stack.
+        static constexpr size_t max_depth = 1 << 20;
+
+        inline explicit Interpreter(const bytecode::Program& program)
+            : program(program), regs(program.registers, 0) {}
+
+        // The exit code, or nothing when the program traps; trap() says why.
+        [[nodiscard]] inline std::optional<uint64_t> run() {
+            static const void* const handlers[] = {
+                &&mov, &&movk, &&add, &&sub, &&mul, &&div, &&addk, &&subk, &&mulk, &&divk, &&rsubk, &&rdivk,
+                &&jmp, &&jz, &&jnz, &&jeq, &&jne, &&jeqk, &&jnek, &&ret, &&retk, &&call,
+            };
+            static_assert(sizeof(handlers) / sizeof(handlers[0]) == bytecode::op_count);
+
+            const uint32_t* const code = program.code.data();
+            const uint32_t* ip = code;
+            uint64_t* r = regs.data();
+            size_t base = 0;
+            uint32_t size = program.registers;
+            uint64_t result;
+            frames.clear();
+            fault = Trap::none;
+            const auto k = [](const uint32_t* at) {
+                return static_cast<uint64_t>(at[0]) | static_cast<uint64_t>(at[1]) << 32;
+            };
+#define NEXT(length) ip += (length); goto *handlers[*ip & 0xff]
+#define D (*ip >> 8)
+
+            goto *handlers[*ip & 0xff];
+        mov:
+            r[D] = r[ip[1]];
+            NEXT(2);
+        movk:
+            r[D] = k(ip + 1);
+            NEXT(3);
+        add:
+            r[D] = r[ip[1]] + r[ip[2]];
+            NEXT(3);
+        sub:
+            r[D] = r[ip[1]] - r[ip[2]];
+            NEXT(3);
+        mul:
+            r[D] = r[ip[1]] * r[ip[2]];
+            NEXT(3);
+        div:
+            if (r[ip[2]] == 0) {
+                fault = Trap::division_by_zero;
+                return std::nullopt;
+            }
+            r[D] = r[ip[1]] / r[ip[2]];
+            NEXT(3);
+        addk:
+            r[D] = r[ip[1]] + k(ip + 2);
+            NEXT(4);
+        subk:
+            r[D] = r[ip[1]] - k(ip + 2);
+            NEXT(4);
+        mulk:
+            r[D] = r[ip[1]] * k(ip + 2);
+            NEXT(4);
+        divk:
+            if (k(ip + 2) == 0) {
+                fault = Trap::division_by_zero;
+                return std::nullopt;
+            }
+            r[D] = r[ip[1]] / k(ip + 2);
+            NEXT(4);
+        rsubk:
+            r[D] = k(ip + 2) - r[ip[1]];
+            NEXT(4);
+        rdivk:
+            if (r[ip[1]] == 0) {
+                fault = Trap::division_by_zero;
+                return std::nullopt;
+            }
+            r[D] = k(ip + 2) / r[ip[1]];
+            NEXT(4);
+        jmp:
+            ip = code + ip[1];
+            NEXT(0);
+        jz:
+            if (r[D] == 0) {
+                ip = code + ip[1];
+                NEXT(0);
+            }
+            NEXT(2);
+        jnz:
+            if (r[D] != 0) {
+                ip = code + ip[1];
+                NEXT(0);
+            }
+            NEXT(2);
+        jeq:
+            if (r[D] == r[ip[1]]) {
+                ip = code + ip[2];
+                NEXT(0);
+            }
+            NEXT(3);
+        jne:
+            if (r[D] != r[ip[1]]) {
+                ip = code + ip[2];
+                NEXT(0);
+            }
+            NEXT(3);
+        jeqk:
+            if (r[D] == k(ip + 2)) {
+                ip = code + ip[1];
+                NEXT(0);
+            }
+            NEXT(4);
+        jnek:
+            if (r[D] != k(ip + 2)) {
+                ip = code + ip[1];
+                NEXT(0);
+            }
+            NEXT(4);
+        ret:
+            result = r[D];
+            goto leave;
+        retk:
+            result = k(ip + 1);
+            goto leave;
+        call: {
+            const bytecode::Function& callee = program.functions[ip[1]];
+            if (frames.size() == max_depth) {
+                fault = Trap::stack_overflow;
+                return std::nullopt;
+            }
+            const size_t top = base + size;
+            if (regs.size() < top + callee.registers) {
+                regs.resize(std::max(regs.size() * 2, top + callee.registers));
+                r = regs.data() + base;
+            }
+            uint64_t* const args = regs.data() + top;
+            for (uint32_t i = 0; i < ip[2]; i++) {
+                args[i] = r[ip[3 + i]];
+            }
+            frames.push_back({ .ip = ip + 3 + ip[2], .base = base, .size = size, .dest = D });
+            base = top;
+            size = callee.registers;
+            r = args;
+            ip = code + callee.entry;
+            NEXT(0);
+        }
+        leave:
+            if (frames.empty()) {
+                return result;
+            }
+            {
+                const Frame frame = frames.back();
+                frames.pop_back();
+                base = frame.base;
+                size = frame.size;
+                r = regs.data() + base;
+                r[frame.dest] = result;
+                ip = frame.ip;
+            }
+            NEXT(0);
+#undef D
+#undef NEXT
+        }
+
+        [[nodiscard]] inline Trap trap() const {
+            return fault;
+        }
+
+    private:
+        // Where a caller resumes, with its register window and the register
+        // that receives the result.
+        struct Frame {
+            const uint32_t* ip;
+            size_t base;
+            uint32_t size;
+            uint32_t dest;
+        };
+
+        const bytecode::Program& program;
+        std::vector<uint64_t> regs;
+        std::vector<Frame> frames {};
+        Trap fault = Trap::none;
+};
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <span>
+#include <string>
+#include <vector>
+
+// SSA form of a program. Every instruction defines the value of its own index
+// in Function::insts; there are no variables left, a variable's successive
+// assignments become distinct values merged by phis where control flow joins.
+// Blocks are numbered in creation order, which is also a topological order
+// since the language has no loops, and the instructions of one block are
+// contiguous. A function's exit leaves the function rather than the program.
+namespace ir {
+
+using Value = uint32_t;
+using BlockId = uint32_t;
+
+inline constexpr uint32_t none = UINT32_MAX;
+
+// Operands by op:
+//   const_         imm: the value
+//   add sub mul div  a, b: operands
+//   copy           a: source
+//   phi            a, b: first index and length of its arguments in Function::args,
+//                  one per predecessor of its block, in the same order
+//   param          imm: index of the parameter; only in the entry block
+//   call           a, b: first index and length of its arguments in
+//                  Function::args, imm: the callee in Module::functions
+//   nop            removed instruction
+enum class Op : uint8_t {
+    const_,
+    add,
+    sub,
+    mul,
+    div,
+    copy,
+    phi,
+    param,
+    call,
+    nop,
+};
+
+struct Inst {
+    Op op;
+    Value a = none;
+    Value b = none;
+    uint64_t imm = 0;
+};
+
+// How control leaves a block: `jump` to `target`, `branch` to `target` when
+// `value` is non-zero and to `other` otherwise, or `exit` with `value` as the
+// exit status.
+struct Term {
+    enum class Kind : uint8_t {
+        jump,
+        branch,
+        exit,
+    } kind = Kind::exit;
+    Value value = none;
+    BlockId target = none;
+    BlockId other = none;
+};
+
+struct Block {
+    uint32_t first = 0;
+    uint32_t end = 0;
+    uint32_t pred_first = 0;
+    uint32_t pred_count = 0;
+    Term term {};
+    bool reachable = true;
+};
+
+struct Function {
+    std::vector<Inst> insts {};
+    std::vector<Block> blocks {};
+    std::vector<BlockId> preds {};
+    std::vector<Value> args {};
+    std::string name {};
+    uint32_t params = 0;
+
+    [[nodiscard]] inline std::span<const BlockId> preds_of(BlockId block) const {
+        return { preds.data() + blocks[block].pred_first, blocks[block].pred_count };
+    }
+
+    // The arguments of a phi or call.
+    [[nodiscard]] inline std::span<Value> args_of(Value inst) {
+        return { args.data() + insts[inst].a, insts[inst].b };
+    }
+
+    [[nodiscard]] inline std::span<const Value> args_of(Value inst) const {
+        return { args.data() + insts[inst].a, insts[inst].b };
+    }
+
+    // Calls `f` with a reference to every value `inst` reads.
+    template<typename F>
+    inline void for_each_operand(Value inst, F&& f) {
+        visit_operands(*this, inst, f);
+    }
+
+    template<typename F>
+    inline void for_each_operand(Value inst, F&& f) const {
+        visit_operands(*this, inst, f);
+    }
+
+    private:
+        template<typename Self, typename F>
+        static inline void visit_operands(Self& fn, Value inst, F& f) {
+            auto& i = fn.insts[inst];
+            switch (i.op) {
+                case Op::add:
+                case Op::sub:
+                case Op::mul:
+                case Op::div:
+                    f(i.a);
+                    f(i.b);
+                    break;
+                case Op::copy:
+                    f(i.a);
+                    break;
+                case Op::phi:
+                case Op::call:
+                    for (auto& arg : fn.args_of(inst)) {
+                        f(arg);
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+};
+
+// The program's top-level code and the functions it defines, numbered in
+// definition order as in Op::call.
+struct Module {
+    Function main {};
+    std::vector<Function> functions {};
+};
+
+inline void print_value(std::ostream& out, Value value) {
+    out << 'v' << value;
+}
+
+// Writes `fn` in a readable text form for --dump-ir.
+inline void print(std::ostream& out, const Function& fn) {
+    static constexpr const char* names[] = { "const", "add", "sub", "mul", "div", "copy", "phi", "param", "call", "nop" };
+    for (BlockId b = 0; b < fn.blocks.size(); b++) {
+        const Block& block = fn.blocks[b];
+        if (!block.reachable) {
+            continue;
+        }
+        out << 'b' << b << ':';
+        if (block.pred_count > 0) {
+            out << "  ; preds";
+            for (const BlockId pred : fn.preds_of(b)) {
+                out << " b" << pred;
+            }
+        }
+        out << '\n';
+        for (Value v = block.first; v < block.end; v++) {
+            const Inst& inst = fn.insts[v];
+            if (inst.op == Op::nop) {
+                continue;
+            }
+            out << "    ";
+            print_value(out, v);
+            out << " = " << names[static_cast<size_t>(inst.op)] << ' ';
+            switch (inst.op) {
+                case Op::const_:
+                case Op::param:
+                    out << inst.imm;
+                    break;
+                case Op::call: {
+                    out << 'f' << inst.imm << '(';
+                    const std::span<const Value> args = fn.args_of(v);
+                    for (size_t i = 0; i < args.size(); i++) {
+                        if (i > 0) {
+                            out << ", ";
+                        }
+                        print_value(out, args[i]);
+                    }
+                    out << ')';
+                    break;
+                }
+                case Op::copy:
+                    print_value(out, inst.a);
+                    break;
+                case Op::phi: {
+                    const std::span<const Value> args = fn.args_of(v);
+                    const std::span<const BlockId> preds = fn.preds_of(b);
+                    for (size_t i = 0; i < args.size(); i++) {
+                        out << (i ? ", [" : "[");
+                        print_value(out, args[i]);
+                        out << ", b" << preds[i] << ']';
+                    }
+                    break;
+                }
+                default:
+                    print_value(out, inst.a);
+                    out << ", ";
+                    print_value(out, inst.b);
+                    break;
+            }
+            out << '\n';
+        }
+        const Term& term = block.term;
+        switch (term.kind) {
+            case Term::Kind::jump:
+                out << "    jump b" << term.target << '\n';
+                break;
+            case Term::Kind::branch:
+                out << "    branch ";
+                print_value(out, term.value);
+                out << ", b" << term.target << ", b" << term.other << '\n';
+                break;
+            case Term::Kind::exit:
+                out << "    exit ";
+                print_value(out, term.value);
+                out << '\n';
+                break;
+        }
+    }
+}
+
+inline void print(std::ostream& out, const Module& module) {
+    print(out, module.main);
+    for (size_t f = 0; f < module.functions.size(); f++) {
+        out << "\nf" << f << ' ' << module.functions[f].name << '(' << module.functions[f].params << "):\n";
+        print(out, module.functions[f]);
+    }
+}
+
+}
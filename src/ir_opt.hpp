@@ -0,0 +1,356 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "./ir.hpp"
+
+namespace ir {
+
+// SSA passes run between lowering and the backend. They rely on every value
+// being defined at a lower index than any instruction reading it, which
+// lowering guarantees: blocks are created in topological order and phis sit
+// in join blocks, after all their predecessors.
+class Optimizer {
+    public:
+        // Copy propagation can make a branch condition constant, dead code
+        // elimination can empty a block, and removing an edge can leave a phi
+        // with a single argument, so the passes repeat until the branches
+        // stop changing. With `fold`, operations on constants are folded too.
+        inline void optimize(Function& fn, bool fold = false) {
+            do {
+                propagate_copies(fn, fold);
+                eliminate_dead_code(fn);
+            } while (simplify_branches(fn));
+        }
+
+        // Replaces every use of a copy, and of a phi whose arguments are all
+        // the same value, with that value and removes the copy or phi. With
+        // `fold`, an operation on constants, as inlining leaves behind where
+        // the AST optimizer could not see, becomes a constant itself unless
+        // it divides by zero.
+        inline void propagate_copies(Function& fn, bool fold = false) {
+            std::vector<Value> replacement(fn.insts.size());
+            for (Value v = 0; v < fn.insts.size(); v++) {
+                replacement[v] = v;
+            }
+            for (BlockId b = 0; b < fn.blocks.size(); b++) {
+                Block& block = fn.blocks[b];
+                // Phis in a block simplify_branches cut off have no arguments.
+                if (!block.reachable) {
+                    continue;
+                }
+                for (Value v = block.first; v < block.end; v++) {
+                    fn.for_each_operand(v, [&](Value& operand) {
+                        operand = replacement[operand];
+                    });
+                    Inst& inst = fn.insts[v];
+                    if (fold && fold_constant(fn, inst)) {
+                        constants++;
+                        continue;
+                    }
+                    if (inst.op == Op::copy) {
+                        replacement[v] = inst.a;
+                    } else if (inst.op == Op::phi) {
+                        const std::span<const Value> args = fn.args_of(v);
+                        bool same = true;
+                        for (const Value arg : args) {
+                            same &= arg == args[0];
+                        }
+                        if (!same) {
+                            continue;
+                        }
+                        replacement[v] = args[0];
+                    } else {
+                        continue;
+                    }
+                    inst.op = Op::nop;
+                    copies++;
+                }
+                if (block.term.value != none) {
+                    block.term.value = replacement[block.term.value];
+                }
+            }
+        }
+
+        // Turns branches on a constant, or with both edges to the same block,
+        // into jumps, and points edges into an empty block that only jumps on
+        // (the join of an if chain ending an arm, an empty arm) at its final
+        // destination. Predecessor lists and phi arguments are then rebuilt
+        // from the new terminators. Returns whether anything changed.
+        inline bool simplify_branches(Function& fn) {
+            const size_t count = fn.blocks.size();
+            // Where an edge into b ends up once empty blocks are skipped, and the
+            // last block skipped, whose edge into that destination it takes over.
+            std::vector<BlockId> final_target(count);
+            std::vector<BlockId> last_hop(count);
+            for (BlockId b = static_cast<BlockId>(count); b-- > 0;) {
+                final_target[b] = b;
+                last_hop[b] = b;
+                const Block& block = fn.blocks[b];
+                if (b == 0 || !block.reachable || block.term.kind != Term::Kind::jump || has_code(fn, b)) {
+                    continue;
+                }
+                final_target[b] = final_target[block.term.target];
+                last_hop[b] = final_target[block.term.target] == block.term.target ? b : last_hop[block.term.target];
+            }
+
+            // For every block, the block each of its outgoing edges replaces
+            // in the predecessors of its target.
+            std::vector<BlockId> target_via(count, none);
+            std::vector<BlockId> other_via(count, none);
+            bool changed = false;
+            for (BlockId b = 0; b < count; b++) {
+                Block& block = fn.blocks[b];
+                if (!block.reachable) {
+                    continue;
+                }
+                Term& term = block.term;
+                if (term.kind == Term::Kind::branch && fn.insts[term.value].op == Op::const_) {
+                    term.target = fn.insts[term.value].imm != 0 ? term.target : term.other;
+                    term.kind = Term::Kind::jump;
+                    term.value = none;
+                    term.other = none;
+                    folded++;
+                    changed = true;
+                }
+                if (term.kind == Term::Kind::exit) {
+                    continue;
+                }
+                target_via[b] = b;
+                other_via[b] = b;
+                BlockId target = final_target[term.target];
+                if (term.kind == Term::Kind::jump) {
+                    if (target != term.target) {
+                        target_via[b] = last_hop[term.target];
+                        term.target = target;
+                        threaded++;
+                        changed = true;
+                    }
+                    continue;
+                }
+                const BlockId other = final_target[term.other];
+                if (target == other && !has_phis(fn, target)) {
+                    term = { .kind = Term::Kind::jump, .target = target };
+                    folded++;
+                    changed = true;
+                    continue;
+                }
+                // Two edges into one join block would need one phi argument each.
+                if (target == other) {
+                    continue;
+                }
+                if (target != term.target) {
+                    target_via[b] = last_hop[term.target];
+                    term.target = target;
+                    threaded++;
+                    changed = true;
+                }
+                if (other != term.other) {
+                    other_via[b] = last_hop[term.other];
+                    term.other = other;
+                    threaded++;
+                    changed = true;
+                }
+            }
+            if (changed) {
+                rebuild_edges(fn, target_via, other_via);
+            }
+            return changed;
+        }
+
+        // Liveness over values: whatever a reachable terminator reads is live,
+        // as is a division that may trap, and so is every operand of a live
+        // value. Everything else, in particular a variable assignment nothing
+        // reads any more, is removed. Walking backwards visits each value after
+        // all of its readers.
+        inline void eliminate_dead_code(Function& fn) {
+            std::vector<bool> live(fn.insts.size(), false);
+            for (const Block& block : fn.blocks) {
+                if (!block.reachable) {
+                    continue;
+                }
+                if (block.term.value != none) {
+                    live[block.term.value] = true;
+                }
+                for (Value v = block.first; v < block.end; v++) {
+                    if (may_trap(fn, v)) {
+                        live[v] = true;
+                    }
+                }
+            }
+            for (BlockId b = static_cast<BlockId>(fn.blocks.size()); b-- > 0;) {
+                const Block& block = fn.blocks[b];
+                for (Value v = block.end; v-- > block.first;) {
+                    if (fn.insts[v].op == Op::nop) {
+                        continue;
+                    }
+                    if (!live[v] || !block.reachable) {
+                        fn.insts[v].op = Op::nop;
+                        dead++;
+                        continue;
+                    }
+                    fn.for_each_operand(v, [&](Value& operand) {
+                        live[operand] = true;
+                    });
+                }
+            }
+        }
+
+        [[nodiscard]] inline uint64_t copies_propagated() const {
+            return copies;
+        }
+
+        [[nodiscard]] inline uint64_t constants_folded() const {
+            return constants;
+        }
+
+        [[nodiscard]] inline uint64_t branches_folded() const {
+            return folded;
+        }
+
+        [[nodiscard]] inline uint64_t jumps_threaded() const {
+            return threaded;
+        }
+
+        [[nodiscard]] inline uint64_t dead_removed() const {
+            return dead;
+        }
+
+    private:
+        [[nodiscard]] static inline bool fold_constant(const Function& fn, Inst& inst) {
+            if (inst.op < Op::add || inst.op > Op::div) {
+                return false;
+            }
+            const Inst& lhs = fn.insts[inst.a];
+            const Inst& rhs = fn.insts[inst.b];
+            if (lhs.op != Op::const_ || rhs.op != Op::const_) {
+                return false;
+            }
+            uint64_t value;
+            switch (inst.op) {
+                case Op::add:
+                    value = lhs.imm + rhs.imm;
+                    break;
+                case Op::sub:
+                    value = lhs.imm - rhs.imm;
+                    break;
+                case Op::mul:
+                    value = lhs.imm * rhs.imm;
+                    break;
+                default:
+                    if (rhs.imm == 0) {
+                        return false;
+                    }
+                    value = lhs.imm / rhs.imm;
+                    break;
+            }
+            inst = { .op = Op::const_, .imm = value };
+            return true;
+        }
+
+        [[nodiscard]] static inline bool has_code(const Function& fn, BlockId b) {
+            for (Value v = fn.blocks[b].first; v < fn.blocks[b].end; v++) {
+                if (fn.insts[v].op != Op::nop) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        [[nodiscard]] static inline bool has_phis(const Function& fn, BlockId b) {
+            for (Value v = fn.blocks[b].first; v < fn.blocks[b].end; v++) {
+                if (fn.insts[v].op == Op::phi) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Recomputes reachability, predecessor lists and phi arguments from the
+        // terminators; call arguments are carried over unchanged. An edge P -> B takes the phi arguments of the old edge
+        // from `via` into B, P itself unless the edge was threaded past empty
+        // blocks. Those blocks define nothing, so the arguments are available
+        // at the end of P as well.
+        static inline void rebuild_edges(Function& fn, const std::vector<BlockId>& target_via, const std::vector<BlockId>& other_via) {
+            struct Edge {
+                BlockId from;
+                BlockId via;
+            };
+            std::vector<std::vector<Edge>> incoming(fn.blocks.size());
+            for (BlockId b = 0; b < fn.blocks.size(); b++) {
+                Block& block = fn.blocks[b];
+                block.reachable = b == 0;
+                for (const Edge& edge : incoming[b]) {
+                    block.reachable |= fn.blocks[edge.from].reachable;
+                }
+                if (!block.reachable) {
+                    continue;
+                }
+                if (block.term.kind != Term::Kind::exit) {
+                    incoming[block.term.target].push_back({ .from = b, .via = target_via[b] });
+                }
+                if (block.term.kind == Term::Kind::branch) {
+                    incoming[block.term.other].push_back({ .from = b, .via = other_via[b] });
+                }
+            }
+
+            std::vector<BlockId> preds;
+            std::vector<Value> args;
+            std::vector<uint32_t> edge_of(fn.blocks.size());
+            for (BlockId b = 0; b < fn.blocks.size(); b++) {
+                Block& block = fn.blocks[b];
+                const std::span<const BlockId> old_preds = fn.preds_of(b);
+                for (uint32_t i = 0; i < old_preds.size(); i++) {
+                    edge_of[old_preds[i]] = i;
+                }
+                for (Value v = block.first; v < block.end; v++) {
+                    if (fn.insts[v].op == Op::call) {
+                        const uint32_t first = static_cast<uint32_t>(args.size());
+                        args.insert(args.end(), fn.args_of(v).begin(), fn.args_of(v).end());
+                        fn.insts[v].a = first;
+                        continue;
+                    }
+                    if (fn.insts[v].op != Op::phi) {
+                        continue;
+                    }
+                    const uint32_t first = static_cast<uint32_t>(args.size());
+                    for (const Edge& edge : incoming[b]) {
+                        args.push_back(fn.args_of(v)[edge_of[edge.via]]);
+                    }
+                    fn.insts[v].a = first;
+                    fn.insts[v].b = static_cast<uint32_t>(incoming[b].size());
+                }
+                block.pred_first = static_cast<uint32_t>(preds.size());
+                block.pred_count = static_cast<uint32_t>(incoming[b].size());
+                for (const Edge& edge : incoming[b]) {
+                    preds.push_back(edge.from);
+                }
+            }
+            fn.preds = std::move(preds);
+            fn.args = std::move(args);
+        }
+
+        // Division by anything but a known non-zero constant, or a call,
+        // whose callee may divide or recurse without end.
+        [[nodiscard]] static inline bool may_trap(const Function& fn, Value v) {
+            const Inst& inst = fn.insts[v];
+            if (inst.op == Op::call) {
+                return true;
+            }
+            if (inst.op != Op::div) {
+                return false;
+            }
+            const Inst& divisor = fn.insts[inst.b];
+            return divisor.op != Op::const_ || divisor.imm == 0;
+        }
+
+        uint64_t copies = 0;
+        uint64_t constants = 0;
+        uint64_t dead = 0;
+        uint64_t folded = 0;
+        uint64_t threaded = 0;
+};
+
+}
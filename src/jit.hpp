@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Machine code generated with Options::jit, loaded into this process. The
+// code is copied into fresh anonymous pages that are then made read and
+// execute only, so no page is ever writable and executable at once.
+//
+// run() executes the program on the calling thread's stack and returns its
+// exit code. A program that faults, e.g. by dividing by zero, takes the
+// process down with it, as the executable would have.
+class JitCode {
+    public:
+        inline explicit JitCode(std::span<const uint8_t> code) {
+            const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+            const size_t length = (code.size() + page - 1) / page * page;
+            if (length == 0) {
+                return;
+            }
+            void* mem = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) {
+                return;
+            }
+            std::memcpy(mem, code.data(), code.size());
+            if (mprotect(mem, length, PROT_READ | PROT_EXEC) != 0) {
+                munmap(mem, length);
+                return;
+            }
+            mapping = mem;
+            size = length;
+        }
+
+        inline JitCode(const JitCode& other) = delete;
+        inline JitCode operator = (const JitCode& other) = delete;
+
+        inline ~JitCode() {
+            if (mapping) {
+                munmap(mapping, size);
+            }
+        }
+
+        // False when the pages could not be mapped or protected.
+        [[nodiscard]] inline bool ok() const {
+            return mapping != nullptr;
+        }
+
+        [[nodiscard]] inline uint64_t run() const {
+            using Entry = uint64_t (*)();
+            return reinterpret_cast<Entry>(mapping)();
+        }
+
+    private:
+        void* mapping = nullptr;
+        size_t size = 0;
+};
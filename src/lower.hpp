@@ -0,0 +1,555 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "./parser.hpp"
+#include "./ir.hpp"
+#include "./symbol_table.hpp"
+#include "./error.hpp"
+
+// Lowers the AST to SSA form. Variables never reach memory: the symbol table
+// maps each visible variable to its current value, which is how `let` is
+// promoted to a register (mem2reg). Since there are no loops, the only join
+// points are the ends of if chains; every variable some arm changed gets a
+// phi there, or just the common value when all arms agree.
+//
+// Code after a `return` goes into a block without predecessors. It is still
+// lowered so that its errors are reported, but marked unreachable.
+// Likewise, arms the AST optimizer found dead keep their branch on a
+// constant; the IR optimizer removes them once their errors are checked.
+//
+// Within an expression, the operand needing more registers is lowered first
+// (Sethi-Ullman order), so fewer values are live at once in the linear order
+// LinearScan allocates over. Only operands that cannot trap are moved ahead of
+// one that can, so a program stops with the same trap either way.
+//
+// A function can be called once its definition starts, by itself included.
+// Bodies are lowered after the top level, each into its own ir::Function, and
+// see only their parameters.
+class Lowering {
+    public:
+        inline explicit Lowering(const Ast& ast)
+            : ast(ast), seen(ast.names.size(), 0), column(ast.names.size(), 0), function_of(ast.names.size(), ir::none) {
+            label_needs();
+        }
+
+        // Statements are lowered from an explicit stack of frames rather than
+        // by recursion, so scope and if nesting depth only costs heap memory.
+        [[nodiscard]] inline ir::Module lower() {
+            ir::Module module;
+            begin_block({});
+            open_scope(Frame::Kind::scope, ast.root);
+            run();
+            module.main = std::move(fn);
+            for (size_t f = 0; f < definitions.size(); f++) {
+                const NodeId def = definitions[f];
+                fn = { .name = std::string(ast.names[ast[def].a]), .params = static_cast<uint32_t>(ast.params(def).size()) };
+                callable = static_cast<uint32_t>(f + 1);
+                begin_block({});
+                vars.begin_scope();
+                const std::span<const uint32_t> params = ast.params(def);
+                for (uint32_t i = 0; i < params.size(); i++) {
+                    if (vars.lookup(params[i])) {
+                        throw error("Identifier already declared: ", params[i], ast.line(def));
+                    }
+                    vars.declare(params[i], add({ .op = ir::Op::param, .imm = i }));
+                }
+                open_scope(Frame::Kind::scope, ast[def].b);
+                run();
+                vars.end_scope();
+                module.functions.push_back(std::move(fn));
+            }
+            return module;
+        }
+
+    private:
+        // An edge into the join block of an if chain with the values the arm
+        // left in the variables it changed, as a range of `changes`.
+        struct Incoming {
+            ir::BlockId block;
+            uint32_t first;
+            uint32_t count;
+        };
+
+        struct Change {
+            uint32_t id;
+            ir::Value value;
+        };
+
+        struct Visit {
+            NodeId node;
+            bool operands_done = false;
+            bool swapped = false;
+        };
+
+        // The low bits of a node's label count the registers its value
+        // needs as the left operand of a binary operation; a leaf on the
+        // right is used where it is and needs none. `traps` marks a node that
+        // contains a call or a division by anything but a non-zero literal.
+        static constexpr uint8_t traps = 0x80;
+        static constexpr uint8_t need_mask = 0x7f;
+
+        // Children always come before their parents in the node array, so one
+        // pass in order labels every node from labels already known.
+        inline void label_needs() {
+            needs.resize(ast.nodes.size());
+            for (NodeId id = 0; id < ast.nodes.size(); id++) {
+                const Node& node = ast[id];
+                switch (node.kind) {
+                    case NodeKind::int_lit:
+                    case NodeKind::ident:
+                        needs[id] = 1;
+                        break;
+                    case NodeKind::add:
+                    case NodeKind::sub:
+                    case NodeKind::mul:
+                    case NodeKind::div: {
+                        const uint32_t lhs = needs[node.a] & need_mask;
+                        const uint32_t rhs = is_leaf(node.b) ? 0 : needs[node.b] & need_mask;
+                        const uint32_t need = lhs == rhs ? lhs + 1 : std::max(lhs, rhs);
+                        const bool div_traps = node.kind == NodeKind::div
+                            && (ast[node.b].kind != NodeKind::int_lit || ast[node.b].value() == 0);
+                        needs[id] = static_cast<uint8_t>(std::min<uint32_t>(need, need_mask))
+                            | ((needs[node.a] | needs[node.b]) & traps) | (div_traps ? traps : 0);
+                        break;
+                    }
+                    case NodeKind::call: {
+                        // Each argument is evaluated while the ones before it are held.
+                        const std::span<const NodeId> args = ast.args(id);
+                        uint32_t need = static_cast<uint32_t>(args.size());
+                        for (uint32_t i = 0; i < args.size(); i++) {
+                            need = std::max(need, (needs[args[i]] & need_mask) + i);
+                        }
+                        needs[id] = static_cast<uint8_t>(std::min<uint32_t>(need, need_mask)) | traps;
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+        }
+
+        [[nodiscard]] inline bool is_leaf(NodeId id) const {
+            return ast[id].kind == NodeKind::int_lit || ast[id].kind == NodeKind::ident;
+        }
+
+        // Whether the right operand of `node` should be lowered first.
+        [[nodiscard]] inline bool right_first(const Node& node) const {
+            if ((needs[node.a] & traps) && (needs[node.b] & traps)) {
+                return false;
+            }
+            const uint32_t rhs = is_leaf(node.b) ? 0 : needs[node.b] & need_mask;
+            return rhs > (needs[node.a] & need_mask);
+        }
+
+        // A scope whose statements are being lowered; an arm is a scope that
+        // also restores the variables changed since `mark` in `undo` once it
+        // is done. Or an if chain at arm `node`, whose condition ended
+        // `cond_block`; its edges into the join block start at `mark` in
+        // `incoming`, and `to_join` is the block branching there when the
+        // last condition is false.
+        struct Frame {
+            enum class Kind : uint8_t {
+                scope,
+                arm,
+                if_chain,
+            };
+
+            Kind kind;
+            bool in_arm = false;
+            NodeId node;
+            uint32_t index = 0;
+            size_t mark = 0;
+            size_t changes_mark = 0;
+            ir::BlockId cond_block = ir::none;
+            ir::BlockId to_join = ir::none;
+        };
+
+        // Lowers the scope on `frames` and ends the function with `exit 0` in
+        // case it falls off the end.
+        inline void run() {
+            while (!frames.empty()) {
+                step();
+            }
+            finish({ .kind = ir::Term::Kind::exit, .value = constant(0) });
+        }
+
+        // Operands are lowered in post-order, from a stack of nodes still to
+        // visit; the heavier operand of a binary operation goes first.
+        inline ir::Value lower_expr(NodeId expr) {
+            const size_t value_mark = values.size();
+            visits.push_back({ .node = expr });
+            while (!visits.empty()) {
+                const Visit visit = visits.back();
+                visits.pop_back();
+                const Node& node = ast[visit.node];
+                switch (node.kind) {
+                    case NodeKind::int_lit:
+                        values.push_back(constant(node.value()));
+                        continue;
+                    case NodeKind::ident: {
+                        const SymbolTable::Var* var = vars.lookup(node.a);
+                        if (!var) {
+                            throw error("Identifier does not exist: ", node.a, node.b);
+                        }
+                        values.push_back(var->value);
+                        continue;
+                    }
+                    default:
+                        break;
+                }
+                if (!visit.operands_done) {
+                    if (node.kind == NodeKind::call) {
+                        visits.push_back({ .node = visit.node, .operands_done = true });
+                        const std::span<const NodeId> args = ast.args(visit.node);
+                        for (size_t i = args.size(); i-- > 0;) {
+                            visits.push_back({ .node = args[i] });
+                        }
+                    } else if (right_first(node)) {
+                        visits.push_back({ .node = visit.node, .operands_done = true, .swapped = true });
+                        visits.push_back({ .node = node.a });
+                        visits.push_back({ .node = node.b });
+                    } else {
+                        visits.push_back({ .node = visit.node, .operands_done = true });
+                        visits.push_back({ .node = node.b });
+                        visits.push_back({ .node = node.a });
+                    }
+                    continue;
+                }
+                if (node.kind == NodeKind::call) {
+                    lower_call(visit.node);
+                    continue;
+                }
+                const ir::Value second = values.back();
+                values.pop_back();
+                const ir::Value first = values.back();
+                values.back() = visit.swapped ? add({ .op = binary_op(node.kind), .a = second, .b = first })
+                                              : add({ .op = binary_op(node.kind), .a = first, .b = second });
+            }
+            const ir::Value value = values.back();
+            values.resize(value_mark);
+            return value;
+        }
+
+        // Replaces the call's arguments on `values` with the call.
+        inline void lower_call(NodeId call) {
+            const Node& node = ast[call];
+            const uint32_t count = static_cast<uint32_t>(ast.args(call).size());
+            const uint32_t callee = function_of[node.a];
+            if (callee == ir::none || callee >= callable) {
+                throw error("Function does not exist: ", node.a, node.c);
+            }
+            if (ast.params(definitions[callee]).size() != count) {
+                throw error("Wrong number of arguments to function: ", node.a, node.c);
+            }
+            const uint32_t first = static_cast<uint32_t>(fn.args.size());
+            fn.args.insert(fn.args.end(), values.end() - count, values.end());
+            values.resize(values.size() - count);
+            values.push_back(add({ .op = ir::Op::call, .a = first, .b = count, .imm = callee }));
+        }
+
+        [[nodiscard]] static inline ir::Op binary_op(NodeKind kind) {
+            switch (kind) {
+                case NodeKind::add:
+                    return ir::Op::add;
+                case NodeKind::sub:
+                    return ir::Op::sub;
+                case NodeKind::mul:
+                    return ir::Op::mul;
+                default:
+                    return ir::Op::div;
+            }
+        }
+
+        // The value stored by a let or assignment. Reading another variable
+        // becomes an explicit copy for copy propagation to remove.
+        inline ir::Value lower_stored(NodeId expr) {
+            const ir::Value value = lower_expr(expr);
+            if (ast[expr].kind == NodeKind::ident) {
+                return add({ .op = ir::Op::copy, .a = value });
+            }
+            return value;
+        }
+
+        inline void step() {
+            Frame& frame = frames.back();
+            if (frame.kind == Frame::Kind::if_chain) {
+                step_if();
+                return;
+            }
+            const std::span<const NodeId> stmts = ast.stmts(frame.node);
+            if (frame.index == stmts.size()) {
+                vars.end_scope();
+                if (frame.kind == Frame::Kind::arm) {
+                    end_arm(frame.mark);
+                }
+                frames.pop_back();
+                return;
+            }
+            lower_stmt(stmts[frame.index++]);
+        }
+
+        inline void open_scope(Frame::Kind kind, NodeId scope) {
+            vars.begin_scope();
+            frames.push_back({ .kind = kind, .node = scope, .mark = undo.size() });
+        }
+
+        inline void lower_stmt(NodeId stmt) {
+            const Node& node = ast[stmt];
+            switch (node.kind) {
+                case NodeKind::ret:
+                    finish({ .kind = ir::Term::Kind::exit, .value = lower_expr(node.a) });
+                    begin_block({});
+                    break;
+                case NodeKind::let: {
+                    if (vars.lookup(node.a)) {
+                        throw error("Identifier already declared: ", node.a, node.c);
+                    }
+                    const ir::Value value = lower_stored(node.b);
+                    vars.declare(node.a, value);
+                    break;
+                }
+                case NodeKind::assign: {
+                    if (!vars.lookup(node.a)) {
+                        throw error("Undeclared Identifier: ", node.a, node.c);
+                    }
+                    assign(node.a, lower_stored(node.b));
+                    break;
+                }
+                case NodeKind::scope:
+                    open_scope(Frame::Kind::scope, stmt);
+                    break;
+                case NodeKind::if_:
+                    frames.push_back({
+                        .kind = Frame::Kind::if_chain,
+                        .node = stmt,
+                        .mark = incoming.size(),
+                        .changes_mark = changes.size(),
+                    });
+                    break;
+                case NodeKind::fn_def:
+                    if (function_of[node.a] != ir::none) {
+                        throw error("Function already defined: ", node.a, ast.line(stmt));
+                    }
+                    function_of[node.a] = static_cast<uint32_t>(definitions.size());
+                    definitions.push_back(stmt);
+                    callable = static_cast<uint32_t>(definitions.size());
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // Each condition ends its block with a branch to the arm's block and,
+        // on false, to the next condition, the else arm or the join block.
+        // Called once to start each arm and once after it is lowered.
+        inline void step_if() {
+            Frame& chain = frames.back();
+            const Node& node = ast[chain.node];
+            if (!chain.in_arm) {
+                chain.in_arm = true;
+                if (node.kind != NodeKind::else_) {
+                    const ir::Value cond = lower_expr(node.a);
+                    chain.cond_block = current;
+                    finish({ .kind = ir::Term::Kind::branch, .value = cond, .target = next_block() });
+                    begin_block(std::span(&chain.cond_block, 1));
+                }
+                begin_arm(node.b);
+                return;
+            }
+            if (node.kind != NodeKind::else_ && node.c != no_node) {
+                fn.blocks[chain.cond_block].term.other = next_block();
+                begin_block(std::span(&chain.cond_block, 1));
+                chain.node = node.c;
+                chain.in_arm = false;
+                return;
+            }
+            if (node.kind != NodeKind::else_) {
+                if (fn.blocks[chain.cond_block].reachable) {
+                    incoming.push_back({ .block = chain.cond_block, .first = static_cast<uint32_t>(changes.size()), .count = 0 });
+                }
+                chain.to_join = chain.cond_block;
+            }
+
+            const std::span<const Incoming> edges(incoming.begin() + static_cast<ptrdiff_t>(chain.mark), incoming.end());
+            std::vector<ir::BlockId> preds;
+            for (const Incoming& in : edges) {
+                preds.push_back(in.block);
+            }
+            const ir::BlockId join = next_block();
+            if (chain.to_join != ir::none) {
+                fn.blocks[chain.to_join].term.other = join;
+            }
+            for (const Incoming& in : edges) {
+                if (fn.blocks[in.block].term.kind == ir::Term::Kind::jump) {
+                    fn.blocks[in.block].term.target = join;
+                }
+            }
+            begin_block(preds);
+            merge(edges);
+            changes.resize(chain.changes_mark);
+            incoming.resize(chain.mark);
+            frames.pop_back();
+        }
+
+        // Lowers one arm in the block just begun; end_arm then closes it with a
+        // jump to the join block (patched in later) and restores the variables
+        // it changed.
+        inline void begin_arm(NodeId scope) {
+            arm_depth++;
+            open_scope(Frame::Kind::arm, scope);
+        }
+
+        inline void end_arm(size_t mark) {
+            arm_depth--;
+            const bool falls_through = fn.blocks[current].reachable;
+            const uint32_t first = static_cast<uint32_t>(changes.size());
+            stamp++;
+            for (size_t i = undo.size(); i > mark; i--) {
+                const uint32_t id = undo[i - 1].id;
+                const SymbolTable::Var* var = vars.lookup(id);
+                if (!var || seen[id] == stamp) {
+                    continue;
+                }
+                seen[id] = stamp;
+                changes.push_back({ .id = id, .value = var->value });
+            }
+            if (falls_through) {
+                incoming.push_back({ .block = current, .first = first, .count = static_cast<uint32_t>(changes.size() - first) });
+            } else {
+                changes.resize(first);
+            }
+            finish({ .kind = ir::Term::Kind::jump });
+
+            while (undo.size() > mark) {
+                if (SymbolTable::Var* var = vars.lookup(undo.back().id)) {
+                    var->value = undo.back().value;
+                }
+                undo.pop_back();
+            }
+        }
+
+        // Gives every variable changed on some incoming edge its value in the
+        // join block. The table holds one row of values per edge and one column
+        // per changed variable, starting from the values before the if.
+        inline void merge(std::span<const Incoming> edges) {
+            if (edges.empty()) {
+                return;
+            }
+            stamp++;
+            std::vector<uint32_t> ids;
+            for (const Incoming& in : edges) {
+                for (uint32_t i = in.first; i < in.first + in.count; i++) {
+                    const uint32_t id = changes[i].id;
+                    if (seen[id] != stamp) {
+                        seen[id] = stamp;
+                        column[id] = static_cast<uint32_t>(ids.size());
+                        ids.push_back(id);
+                    }
+                }
+            }
+            std::vector<ir::Value> table(edges.size() * ids.size());
+            for (size_t row = 0; row < edges.size(); row++) {
+                for (size_t col = 0; col < ids.size(); col++) {
+                    table[row * ids.size() + col] = vars.lookup(ids[col])->value;
+                }
+                for (uint32_t i = edges[row].first; i < edges[row].first + edges[row].count; i++) {
+                    table[row * ids.size() + column[changes[i].id]] = changes[i].value;
+                }
+            }
+            for (size_t col = 0; col < ids.size(); col++) {
+                const ir::Value first = table[col];
+                bool same = true;
+                for (size_t row = 1; row < edges.size() && same; row++) {
+                    same = table[row * ids.size() + col] == first;
+                }
+                if (same) {
+                    assign(ids[col], first);
+                    continue;
+                }
+                const uint32_t args = static_cast<uint32_t>(fn.args.size());
+                for (size_t row = 0; row < edges.size(); row++) {
+                    fn.args.push_back(table[row * ids.size() + col]);
+                }
+                assign(ids[col], add({ .op = ir::Op::phi, .a = args, .b = static_cast<uint32_t>(edges.size()) }));
+            }
+        }
+
+        [[nodiscard]] inline CompileError error(std::string_view message, uint32_t name, uint32_t line) const {
+            return CompileError(std::string(message) + std::string(ast.names[name]) + " on line " + std::to_string(line), line);
+        }
+
+        inline void assign(uint32_t id, ir::Value value) {
+            SymbolTable::Var* var = vars.lookup(id);
+            if (arm_depth > 0) {
+                undo.push_back({ .id = id, .value = var->value });
+            }
+            var->value = value;
+        }
+
+        inline ir::Value constant(uint64_t value) {
+            return add({ .op = ir::Op::const_, .imm = value });
+        }
+
+        inline ir::Value add(const ir::Inst& inst) {
+            fn.insts.push_back(inst);
+            return static_cast<ir::Value>(fn.insts.size() - 1);
+        }
+
+        [[nodiscard]] inline ir::BlockId next_block() const {
+            return static_cast<ir::BlockId>(fn.blocks.size());
+        }
+
+        // Starts a new current block. It is reachable when one of its
+        // predecessors is, or when it is the entry block.
+        inline void begin_block(std::span<const ir::BlockId> preds) {
+            bool reachable = fn.blocks.empty();
+            for (const ir::BlockId pred : preds) {
+                reachable |= fn.blocks[pred].reachable;
+            }
+            current = next_block();
+            fn.blocks.push_back({
+                .first = static_cast<uint32_t>(fn.insts.size()),
+                .pred_first = static_cast<uint32_t>(fn.preds.size()),
+                .pred_count = static_cast<uint32_t>(preds.size()),
+                .reachable = reachable,
+            });
+            fn.preds.insert(fn.preds.end(), preds.begin(), preds.end());
+        }
+
+        inline void finish(const ir::Term& term) {
+            fn.blocks[current].term = term;
+            fn.blocks[current].end = static_cast<uint32_t>(fn.insts.size());
+        }
+
+        struct Undo {
+            uint32_t id;
+            ir::Value value;
+        };
+
+        const Ast& ast;
+        ir::Function fn {};
+        ir::BlockId current = ir::none;
+        SymbolTable vars {};
+        std::vector<Undo> undo {};
+        std::vector<Change> changes {};
+        std::vector<Incoming> incoming {};
+        std::vector<Frame> frames {};
+        std::vector<Visit> visits {};
+        std::vector<ir::Value> values {};
+        std::vector<uint8_t> needs {};
+        std::vector<uint32_t> seen;
+        std::vector<uint32_t> column;
+        // Index of the function each name is defined as, and the definitions
+        // in order. Only the first `callable` may be called from the code
+        // being lowered.
+        std::vector<uint32_t> function_of;
+        std::vector<NodeId> definitions {};
+        uint32_t callable = 0;
+        uint32_t stamp = 0;
+        size_t arm_depth = 0;
+};
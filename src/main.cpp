@@ -1,49 +1,42 @@
-#include <iostream>
-#include <fstream>
-#include <sstream>
-#include <optional>
-#include <vector>
-
-#include "./tokenizer.hpp"
-#include "./generator.hpp"
-#include "./parser.hpp"
-
-int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "Incorrect Usage!" << std::endl;
-        std::cerr << "Correct Usage : ./main.exe <input.ps>" << std::endl;
-        return EXIT_FAILURE;
-    }
-    
-    std::string contents;
-    {
-        std::stringstream contents_stream;
-        std::fstream input(argv[1], std::ios::in);
-        contents_stream << input.rdbuf();
-        contents = contents_stream.str();
-    }
-
-    Tokenizer tokenizer(std::move(contents));
-    std::vector<Token> tokens = tokenizer.tokenize();
-
-    Parser parser(std::move(tokens));
-    std::optional<NodeProg> prog = parser.parse_prog();
-
-    if (!prog.has_value()) {
-        std::cerr << "No return statement found" << std::endl;
-        exit(EXIT_FAILURE);
-    };
-
-    Generator generator(prog.value());
-    std::string code = generator.gen_prog();
-
-    {
-        std::fstream file("../output.asm", std::ios::out);
-        file << code;
-    }
-
-    system("nasm -felf64 ../output.asm");
-    system("ld -o ../output ../output.o");
-
-    return EXIT_SUCCESS;
-}
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "./cli.hpp"
+#include "./server.hpp"
+
+int main(int argc, char* argv[]) {
+    const std::vector<std::string> args(argv + 1, argv + argc);
+    const CommandLine cmd = parse_command_line(args);
+    if (!cmd.valid) {
+        print_usage(std::cerr);
+        return EXIT_FAILURE;
+    }
+
+    const std::string socket_path = cmd.socket_path.empty() ? wire::default_socket_path() : cmd.socket_path;
+    if (cmd.server) {
+        CompileServer server(socket_path);
+        return server.run() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (cmd.server_stats || cmd.server_stop) {
+        if (std::optional<int> status = forward_to_server(socket_path, args)) {
+            return status.value();
+        }
+        std::cerr << "No compile server listening on " << socket_path << std::endl;
+        return EXIT_FAILURE;
+    }
+    // With PS_COMPILE_SERVER set, compiles go to the server when one is up,
+    // unless the source is this process's standard input or the program is
+    // to run here.
+    const bool reads_stdin = std::find(cmd.inputs.begin(), cmd.inputs.end(), "-") != cmd.inputs.end();
+    if (std::getenv("PS_COMPILE_SERVER") && !reads_stdin && !cmd.run) {
+        if (std::optional<int> status = forward_to_server(socket_path, args)) {
+            return status.value();
+        }
+    }
+
+    ArenaAllocator allocator;
+    return run_command(cmd, {}, std::cout, std::cerr, allocator);
+}
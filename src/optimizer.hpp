@@ -0,0 +1,310 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "./parser.hpp"
+
+// AST pass run between Parser::parse_prog and Generator::gen_prog. Folds
+// literal subexpressions, propagates variables holding known constants into
+// later reads and skips if/elif/else arms whose condition is constant and
+// false, or that follow one that is constant and true. Skipped arms stay in
+// the tree: lowering still checks their names and calls, so a program is
+// rejected the same way at every optimization level, and the IR optimizer
+// removes their branches. Calls are never folded, only their arguments.
+class Optimizer {
+    public:
+        // Statements are visited with an explicit stack of frames rather than
+        // by recursion, so scope and if nesting depth only costs heap memory.
+        inline void optimize(Ast& prog) {
+            ast = &prog;
+            open_scope(prog.root, false);
+            while (!frames.empty()) {
+                step();
+            }
+            ast = nullptr;
+        }
+
+        // Folds `expr` in place and returns its value when it is constant.
+        // Constant subtrees are overwritten with an int_lit node; their
+        // children simply become unreachable. Operands are folded left to
+        // right in post-order, from a stack of nodes still to visit.
+        inline std::optional<uint64_t> fold_expr(NodeId expr) {
+            const size_t value_mark = values.size();
+            visits.push_back({ .node = expr });
+            while (!visits.empty()) {
+                const Visit visit = visits.back();
+                visits.pop_back();
+                Node& node = (*ast)[visit.node];
+                if (node.kind == NodeKind::int_lit) {
+                    values.push_back(node.value());
+                    continue;
+                }
+                if (node.kind == NodeKind::ident) {
+                    values.push_back(lookup(node.a));
+                } else if (!visit.operands_done) {
+                    visits.push_back({ .node = visit.node, .operands_done = true });
+                    if (node.kind == NodeKind::call) {
+                        const std::span<NodeId> args = ast->args(visit.node);
+                        for (size_t i = args.size(); i-- > 0;) {
+                            visits.push_back({ .node = args[i] });
+                        }
+                    } else {
+                        visits.push_back({ .node = node.b });
+                        visits.push_back({ .node = node.a });
+                    }
+                    continue;
+                } else if (node.kind == NodeKind::call) {
+                    values.resize(values.size() - ast->args(visit.node).size());
+                    values.emplace_back();
+                } else {
+                    const std::optional<uint64_t> rhs = values.back();
+                    values.pop_back();
+                    const std::optional<uint64_t> lhs = values.back();
+                    values.back() = fold(node.kind, lhs, rhs);
+                }
+                if (values.back().has_value()) {
+                    node = Node::int_lit(values.back().value());
+                }
+            }
+            const std::optional<uint64_t> value = values.back();
+            values.resize(value_mark);
+            return value;
+        }
+
+    private:
+        struct Binding {
+            bool live = false;
+            std::optional<uint64_t> value;
+        };
+
+        struct Undo {
+            uint32_t id;
+            Binding binding;
+        };
+
+        struct Visit {
+            NodeId node;
+            bool operands_done = false;
+        };
+
+        // A scope whose statements are being optimized; for an arm, `mark` is
+        // where its changes start in `undo`. Or an if chain with `next` the
+        // next arm to look at, `conditional` set once an arm that may not run
+        // has been entered, and `mark` the start of the chain's entries in
+        // `clobbered`.
+        struct Frame {
+            enum class Kind : uint8_t {
+                scope,
+                if_chain,
+            };
+
+            Kind kind;
+            bool arm = false;
+            bool function = false;
+            bool conditional = false;
+            NodeId node;
+            NodeId next = no_node;
+            uint32_t index = 0;
+            size_t mark = 0;
+        };
+
+        [[nodiscard]] static inline std::optional<uint64_t> fold(NodeKind kind, std::optional<uint64_t> lhs, std::optional<uint64_t> rhs) {
+            if (!lhs || !rhs) {
+                return {};
+            }
+            switch (kind) {
+                case NodeKind::add:
+                    return lhs.value() + rhs.value();
+                case NodeKind::sub:
+                    return lhs.value() - rhs.value();
+                case NodeKind::mul:
+                    return lhs.value() * rhs.value();
+                default:
+                    if (rhs.value() == 0) {
+                        return {};
+                    }
+                    return lhs.value() / rhs.value();
+            }
+        }
+
+        inline void step() {
+            Frame& frame = frames.back();
+            if (frame.kind == Frame::Kind::if_chain) {
+                next_arm();
+                return;
+            }
+            const std::span<NodeId> stmts = ast->stmts(frame.node);
+            if (frame.index == stmts.size()) {
+                close_scope();
+                return;
+            }
+            opt_stmt(stmts[frame.index++]);
+        }
+
+        // Scopes and if chains push frames for their contents.
+        inline void opt_stmt(NodeId stmt) {
+            const Node node = (*ast)[stmt];
+            switch (node.kind) {
+                case NodeKind::ret:
+                    fold_expr(node.a);
+                    break;
+                case NodeKind::let:
+                    declare(node.a, fold_expr(node.b));
+                    break;
+                case NodeKind::assign:
+                    assign(node.a, fold_expr(node.b));
+                    break;
+                case NodeKind::scope:
+                    open_scope(stmt, false);
+                    break;
+                case NodeKind::if_:
+                    frames.push_back({ .kind = Frame::Kind::if_chain, .node = stmt, .next = stmt, .mark = begin_branches() });
+                    next_arm();
+                    break;
+                case NodeKind::fn_def:
+                    open_function(stmt);
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        // Opens the scope of the next arm of the chain that can run, or ends
+        // the chain. Arms whose condition is constantly false are skipped, and
+        // a constantly true condition skips every arm after it. An arm that
+        // always runs, because no arm before it may run instead, is opened
+        // as a plain scope so the constants it sets outlive the chain.
+        inline void next_arm() {
+            Frame& chain = frames.back();
+            while (chain.next != no_node) {
+                const Node node = (*ast)[chain.next];
+                bool always = node.kind == NodeKind::else_;
+                chain.next = always ? no_node : node.c;
+                if (!always) {
+                    const std::optional<uint64_t> cond = fold_expr(node.a);
+                    if (cond.has_value() && cond.value() == 0) {
+                        continue;
+                    }
+                    if (cond.has_value()) {
+                        always = true;
+                        chain.next = no_node;
+                    }
+                }
+                const bool arm = !always || chain.conditional;
+                chain.conditional = true;
+                open_scope(node.b, arm);
+                return;
+            }
+            end_branches(chain.mark);
+            frames.pop_back();
+        }
+
+        // An arm is conditionally executed: once it is done, the constants it
+        // changed are rolled back so the next arm starts from the state
+        // before the if.
+        inline void open_scope(NodeId scope, bool arm) {
+            begin_scope();
+            if (arm) {
+                arm_depth++;
+            }
+            frames.push_back({ .kind = Frame::Kind::scope, .arm = arm, .node = scope, .mark = undo.size() });
+        }
+
+        // A function body sees its parameters, with unknown values, and none
+        // of the top level's variables. Definitions are only at the top
+        // level, so `outer` holds the only bindings set aside.
+        inline void open_function(NodeId fn_def) {
+            outer.swap(bindings);
+            bindings.clear();
+            open_scope((*ast)[fn_def].b, false);
+            frames.back().function = true;
+            for (uint32_t param : ast->params(fn_def)) {
+                declare(param, {});
+            }
+        }
+
+        inline void close_scope() {
+            const Frame frame = frames.back();
+            frames.pop_back();
+            end_scope();
+            if (frame.function) {
+                bindings.swap(outer);
+            }
+            if (!frame.arm) {
+                return;
+            }
+            arm_depth--;
+            while (undo.size() > frame.mark) {
+                clobbered.push_back(undo.back().id);
+                bindings[undo.back().id] = undo.back().binding;
+                undo.pop_back();
+            }
+        }
+
+        inline size_t begin_branches() {
+            return clobbered.size();
+        }
+
+        // Anything assigned in some arm is unknown once the if chain is over.
+        inline void end_branches(size_t mark) {
+            while (clobbered.size() > mark) {
+                assign(clobbered.back(), {});
+                clobbered.pop_back();
+            }
+        }
+
+        [[nodiscard]] inline std::optional<uint64_t> lookup(uint32_t id) const {
+            if (id >= bindings.size() || !bindings[id].live) {
+                return {};
+            }
+            return bindings[id].value;
+        }
+
+        inline void declare(uint32_t id, std::optional<uint64_t> value) {
+            if (id >= bindings.size()) {
+                bindings.resize(id + 1);
+            }
+            record(id);
+            bindings[id] = { .live = true, .value = value };
+            scopes.back().push_back(id);
+        }
+
+        inline void assign(uint32_t id, std::optional<uint64_t> value) {
+            if (id >= bindings.size() || !bindings[id].live) {
+                return;
+            }
+            record(id);
+            bindings[id].value = value;
+        }
+
+        inline void record(uint32_t id) {
+            if (arm_depth > 0) {
+                undo.push_back({ .id = id, .binding = bindings[id] });
+            }
+        }
+
+        inline void begin_scope() {
+            scopes.emplace_back();
+        }
+
+        inline void end_scope() {
+            for (uint32_t id : scopes.back()) {
+                bindings[id].live = false;
+            }
+            scopes.pop_back();
+        }
+
+        Ast* ast = nullptr;
+        std::vector<Binding> bindings {};
+        std::vector<Binding> outer {};
+        std::vector<std::vector<uint32_t>> scopes {};
+        std::vector<Undo> undo {};
+        std::vector<uint32_t> clobbered {};
+        std::vector<Frame> frames {};
+        std::vector<Visit> visits {};
+        std::vector<std::optional<uint64_t>> values {};
+        size_t arm_depth = 0;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include <unistd.h>
+
+// Append-only byte buffer for generated text. Bound to a file descriptor it
+// writes itself out whenever it fills up, so memory stays at `capacity` no
+// matter how much is emitted; without one it simply keeps growing.
+class OutputBuffer {
+    public:
+        inline explicit OutputBuffer(int fd = -1, size_t capacity = 64 * 1024) : fd(fd), capacity(capacity) {
+            buffer.reserve(capacity);
+        }
+
+        inline OutputBuffer(const OutputBuffer& other) = delete;
+        inline OutputBuffer operator = (const OutputBuffer& other) = delete;
+
+        inline ~OutputBuffer() {
+            flush();
+        }
+
+        inline void append(std::string_view text) {
+            if (fd >= 0 && buffer.size() + text.size() > capacity) {
+                flush();
+            }
+            buffer.append(text);
+        }
+
+        inline void append(char c) {
+            if (fd >= 0 && buffer.size() + 1 > capacity) {
+                flush();
+            }
+            buffer.push_back(c);
+        }
+
+        inline void append_uint(uint64_t value) {
+            char digits[20];
+            char* end = digits + sizeof(digits);
+            char* p = end;
+            while (value >= 100) {
+                p -= 2;
+                std::memcpy(p, pairs + (value % 100) * 2, 2);
+                value /= 100;
+            }
+            if (value >= 10) {
+                p -= 2;
+                std::memcpy(p, pairs + value * 2, 2);
+            } else {
+                *--p = static_cast<char>('0' + value);
+            }
+            append(std::string_view(p, end - p));
+        }
+
+        inline void append_int(int64_t value) {
+            if (value < 0) {
+                append('-');
+                append_uint(0 - static_cast<uint64_t>(value));
+            } else {
+                append_uint(static_cast<uint64_t>(value));
+            }
+        }
+
+        // Writes pending bytes to the descriptor, if any. Returns false once a write failed.
+        inline bool flush() {
+            if (fd < 0 || failed) {
+                return !failed;
+            }
+            const char* p = buffer.data();
+            size_t left = buffer.size();
+            while (left > 0) {
+                const ssize_t n = ::write(fd, p, left);
+                if (n < 0) {
+                    failed = true;
+                    break;
+                }
+                p += n;
+                left -= static_cast<size_t>(n);
+            }
+            written += buffer.size() - left;
+            buffer.clear();
+            return !failed;
+        }
+
+        // Everything appended so far, for buffers without a descriptor.
+        [[nodiscard]] inline const std::string& str() const {
+            return buffer;
+        }
+
+        [[nodiscard]] inline size_t size() const {
+            return written + buffer.size();
+        }
+
+    private:
+        static constexpr char pairs[] =
+            "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+            "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+
+        int fd;
+        size_t capacity;
+        std::string buffer;
+        size_t written = 0;
+        bool failed = false;
+};
@@ -1,371 +1,519 @@
-#pragma once
-
-#include <variant>
-
-#include "./tokenizer.hpp"
-#include "./arena.hpp"
-
-struct NodeTermInt {
-    Token _int;
-};
-
-struct NodeTermIdent {
-    Token ident;
-};
-
-struct NodeExpr;
-
-struct NodeTermParen {
-    NodeExpr* expr;
-};
-
-struct NodeBinExprAdd {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprMult {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprSub {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExprDiv {
-    NodeExpr* lhs;
-    NodeExpr* rhs;
-};
-
-struct NodeBinExpr {
-    std::variant<NodeBinExprAdd*, NodeBinExprMult*, NodeBinExprSub*, NodeBinExprDiv*> var;    
-};
-
-struct NodeTerm {
-    std::variant<NodeTermIdent*, NodeTermInt*, NodeTermParen*> var;
-};
-
-struct NodeExpr {
-    std::variant<NodeTerm*, NodeBinExpr*> var;
-};
-
-struct NodeStmtRet {
-    NodeExpr* expr;
-};
-
-struct NodeStmtLet {
-    Token ident;
-    NodeExpr* expr;
-};
-
-struct NodeStmt;
-
-struct NodeScope {
-    std::vector<NodeStmt*> stmts;
-};
-
-struct NodeIfPred;
-
-struct NodeIfPredElif {
-    NodeExpr* expr;
-    NodeScope* scope;
-    std::optional<NodeIfPred*> pred;
-};
-
-struct NodeIfPredElse {
-    NodeScope* scope;
-};
-
-struct NodeStmtIf {
-    NodeExpr* expr {};
-    NodeScope* scope {};
-    std::optional<NodeIfPred*> pred; 
-};
-
-struct NodeIfPred {
-    std::variant<NodeIfPredElif*, NodeIfPredElse*> var;
-};
-
-struct NodeStmtAssign {
-    Token ident;
-    NodeExpr* expr;
-};
-
-struct NodeStmt {
-    std::variant<NodeStmtRet*, NodeStmtLet*, NodeScope*, NodeStmtIf*, NodeStmtAssign*> var;
-};
-
-struct NodeProg {
-    std::vector<NodeStmt*> stmts;
-};
-
-class Parser {
-    public:
-        inline explicit Parser(std::vector<Token> tokens) : tokens(std::move(tokens)), allocator(1024 * 1024 * 4) {}
-
-        void error_expected(const std::string& msg) const {
-            std::cerr << "[Parse Error] Expected " << msg << " on line " << peek(-1).value().line << std::endl; 
-            exit(EXIT_FAILURE);
-        }
-
-        std::optional<NodeProg> parse_prog() {
-            NodeProg prog;
-            while (peek().has_value()) {
-                if (auto stmt = parse_stmt()) {
-                    prog.stmts.push_back(stmt.value());
-                } else {
-                    error_expected("statement");
-                }
-            }
-            index = 0;
-            return prog;
-        }
-
-        std::optional<NodeScope*> parse_scope() {
-            if (!try_consume(TokenType::_open_curly)) {
-                return {};
-            }
-            int stmt_line = 0;
-            NodeScope* scope = allocator.alloc<NodeScope>();
-            while (auto stmt = parse_stmt()) {
-                scope->stmts.push_back(stmt.value());
-            }
-            try_consume_err(TokenType::_close_curly);
-            return scope;
-        }
-
-        std::optional<NodeIfPred*> parse_if_pred() {
-            if (try_consume(TokenType::_elif)) {
-                NodeIfPredElif* elif_pred = allocator.alloc<NodeIfPredElif>();
-                try_consume_err(TokenType::_open_paren);
-                if (auto expr = parse_expr()) {
-                    elif_pred->expr = expr.value();
-                } else {
-                    error_expected("expression");
-                }
-                try_consume_err(TokenType::_close_paren);
-                if (auto scope = parse_scope()) {
-                    elif_pred->scope = scope.value();
-                } else {
-                    error_expected("scope");
-                }
-                elif_pred->pred = parse_if_pred();
-                NodeIfPred* if_pred = allocator.alloc<NodeIfPred>();
-                if_pred->var = elif_pred;
-                return if_pred;
-            } else if (try_consume(TokenType::_else)) {
-                NodeIfPredElse* else_pred = allocator.alloc<NodeIfPredElse>();
-                if (auto scope = parse_scope()) {
-                    else_pred->scope = scope.value();
-                } else {
-                    error_expected("scope");
-                }
-                NodeIfPred* if_pred = allocator.alloc<NodeIfPred>();
-                if_pred->var = else_pred;
-                return if_pred;
-            }
-            return {};
-        }
-
-        std::optional<NodeStmt*> parse_stmt() {
-            NodeStmt* stmt_node = allocator.alloc<NodeStmt>();
-            if (peek().has_value() && peek().value().type == TokenType::_return) {
-                NodeStmtRet* return_node = allocator.alloc<NodeStmtRet>();
-                if (peek().value().type == TokenType::_return && peek(1).value().type == TokenType::_open_paren) {
-                    consume();
-                    consume();
-                    if (auto node_expr = parse_expr()) {
-                        return_node->expr = node_expr.value();
-                    } else {
-                        error_expected("expression");
-                    }
-                    try_consume_err(TokenType::_close_paren);
-                    try_consume_err(TokenType::_semi);
-                }
-                stmt_node->var = return_node;
-                return stmt_node;
-            } else if (peek().has_value() && peek().value().type == TokenType::_let && peek(1).has_value() &&
-                        peek(1).value().type == TokenType::_ident &&
-                        peek(2).has_value() && peek(2).value().type == TokenType::_eq) {
-                consume();
-                NodeStmtLet* let_node = allocator.alloc<NodeStmtLet>();
-                let_node->ident = consume();
-                consume();
-                if (auto expr = parse_expr()) {
-                    let_node->expr = expr.value();
-                } else {
-                    error_expected("expression");
-                }
-                try_consume_err(TokenType::_semi);
-                stmt_node->var = let_node;
-                return stmt_node;
-            } else if (peek().has_value() && peek().value().type == TokenType::_open_curly) {
-                if (auto scope = parse_scope()) {
-                    NodeStmt* stmt = allocator.alloc<NodeStmt>();
-                    stmt->var = scope.value();
-                    return stmt;
-                } else {
-                    error_expected("scope");
-                }
-            } else if (try_consume(TokenType::_if)) {
-                NodeStmtIf* stmt_if = allocator.alloc<NodeStmtIf>();
-                try_consume_err(TokenType::_open_paren);
-                if (auto expr = parse_expr()) {
-                    stmt_if->expr = expr.value();
-                } else {
-                    error_expected("expression");
-                }
-                try_consume_err(TokenType::_close_paren);
-                if (auto scope = parse_scope()) {
-                    stmt_if->scope = scope.value();
-                } else {
-                    error_expected("scope");
-                }
-                stmt_if->pred = parse_if_pred();
-                NodeStmt* stmt = allocator.alloc<NodeStmt>();
-                stmt->var = stmt_if;
-                return stmt; 
-            } else if (peek().has_value() && peek().value().type == TokenType::_ident &&
-                        peek(1).has_value() && peek(1).value().type == TokenType::_eq) {
-                NodeStmtAssign* assign_node = allocator.alloc<NodeStmtAssign>();
-                assign_node->ident = consume();
-                consume();
-                if (auto expr = parse_expr()) {
-                    assign_node->expr = expr.value();
-                } else {
-                    error_expected("expression");
-                }
-                try_consume_err(TokenType::_semi);
-                stmt_node->var = assign_node;
-                return stmt_node;
-            } else {
-                return {};
-            }
-            return {};
-        }
-
-        std::optional<NodeTerm*> parse_term() {
-            if (auto int_lit = try_consume(TokenType::_int)) {
-                NodeTerm* term = allocator.alloc<NodeTerm>();
-                NodeTermInt* node_term_int = allocator.alloc<NodeTermInt>();
-                node_term_int->_int = int_lit.value();
-                term->var = node_term_int;
-                return term;
-            } else if (auto ident = try_consume(TokenType::_ident)) {
-                NodeTerm* term = allocator.alloc<NodeTerm>();
-                NodeTermIdent* node_term_ident = allocator.alloc<NodeTermIdent>();
-                node_term_ident->ident = ident.value();
-                term->var = node_term_ident;
-                return term;
-            } else if (auto open_paren = try_consume(TokenType::_open_paren)) {
-                auto expr = parse_expr();
-                if (!expr.has_value()) {
-                    error_expected("expression");
-                }
-                try_consume_err(TokenType::_close_paren);
-                NodeTerm* term = allocator.alloc<NodeTerm>();
-                NodeTermParen* term_paren = allocator.alloc<NodeTermParen>();
-                term_paren->expr = expr.value();
-                term->var = term_paren;
-                return term;
-            } else {
-                return {};
-            }
-        }
-
-        std::optional<NodeExpr*> parse_expr(int min_prec = 0) {
-            std::optional<NodeTerm*> term_lhs = parse_term();
-            if (!term_lhs.has_value()) {
-                return {};
-            }
-
-            NodeExpr* expr_lhs = allocator.alloc<NodeExpr>();
-            expr_lhs->var = term_lhs.value();
-            
-            while (true) {
-                std::optional<Token> token = peek();
-                std::optional<int> prec = bin_prec(token->type);
-                if (token.has_value()) {
-                    if (!prec.has_value() || prec.value() < min_prec) {
-                        break;
-                    }
-                } else {
-                    break;
-                }
-
-                Token op = consume();
-                int next_min_prec = prec.value() + 1;
-                auto expr_rhs = parse_expr(next_min_prec);
-
-                if (!expr_rhs.has_value()) {
-                    error_expected("expression");
-                }
-
-                NodeBinExpr* expr = allocator.alloc<NodeBinExpr>();
-                auto expr_lhs2 = allocator.alloc<NodeExpr>();
-                if (op.type == TokenType::_plus) {
-                    NodeBinExprAdd* add = allocator.alloc<NodeBinExprAdd>();
-                    expr_lhs2->var = expr_lhs->var;
-                    add->lhs = expr_lhs2;
-                    add->rhs = expr_rhs.value();
-                    expr->var = add;
-                } else if (op.type == TokenType::_mult) {
-                    NodeBinExprMult* mult = allocator.alloc<NodeBinExprMult>();
-                    expr_lhs2->var = expr_lhs->var;
-                    mult->lhs = expr_lhs2;
-                    mult->rhs = expr_rhs.value();
-                    expr->var = mult;
-                } else if (op.type == TokenType::_minus) {
-                    NodeBinExprSub* sub = allocator.alloc<NodeBinExprSub>();
-                    expr_lhs2->var = expr_lhs->var;
-                    sub->lhs = expr_lhs2;
-                    sub->rhs = expr_rhs.value();
-                    expr->var = sub;
-                } else if (op.type == TokenType::_fslash) {
-                    NodeBinExprDiv* div = allocator.alloc<NodeBinExprDiv>();
-                    expr_lhs2->var = expr_lhs->var;
-                    div->lhs = expr_lhs2;
-                    div->rhs = expr_rhs.value();
-                    expr->var = div;
-                } else {
-                    error_expected("operand");
-                }
-                expr_lhs->var = expr;  
-            }
-            return expr_lhs;
-        }
-    private:
-        [[nodiscard]] inline std::optional<Token> peek(const int offset = 0) const {
-            if (index + offset >= tokens.size()) {
-                return {};
-            }
-            return tokens.at(index + offset);
-        }
-
-        inline Token consume() {
-            return tokens.at(index++);
-        }
-
-
-        inline Token try_consume_err(TokenType type) {
-            if (peek().has_value() && peek().value().type == type) {
-                return consume();
-            }
-            error_expected(token_to_string(type));
-            return {};
-        }
-
-        inline std::optional<Token> try_consume(TokenType type) {
-            if (peek().has_value() && peek().value().type == type) {
-                return consume();
-            } else {
-                return {};
-            }
-        }
-
-        const std::vector<Token> tokens;
-        size_t index = 0;
-        ArenaAllocator allocator;
+#pragma once
+
+#include <charconv>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include "./tokenizer.hpp"
+#include "./arena.hpp"
+#include "./error.hpp"
+
+// Nodes live in one array and refer to each other by index. Children are
+// always stored before their parents, so the program is in post-order and
+// the root scope comes last.
+using NodeId = uint32_t;
+
+inline constexpr NodeId no_node = UINT32_MAX;
+
+// Meaning of a node's a, b and c fields by kind:
+//   int_lit        a, b: low and high 32 bits of the value
+//   ident          a: interned name, b: source line
+//   add sub mul div  a, b: operands
+//   ret            a: expression
+//   let assign     a: interned name, b: expression, c: source line
+//   scope          a, b: first index and length of its statements in Ast::lists
+//   if_ elif       a: condition, b: scope, c: next elif/else arm or no_node
+//   else_          b: scope
+//   call           a: interned name, b: index in Ast::lists of the argument
+//                  count followed by the arguments, c: source line
+//   fn_def         a: interned name, b: body scope, c: index in Ast::lists of
+//                  the source line and parameter count followed by the
+//                  parameters' interned names
+enum class NodeKind : uint8_t {
+    int_lit,
+    ident,
+    add,
+    sub,
+    mul,
+    div,
+    ret,
+    let,
+    assign,
+    scope,
+    if_,
+    elif,
+    else_,
+    call,
+    fn_def,
+};
+
+struct Node {
+    NodeKind kind;
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t c = no_node;
+
+    [[nodiscard]] static inline Node int_lit(uint64_t value) {
+        return { .kind = NodeKind::int_lit, .a = static_cast<uint32_t>(value), .b = static_cast<uint32_t>(value >> 32) };
+    }
+
+    [[nodiscard]] inline uint64_t value() const {
+        return static_cast<uint64_t>(b) << 32 | a;
+    }
+};
+
+static_assert(sizeof(Node) == 16);
+
+struct Ast {
+    ArenaVector<Node> nodes;
+    ArenaVector<NodeId> lists;
+    ArenaVector<std::string_view> names;
+    NodeId root = no_node;
+
+    inline Node& operator[](NodeId id) const {
+        return nodes[id];
+    }
+
+    [[nodiscard]] inline std::span<NodeId> stmts(NodeId scope) const {
+        return { lists.begin() + nodes[scope].a, nodes[scope].b };
+    }
+
+    [[nodiscard]] inline std::span<NodeId> args(NodeId call) const {
+        return { lists.begin() + nodes[call].b + 1, lists[nodes[call].b] };
+    }
+
+    [[nodiscard]] inline std::span<uint32_t> params(NodeId fn_def) const {
+        return { lists.begin() + nodes[fn_def].c + 2, lists[nodes[fn_def].c + 1] };
+    }
+
+    [[nodiscard]] inline uint32_t line(NodeId fn_def) const {
+        return lists[nodes[fn_def].c];
+    }
+};
+
+class Parser {
+    public:
+        inline explicit Parser(Tokenizer& tokenizer, ArenaAllocator& allocator) : tokens(tokenizer), allocator(allocator) {}
+
+        [[noreturn]] void error_expected(const std::string& msg) {
+            const Token* last = peek(-1);
+            const int line = last ? last->line : 1;
+            throw CompileError("[Parse Error] Expected " + msg + " on line " + std::to_string(line), static_cast<uint32_t>(line));
+        }
+
+        // Statements nest through scopes and if chains, expressions through
+        // parentheses. Neither recurses: every open scope and if chain is a
+        // Frame on `frames` and parse_expr keeps its own operator stack, so
+        // nesting depth only costs heap memory.
+        std::optional<Ast> parse_prog() {
+            nodes.clear();
+            lists.clear();
+            names.clear();
+            frames.push_back({ .kind = Frame::Kind::scope, .mark = static_cast<uint32_t>(pending.size()) });
+            while (true) {
+                if (std::optional<NodeId> stmt = parse_stmt()) {
+                    pending.push_back(stmt.value());
+                    continue;
+                }
+                if (try_consume(TokenType::_open_curly)) {
+                    open_scope();
+                } else if (try_consume(TokenType::_if)) {
+                    open_arm(NodeKind::if_);
+                } else if (try_consume(TokenType::_fn)) {
+                    open_function();
+                } else if (frames.size() > 1) {
+                    try_consume_err(TokenType::_close_curly);
+                    close_scope();
+                } else if (peek()) {
+                    error_expected("statement");
+                } else {
+                    break;
+                }
+            }
+            const NodeId root = add_scope(frames.back().mark);
+            frames.pop_back();
+            // The arena gets one block of exactly the final size per array;
+            // the buffers keep their capacity for the next parse.
+            Ast ast;
+            ast.nodes.assign(allocator, nodes.data(), nodes.size());
+            ast.lists.assign(allocator, lists.data(), lists.size());
+            ast.names.assign(allocator, names.data(), names.size());
+            ast.root = root;
+            return ast;
+        }
+
+        // Parses a return, let or assignment. Scopes and if chains are left
+        // to parse_prog.
+        std::optional<NodeId> parse_stmt() {
+            if (try_consume(TokenType::_return)) {
+                try_consume_err(TokenType::_open_paren);
+                const std::optional<NodeId> expr = parse_expr();
+                if (!expr.has_value()) {
+                    error_expected("expression");
+                }
+                try_consume_err(TokenType::_close_paren);
+                try_consume_err(TokenType::_semi);
+                return add({ .kind = NodeKind::ret, .a = expr.value() });
+            } else if (peek() && peek()->type == TokenType::_let &&
+                        peek(1) && peek(1)->type == TokenType::_ident &&
+                        peek(2) && peek(2)->type == TokenType::_eq) {
+                consume();
+                const Token ident = consume();
+                consume();
+                return add({ .kind = NodeKind::let, .a = name(ident), .b = parse_stmt_expr(), .c = line_of(ident) });
+            } else if (peek() && peek()->type == TokenType::_ident &&
+                        peek(1) && peek(1)->type == TokenType::_eq) {
+                const Token ident = consume();
+                consume();
+                return add({ .kind = NodeKind::assign, .a = name(ident), .b = parse_stmt_expr(), .c = line_of(ident) });
+            }
+            return {};
+        }
+
+        // Precedence climbing over an explicit stack of pending operators and
+        // open parentheses. An operator is applied once one of no higher
+        // precedence follows it, which keeps + - * / left associative and
+        // adds every node after both of its operands. The parenthesis of a
+        // call is an `_ident` on the operator stack, and its arguments are
+        // the operands above the call's mark when it closes.
+        std::optional<NodeId> parse_expr() {
+            const size_t operator_mark = operators.size();
+            const size_t operand_mark = operands.size();
+            size_t open_parens = 0;
+            while (true) {
+                if (const Token* int_lit = try_consume(TokenType::_int)) {
+                    operands.push_back(add(Node::int_lit(int_value(*int_lit))));
+                } else if (const Token* token = try_consume(TokenType::_ident)) {
+                    const Token ident = *token;
+                    if (!try_consume(TokenType::_open_paren)) {
+                        operands.push_back(add({ .kind = NodeKind::ident, .a = name(ident), .b = line_of(ident) }));
+                    } else if (try_consume(TokenType::_close_paren)) {
+                        calls.push_back({ .name = name(ident), .line = line_of(ident), .mark = static_cast<uint32_t>(operands.size()) });
+                        close_call();
+                    } else {
+                        calls.push_back({ .name = name(ident), .line = line_of(ident), .mark = static_cast<uint32_t>(operands.size()) });
+                        operators.push_back(TokenType::_ident);
+                        open_parens++;
+                        continue;
+                    }
+                } else if (try_consume(TokenType::_open_paren)) {
+                    operators.push_back(TokenType::_open_paren);
+                    open_parens++;
+                    continue;
+                } else if (operators.size() == operator_mark) {
+                    return {};
+                } else {
+                    error_expected("expression");
+                }
+
+                // An operand is in: close parentheses, then look for an operator.
+                while (true) {
+                    const Token* token = peek();
+                    const std::optional<int> prec = token ? bin_prec(token->type) : std::nullopt;
+                    if (prec.has_value()) {
+                        reduce(operator_mark, prec.value());
+                        operators.push_back(consume().type);
+                        break;
+                    }
+                    if (token && token->type == TokenType::_close_paren && open_parens > 0) {
+                        consume();
+                        reduce(operator_mark, 0);
+                        if (operators.back() == TokenType::_ident) {
+                            close_call();
+                        }
+                        operators.pop_back();
+                        open_parens--;
+                        continue;
+                    }
+                    if (token && token->type == TokenType::_comma && open_parens > 0) {
+                        reduce(operator_mark, 0);
+                        if (operators.back() != TokenType::_ident) {
+                            error_expected("`)`");
+                        }
+                        consume();
+                        break;
+                    }
+                    if (open_parens > 0) {
+                        try_consume_err(TokenType::_close_paren);
+                    }
+                    reduce(operator_mark, 0);
+                    const NodeId expr = operands.back();
+                    operands.resize(operand_mark);
+                    return expr;
+                }
+            }
+        }
+
+        // Tokens pulled from the tokenizer so far.
+        [[nodiscard]] inline size_t token_count() const {
+            return tokens.count();
+        }
+
+    private:
+        inline NodeId add(const Node& node) {
+            nodes.push_back(node);
+            return static_cast<NodeId>(nodes.size() - 1);
+        }
+
+        // Moves the statements parsed since `mark` into one list for a new scope.
+        inline NodeId add_scope(size_t mark) {
+            const uint32_t first = static_cast<uint32_t>(lists.size());
+            lists.insert(lists.end(), pending.begin() + mark, pending.end());
+            const uint32_t count = static_cast<uint32_t>(pending.size() - mark);
+            pending.resize(mark);
+            return add({ .kind = NodeKind::scope, .a = first, .b = count });
+        }
+
+        // An open scope collects its statements in `pending` from `mark` on; an
+        // if chain collects its arms in `arms` from `mark` on while the scope
+        // of the last one is open.
+        struct Frame {
+            enum class Kind : uint8_t {
+                scope,
+                if_chain,
+                function,
+            };
+
+            Kind kind;
+            uint32_t mark;
+        };
+
+        struct Arm {
+            NodeKind kind;
+            NodeId cond;
+            NodeId scope = no_node;
+        };
+
+        struct Call {
+            uint32_t name;
+            uint32_t line;
+            uint32_t mark;
+        };
+
+        inline void open_scope() {
+            frames.push_back({ .kind = Frame::Kind::scope, .mark = static_cast<uint32_t>(pending.size()) });
+        }
+
+        // Parses `name(params) {` of a function definition and opens its
+        // body. Definitions cannot nest, so `function` holds the only one
+        // being parsed.
+        inline void open_function() {
+            const uint32_t line = static_cast<uint32_t>(peek(-1)->line);
+            if (frames.size() > 1) {
+                throw CompileError("[Parse Error] Functions can only be defined at the top level on line " + std::to_string(line), line);
+            }
+            const Token& ident = try_consume_err(TokenType::_ident);
+            function = { .kind = NodeKind::fn_def, .a = name(ident), .c = static_cast<uint32_t>(lists.size()) };
+            lists.push_back(line);
+            lists.push_back(0);
+            try_consume_err(TokenType::_open_paren);
+            if (!try_consume(TokenType::_close_paren)) {
+                do {
+                    lists.push_back(name(try_consume_err(TokenType::_ident)));
+                    lists[function.c + 1]++;
+                } while (try_consume(TokenType::_comma));
+                try_consume_err(TokenType::_close_paren);
+            }
+            if (lists[function.c + 1] > max_params) {
+                throw CompileError("[Parse Error] Functions take at most " + std::to_string(max_params) + " parameters on line " + std::to_string(line), line);
+            }
+            if (!try_consume(TokenType::_open_curly)) {
+                error_expected("scope");
+            }
+            frames.push_back({ .kind = Frame::Kind::function, .mark = static_cast<uint32_t>(pending.size()) });
+        }
+
+        // Replaces the arguments of the innermost call on `operands` with
+        // the call.
+        inline void close_call() {
+            const Call call = calls.back();
+            calls.pop_back();
+            const uint32_t first = static_cast<uint32_t>(lists.size());
+            lists.push_back(static_cast<uint32_t>(operands.size() - call.mark));
+            lists.insert(lists.end(), operands.begin() + call.mark, operands.end());
+            operands.resize(call.mark);
+            operands.push_back(add({ .kind = NodeKind::call, .a = call.name, .b = first, .c = call.line }));
+        }
+
+        // Parses `(expr) {` of an if or elif arm, or `{` of an else arm, and
+        // opens the arm's scope, starting a new if chain for an if.
+        inline void open_arm(NodeKind kind) {
+            if (kind == NodeKind::if_) {
+                frames.push_back({ .kind = Frame::Kind::if_chain, .mark = static_cast<uint32_t>(arms.size()) });
+            }
+            NodeId cond = no_node;
+            if (kind != NodeKind::else_) {
+                try_consume_err(TokenType::_open_paren);
+                const std::optional<NodeId> expr = parse_expr();
+                if (!expr.has_value()) {
+                    error_expected("expression");
+                }
+                try_consume_err(TokenType::_close_paren);
+                cond = expr.value();
+            }
+            if (!try_consume(TokenType::_open_curly)) {
+                error_expected("scope");
+            }
+            arms.push_back({ .kind = kind, .cond = cond });
+            open_scope();
+        }
+
+        // Ends the innermost scope after its `}` and hands it to whatever
+        // contains it: the enclosing scope, or the if chain it is an arm of.
+        inline void close_scope() {
+            const Frame::Kind kind = frames.back().kind;
+            const NodeId scope = add_scope(frames.back().mark);
+            frames.pop_back();
+            if (kind == Frame::Kind::function) {
+                function.b = scope;
+                pending.push_back(add(function));
+                return;
+            }
+            if (frames.back().kind != Frame::Kind::if_chain) {
+                pending.push_back(scope);
+                return;
+            }
+            arms.back().scope = scope;
+            if (arms.back().kind != NodeKind::else_) {
+                if (try_consume(TokenType::_elif)) {
+                    open_arm(NodeKind::elif);
+                    return;
+                }
+                if (try_consume(TokenType::_else)) {
+                    open_arm(NodeKind::else_);
+                    return;
+                }
+            }
+            // The chain is complete. Its arms are added last to first, each
+            // linking to the next.
+            NodeId next = no_node;
+            for (size_t i = arms.size(); i-- > frames.back().mark;) {
+                const Arm& arm = arms[i];
+                if (arm.kind == NodeKind::else_) {
+                    next = add({ .kind = NodeKind::else_, .b = arm.scope });
+                } else {
+                    next = add({ .kind = arm.kind, .a = arm.cond, .b = arm.scope, .c = next });
+                }
+            }
+            arms.resize(frames.back().mark);
+            frames.pop_back();
+            pending.push_back(next);
+        }
+
+        // Applies the pending operators of at least `min_prec` above the
+        // innermost open parenthesis, or above `mark` when there is none.
+        inline void reduce(size_t mark, int min_prec) {
+            while (operators.size() > mark && bin_prec(operators.back()).value_or(-1) >= min_prec) {
+                const NodeId rhs = operands.back();
+                operands.pop_back();
+                const NodeId lhs = operands.back();
+                operands.back() = add({ .kind = binary_kind(operators.back()), .a = lhs, .b = rhs });
+                operators.pop_back();
+            }
+        }
+
+        [[nodiscard]] static inline NodeKind binary_kind(TokenType op) {
+            switch (op) {
+                case TokenType::_plus:
+                    return NodeKind::add;
+                case TokenType::_minus:
+                    return NodeKind::sub;
+                case TokenType::_mult:
+                    return NodeKind::mul;
+                default:
+                    return NodeKind::div;
+            }
+        }
+
+        [[nodiscard]] static inline uint64_t int_value(const Token& int_lit) {
+            uint64_t value;
+            const std::string_view digits = int_lit.value;
+            auto [end, err] = std::from_chars(digits.data(), digits.data() + digits.size(), value);
+            if (err != std::errc()) {
+                throw CompileError("Integer literal out of range: " + std::string(digits), static_cast<uint32_t>(int_lit.line));
+            }
+            return value;
+        }
+
+        // The `expr;` ending a let or assignment.
+        inline NodeId parse_stmt_expr() {
+            const std::optional<NodeId> expr = parse_expr();
+            if (!expr.has_value()) {
+                error_expected("expression");
+            }
+            try_consume_err(TokenType::_semi);
+            return expr.value();
+        }
+
+        [[nodiscard]] static inline uint32_t line_of(const Token& token) {
+            return static_cast<uint32_t>(token.line);
+        }
+
+        // Records the spelling of an identifier under its interned id.
+        inline uint32_t name(const Token& ident) {
+            if (names.size() <= ident.id) {
+                names.resize(ident.id + 1);
+            }
+            names[ident.id] = ident.value;
+            return ident.id;
+        }
+
+        [[nodiscard]] inline const Token* peek(const int offset = 0) {
+            return tokens.peek(offset);
+        }
+
+        inline const Token& consume() {
+            return tokens.consume();
+        }
+
+
+        inline const Token& try_consume_err(TokenType type) {
+            if (peek() && peek()->type == type) {
+                return consume();
+            }
+            error_expected(token_to_string(type));
+        }
+
+        inline const Token* try_consume(TokenType type) {
+            if (peek() && peek()->type == type) {
+                return &consume();
+            } else {
+                return nullptr;
+            }
+        }
+
+        // The System V ABI passes the first six integer arguments in registers,
+        // and the Generator passes no others.
+        static constexpr uint32_t max_params = 6;
+
+        // Growable buffers the tree is built in before parse_prog copies it
+        // into the arena. They belong to the thread rather than the Parser, so
+        // a batch worker or the compile server reuses the same storage for
+        // every file instead of regrowing it. Only parse_prog touches them and
+        // it never runs inside another parse, so Parsers on one thread can't
+        // interfere.
+        struct Buffers {
+            std::vector<Node> nodes;
+            std::vector<NodeId> lists;
+            std::vector<std::string_view> names;
+        };
+
+        static Buffers& thread_buffers() {
+            thread_local Buffers buffers;
+            return buffers;
+        }
+
+        TokenStream tokens;
+        ArenaAllocator& allocator;
+        std::vector<Node>& nodes = thread_buffers().nodes;
+        std::vector<NodeId>& lists = thread_buffers().lists;
+        std::vector<std::string_view>& names = thread_buffers().names;
+        std::vector<NodeId> pending {};
+        std::vector<Frame> frames {};
+        std::vector<Arm> arms {};
+        std::vector<TokenType> operators {};
+        std::vector<NodeId> operands {};
+        std::vector<Call> calls {};
+        Node function { .kind = NodeKind::fn_def };
 };
\ No newline at end of file
@@ -0,0 +1,234 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <vector>
+
+#include "./asm.hpp"
+
+// Peephole rewrites over the Generator's instruction stream. A rule looks at
+// the last instructions of the list built so far and rewrites them in place.
+// Rules may change flags: generated code only reads them in the jz or jnz
+// right after a test or cmp.
+namespace peephole {
+
+struct Rule {
+    std::string_view name;
+    bool (*apply)(std::vector<Instr>& code);
+};
+
+inline bool is(const Instr& instr, Mnemonic mnemonic) {
+    return instr.mnemonic == mnemonic;
+}
+
+inline bool is_imm(const Operand& op) {
+    return op.kind == Operand::Kind::imm;
+}
+
+// Whether reading `src` reads `dst`, directly or as a memory base or index.
+inline bool reads(const Operand& src, const Operand& dst) {
+    if (src == dst) {
+        return true;
+    }
+    return dst.kind == Operand::Kind::reg && src.kind == Operand::Kind::mem
+        && (src.reg == dst.reg || (src.scale != 0 && src.index == dst.reg));
+}
+
+// Signed change an `add` or `sub` with an immediate applies to its destination.
+inline uint64_t delta(const Instr& instr) {
+    return is(instr, Mnemonic::add) ? instr.src.imm : 0 - instr.src.imm;
+}
+
+inline bool is_add_imm(const Instr& instr) {
+    return (is(instr, Mnemonic::add) || is(instr, Mnemonic::sub)) && is_imm(instr.src);
+}
+
+// mov x, x
+inline bool self_move(std::vector<Instr>& code) {
+    const Instr& last = code.back();
+    if (!is(last, Mnemonic::mov) || last.dst != last.src) {
+        return false;
+    }
+    code.pop_back();
+    return true;
+}
+
+// add x, 0 / sub x, 0
+inline bool add_zero(std::vector<Instr>& code) {
+    const Instr& last = code.back();
+    if (!is_add_imm(last) || last.src.imm != 0) {
+        return false;
+    }
+    code.pop_back();
+    return true;
+}
+
+// mov r, a; add r, b  ->  mov r, a + b
+inline bool fold_imm(std::vector<Instr>& code) {
+    if (code.size() < 2) {
+        return false;
+    }
+    Instr& prev = code.end()[-2];
+    const Instr& last = code.back();
+    if (!is_add_imm(last) || !is(prev, Mnemonic::mov) || prev.dst != last.dst || !is_imm(prev.src)) {
+        return false;
+    }
+    prev.src.imm += delta(last);
+    code.pop_back();
+    return true;
+}
+
+// add x, a; sub x, b  ->  add x, a - b, when that still fits an imm32.
+inline bool merge_imm(std::vector<Instr>& code) {
+    if (code.size() < 2) {
+        return false;
+    }
+    Instr& prev = code.end()[-2];
+    const Instr& last = code.back();
+    if (!is_add_imm(last) || !is_add_imm(prev) || prev.dst != last.dst) {
+        return false;
+    }
+    const int64_t sum = static_cast<int64_t>(delta(prev) + delta(last));
+    if (sum < -INT32_MAX || sum > INT32_MAX) {
+        return false;
+    }
+    prev.mnemonic = sum < 0 ? Mnemonic::sub : Mnemonic::add;
+    prev.src.imm = static_cast<uint64_t>(sum < 0 ? -sum : sum);
+    code.pop_back();
+    return true;
+}
+
+// mov [m], r; mov x, [m]  ->  mov [m], r; mov x, r
+inline bool store_load(std::vector<Instr>& code) {
+    if (code.size() < 2) {
+        return false;
+    }
+    const Instr& prev = code.end()[-2];
+    Instr& last = code.back();
+    if (!is(prev, Mnemonic::mov) || !is(last, Mnemonic::mov) || prev.dst.kind != Operand::Kind::mem
+        || last.src != prev.dst || prev.src.kind != Operand::Kind::reg) {
+        return false;
+    }
+    last.src = prev.src;
+    return true;
+}
+
+// mov a, b; mov b, a  ->  mov a, b
+inline bool move_back(std::vector<Instr>& code) {
+    if (code.size() < 2) {
+        return false;
+    }
+    const Instr& prev = code.end()[-2];
+    const Instr& last = code.back();
+    if (!is(prev, Mnemonic::mov) || !is(last, Mnemonic::mov) || prev.dst != last.src || prev.src != last.dst) {
+        return false;
+    }
+    code.pop_back();
+    return true;
+}
+
+// mov x, a; mov x, b  ->  mov x, b, unless b reads x.
+inline bool dead_move(std::vector<Instr>& code) {
+    if (code.size() < 2) {
+        return false;
+    }
+    const Instr& prev = code.end()[-2];
+    const Instr& last = code.back();
+    if (!is(prev, Mnemonic::mov) || !is(last, Mnemonic::mov) || prev.dst != last.dst || reads(last.src, last.dst)) {
+        return false;
+    }
+    code.end()[-2] = last;
+    code.pop_back();
+    return true;
+}
+
+// jmp L; L:  ->  L:
+inline bool jump_to_next(std::vector<Instr>& code) {
+    if (code.size() < 2) {
+        return false;
+    }
+    const Instr& prev = code.end()[-2];
+    const Instr& last = code.back();
+    if (!is(prev, Mnemonic::jmp) || !is(last, Mnemonic::label) || prev.dst != last.dst) {
+        return false;
+    }
+    code.end()[-2] = last;
+    code.pop_back();
+    return true;
+}
+
+inline constexpr std::array<Rule, 8> default_rules {{
+    { "peephole.self_move", self_move },
+    { "peephole.add_zero", add_zero },
+    { "peephole.fold_imm", fold_imm },
+    { "peephole.merge_imm", merge_imm },
+    { "peephole.store_load", store_load },
+    { "peephole.move_back", move_back },
+    { "peephole.dead_move", dead_move },
+    { "peephole.jump_to_next", jump_to_next },
+}};
+
+// Applies `rules` to the instruction stream as each instruction arrives.
+// After every hit the rules are tried again on the new end of the list, which
+// may now reach instructions further back. Only a window of recent
+// instructions is held: older ones are passed on to `out` in batches, always
+// keeping the last `lookback` (the longest rule's pattern), so memory stays
+// bounded and output streams as with no optimizer. finish() passes on the
+// rest.
+class Optimizer : public AsmSink {
+    public:
+        inline explicit Optimizer(AsmSink& out, std::span<const Rule> rules = default_rules)
+            : out(out), rules(rules), hit_counts(rules.size(), 0) {}
+
+        // Instructions every rule may look back over.
+        static constexpr size_t lookback = 2;
+
+        inline void emit(const Instr& instr) override {
+            if (code.size() == lookback + batch) {
+                for (size_t i = 0; i < batch; i++) {
+                    out.emit(code[i]);
+                }
+                code.erase(code.begin(), code.begin() + batch);
+            }
+            code.push_back(instr);
+            bool changed = true;
+            while (changed && !code.empty()) {
+                changed = false;
+                for (size_t i = 0; i < rules.size(); i++) {
+                    if (rules[i].apply(code)) {
+                        hit_counts[i]++;
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        inline void finish() {
+            for (const Instr& instr : code) {
+                out.emit(instr);
+            }
+            code.clear();
+        }
+
+        [[nodiscard]] inline std::span<const Rule> rule_set() const {
+            return rules;
+        }
+
+        // Times each rule fired, in the order of rule_set().
+        [[nodiscard]] inline std::span<const uint64_t> hits() const {
+            return hit_counts;
+        }
+
+    private:
+        static constexpr size_t batch = 64;
+
+        AsmSink& out;
+        std::span<const Rule> rules;
+        std::vector<uint64_t> hit_counts;
+        std::vector<Instr> code {};
+};
+
+}
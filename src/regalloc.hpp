@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "./asm.hpp"
+
+// Interval of a value in the linear order of the generated code. A value is
+// defined at `start` and read for the last time at `end`. `hint` names the
+// interval whose register this one should inherit when that one dies here,
+// the usual case for two-address arithmetic. `across_call` marks a value
+// still needed after a call that starts inside the interval.
+struct LiveInterval {
+    uint32_t start;
+    uint32_t end;
+    int32_t hint = -1;
+    bool across_call = false;
+};
+
+struct Location {
+    bool spilled = false;
+    Reg reg = Reg::rax;
+    uint32_t slot = 0;
+};
+
+// Linear-scan allocation over the general purpose registers that generated
+// code may freely clobber. rax and rdx are kept out of the pool because `mul`
+// and `div` need them, rsp and rbp hold the stack. Intervals that live across
+// a call take the registers a callee preserves first and the others keep out
+// of them, so fewer values are saved around calls or in a prologue.
+class LinearScan {
+    public:
+        static constexpr std::array<Reg, 12> pool {
+            Reg::rbx, Reg::rcx, Reg::rsi, Reg::rdi, Reg::r8, Reg::r9,
+            Reg::r10, Reg::r11, Reg::r12, Reg::r13, Reg::r14, Reg::r15,
+        };
+
+        [[nodiscard]] static inline bool preserved(Reg reg) {
+            return reg == Reg::rbx || reg == Reg::r12 || reg == Reg::r13 || reg == Reg::r14 || reg == Reg::r15;
+        }
+
+        inline explicit LinearScan(size_t registers = pool.size()) : registers(registers) {}
+
+        // Intervals must be sorted by start. Returns one location per interval and
+        // sets `spill_slots` to the number of stack slots the spilled ones need.
+        inline std::vector<Location> allocate(const std::vector<LiveInterval>& intervals, uint32_t& spill_slots) {
+            std::vector<Location> locs(intervals.size());
+            std::vector<uint32_t> active;
+            // Spilled intervals by ascending end, so expiring them is cheap even
+            // when thousands are live at once.
+            std::priority_queue<std::pair<uint32_t, uint32_t>, std::vector<std::pair<uint32_t, uint32_t>>, std::greater<>> spilled;
+            std::vector<Reg> free_regs(pool.rbegin() + (pool.size() - registers), pool.rend());
+            // Free slots by the end of their last occupant. A spilled victim
+            // lives in its slot from its own start, which may be well before
+            // the current position, so it can only reuse a slot freed earlier.
+            std::priority_queue<std::pair<uint32_t, uint32_t>, std::vector<std::pair<uint32_t, uint32_t>>, std::greater<>> free_slots;
+            spill_slots = 0;
+            const auto take_reg = [&](const LiveInterval& interval) {
+                auto itr = free_regs.end() - 1;
+                for (auto reg = free_regs.rbegin(); reg != free_regs.rend(); reg++) {
+                    if (preserved(*reg) == interval.across_call) {
+                        itr = reg.base() - 1;
+                        break;
+                    }
+                }
+                const Reg reg = *itr;
+                free_regs.erase(itr);
+                return reg;
+            };
+
+            const auto take_slot = [&](uint32_t v) {
+                locs[v].spilled = true;
+                spilled.push({ intervals[v].end, v });
+                if (!free_slots.empty() && free_slots.top().first < intervals[v].start) {
+                    locs[v].slot = free_slots.top().second;
+                    free_slots.pop();
+                } else {
+                    locs[v].slot = spill_slots++;
+                }
+            };
+
+            for (uint32_t v = 0; v < intervals.size(); v++) {
+                const LiveInterval& cur = intervals[v];
+                for (size_t i = 0; i < active.size();) {
+                    if (intervals[active[i]].end < cur.start) {
+                        free_regs.push_back(locs[active[i]].reg);
+                        active.erase(active.begin() + i);
+                    } else {
+                        i++;
+                    }
+                }
+                while (!spilled.empty() && spilled.top().first < cur.start) {
+                    free_slots.push({ spilled.top().first, locs[spilled.top().second].slot });
+                    spilled.pop();
+                }
+
+                if (cur.hint >= 0 && !locs[cur.hint].spilled && intervals[cur.hint].end == cur.start) {
+                    for (size_t i = 0; i < active.size(); i++) {
+                        if (active[i] == static_cast<uint32_t>(cur.hint)) {
+                            active.erase(active.begin() + i);
+                            break;
+                        }
+                    }
+                    locs[v].reg = locs[cur.hint].reg;
+                    insert_active(active, intervals, v);
+                } else if (!free_regs.empty()) {
+                    locs[v].reg = take_reg(cur);
+                    insert_active(active, intervals, v);
+                } else if (!active.empty() && intervals[active.back()].end > cur.end) {
+                    const uint32_t victim = active.back();
+                    active.pop_back();
+                    locs[v].reg = locs[victim].reg;
+                    take_slot(victim);
+                    insert_active(active, intervals, v);
+                } else {
+                    take_slot(v);
+                }
+            }
+            return locs;
+        }
+
+    private:
+        static inline void insert_active(std::vector<uint32_t>& active, const std::vector<LiveInterval>& intervals, uint32_t v) {
+            auto itr = active.begin();
+            while (itr != active.end() && intervals[*itr].end <= intervals[v].end) {
+                itr++;
+            }
+            active.insert(itr, v);
+        }
+
+        size_t registers;
+};
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+// Character classification and run-skipping kernels used by the Tokenizer.
+// Every kernel takes [p, end) and returns a pointer to the first byte that does
+// not belong to the run, never reading past `end`.
+namespace scan {
+
+enum CharClass : uint8_t {
+    cls_space = 1 << 0,
+    cls_newline = 1 << 1,
+    cls_alpha = 1 << 2,
+    cls_digit = 1 << 3,
+    cls_punct = 1 << 4,
+};
+
+inline constexpr std::array<uint8_t, 256> char_class = [] {
+    std::array<uint8_t, 256> table {};
+    for (int c : { ' ', '\t', '\v', '\f', '\r' }) {
+        table[c] = cls_space;
+    }
+    table['\n'] = cls_newline;
+    for (int c = 'a'; c <= 'z'; c++) {
+        table[c] = cls_alpha;
+        table[c - 'a' + 'A'] = cls_alpha;
+    }
+    for (int c = '0'; c <= '9'; c++) {
+        table[c] = cls_digit;
+    }
+    for (int c : { '=', ';', '(', ')', '+', '*', '-', '/', '{', '}', ',' }) {
+        table[c] = cls_punct;
+    }
+    return table;
+}();
+
+[[nodiscard]] inline uint8_t classify(char c) {
+    return char_class[static_cast<unsigned char>(c)];
+}
+
+namespace scalar {
+
+inline const char* skip_class(const char* p, const char* end, uint8_t mask) {
+    while (p < end && (classify(*p) & mask)) {
+        p++;
+    }
+    return p;
+}
+
+inline const char* skip_ident(const char* p, const char* end) {
+    return skip_class(p, end, cls_alpha | cls_digit);
+}
+
+inline const char* skip_digits(const char* p, const char* end) {
+    return skip_class(p, end, cls_digit);
+}
+
+inline const char* skip_space(const char* p, const char* end, int& lines) {
+    while (p < end && (classify(*p) & (cls_space | cls_newline))) {
+        lines += *p == '\n';
+        p++;
+    }
+    return p;
+}
+
+// Advances to the first `c`, counting the newlines passed on the way.
+inline const char* find_byte(const char* p, const char* end, char c, int& lines) {
+    while (p < end && *p != c) {
+        lines += *p == '\n';
+        p++;
+    }
+    return p;
+}
+
+}
+
+#ifdef SCAN_X86
+namespace sse2 {
+
+inline __m128i in_range(__m128i v, char lo, char hi) {
+    return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(lo - 1))),
+                         _mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(hi + 1))));
+}
+
+inline __m128i digit_mask(__m128i v) {
+    return in_range(v, '0', '9');
+}
+
+inline __m128i ident_mask(__m128i v) {
+    const __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+    return _mm_or_si128(in_range(lower, 'a', 'z'), digit_mask(v));
+}
+
+inline __m128i space_mask(__m128i v) {
+    return _mm_or_si128(in_range(v, '\t', '\r'), _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+}
+
+inline uint32_t newlines(__m128i v) {
+    return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))));
+}
+
+inline const char* skip_ident(const char* p, const char* end) {
+    for (; end - p >= 16; p += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const uint32_t stop = ~static_cast<uint32_t>(_mm_movemask_epi8(ident_mask(v))) & 0xffff;
+        if (stop) {
+            return p + __builtin_ctz(stop);
+        }
+    }
+    return scalar::skip_ident(p, end);
+}
+
+inline const char* skip_digits(const char* p, const char* end) {
+    for (; end - p >= 16; p += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const uint32_t stop = ~static_cast<uint32_t>(_mm_movemask_epi8(digit_mask(v))) & 0xffff;
+        if (stop) {
+            return p + __builtin_ctz(stop);
+        }
+    }
+    return scalar::skip_digits(p, end);
+}
+
+inline const char* skip_space(const char* p, const char* end, int& lines) {
+    for (; end - p >= 16; p += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const uint32_t stop = ~static_cast<uint32_t>(_mm_movemask_epi8(space_mask(v))) & 0xffff;
+        if (stop) {
+            const int n = __builtin_ctz(stop);
+            lines += __builtin_popcount(newlines(v) & ((1u << n) - 1));
+            return p + n;
+        }
+        lines += __builtin_popcount(newlines(v));
+    }
+    return scalar::skip_space(p, end, lines);
+}
+
+inline const char* find_byte(const char* p, const char* end, char c, int& lines) {
+    const __m128i needle = _mm_set1_epi8(c);
+    for (; end - p >= 16; p += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const uint32_t stop = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+        if (stop) {
+            const int n = __builtin_ctz(stop);
+            lines += __builtin_popcount(newlines(v) & ((1u << n) - 1));
+            return p + n;
+        }
+        lines += __builtin_popcount(newlines(v));
+    }
+    return scalar::find_byte(p, end, c, lines);
+}
+
+}
+
+namespace avx2 {
+
+#define SCAN_AVX2 __attribute__((target("avx2,popcnt,bmi")))
+
+SCAN_AVX2 inline __m256i in_range(__m256i v, char lo, char hi) {
+    return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(static_cast<char>(lo - 1))),
+                            _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), v));
+}
+
+SCAN_AVX2 inline __m256i digit_mask(__m256i v) {
+    return in_range(v, '0', '9');
+}
+
+SCAN_AVX2 inline __m256i ident_mask(__m256i v) {
+    const __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(in_range(lower, 'a', 'z'), digit_mask(v));
+}
+
+SCAN_AVX2 inline __m256i space_mask(__m256i v) {
+    return _mm256_or_si256(in_range(v, '\t', '\r'), _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')));
+}
+
+SCAN_AVX2 inline uint32_t newlines(__m256i v) {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))));
+}
+
+SCAN_AVX2 inline uint32_t below(int n) {
+    return n == 32 ? ~0u : (1u << n) - 1;
+}
+
+SCAN_AVX2 inline const char* skip_ident(const char* p, const char* end) {
+    for (; end - p >= 32; p += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(ident_mask(v)));
+        if (stop) {
+            return p + __builtin_ctz(stop);
+        }
+    }
+    return sse2::skip_ident(p, end);
+}
+
+SCAN_AVX2 inline const char* skip_digits(const char* p, const char* end) {
+    for (; end - p >= 32; p += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(digit_mask(v)));
+        if (stop) {
+            return p + __builtin_ctz(stop);
+        }
+    }
+    return sse2::skip_digits(p, end);
+}
+
+SCAN_AVX2 inline const char* skip_space(const char* p, const char* end, int& lines) {
+    for (; end - p >= 32; p += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const uint32_t stop = ~static_cast<uint32_t>(_mm256_movemask_epi8(space_mask(v)));
+        if (stop) {
+            const int n = __builtin_ctz(stop);
+            lines += __builtin_popcount(newlines(v) & below(n));
+            return p + n;
+        }
+        lines += __builtin_popcount(newlines(v));
+    }
+    return sse2::skip_space(p, end, lines);
+}
+
+SCAN_AVX2 inline const char* find_byte(const char* p, const char* end, char c, int& lines) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    for (; end - p >= 32; p += 32) {
+        const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+        const uint32_t stop = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+        if (stop) {
+            const int n = __builtin_ctz(stop);
+            lines += __builtin_popcount(newlines(v) & below(n));
+            return p + n;
+        }
+        lines += __builtin_popcount(newlines(v));
+    }
+    return sse2::find_byte(p, end, c, lines);
+}
+
+#undef SCAN_AVX2
+
+}
+#endif
+
+enum class Isa {
+    scalar,
+    sse2,
+    avx2,
+};
+
+struct Kernels {
+    Isa isa;
+    const char* (*skip_ident)(const char*, const char*);
+    const char* (*skip_digits)(const char*, const char*);
+    const char* (*skip_space)(const char*, const char*, int&);
+    const char* (*find_byte)(const char*, const char*, char, int&);
+};
+
+[[nodiscard]] inline bool supported(Isa isa) {
+#ifdef SCAN_X86
+    switch (isa) {
+        case Isa::avx2:
+            return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("bmi");
+        default:
+            return true;
+    }
+#else
+    return isa == Isa::scalar;
+#endif
+}
+
+// Returns the kernels for `isa`, degrading to the best supported set below it.
+[[nodiscard]] inline Kernels kernels_for(Isa isa) {
+#ifdef SCAN_X86
+    if (isa == Isa::avx2 && supported(Isa::avx2)) {
+        return { Isa::avx2, avx2::skip_ident, avx2::skip_digits, avx2::skip_space, avx2::find_byte };
+    }
+    if (isa != Isa::scalar) {
+        return { Isa::sse2, sse2::skip_ident, sse2::skip_digits, sse2::skip_space, sse2::find_byte };
+    }
+#endif
+    return { Isa::scalar, scalar::skip_ident, scalar::skip_digits, scalar::skip_space, scalar::find_byte };
+}
+
+[[nodiscard]] inline const Kernels& best_kernels() {
+    static const Kernels kernels = kernels_for(Isa::avx2);
+    return kernels;
+}
+
+[[nodiscard]] inline const char* isa_name(Isa isa) {
+    switch (isa) {
+        case Isa::avx2:
+            return "avx2";
+        case Isa::sse2:
+            return "sse2";
+        default:
+            return "scalar";
+    }
+}
+
+}
@@ -0,0 +1,431 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "./cli.hpp"
+
+// Wire format shared by the compile server and its client. A message is a
+// 32-bit length followed by that many bytes. Requests hold NUL-separated
+// fields: the client's working directory, then its arguments. Replies hold
+// the exit status byte, the stdout text, a NUL and the stderr text.
+namespace wire {
+
+inline std::string default_socket_path() {
+    if (const char* path = std::getenv("PS_COMPILE_SERVER"); path && *path) {
+        return path;
+    }
+    return "/tmp/ps-compile-" + std::to_string(getuid()) + ".sock";
+}
+
+// Sockets only. MSG_NOSIGNAL turns a peer that has gone away into EPIPE
+// instead of a SIGPIPE that would kill the server.
+inline bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool read_all(int fd, char* data, size_t size) {
+    while (size > 0) {
+        const ssize_t n = ::read(fd, data, size);
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+inline bool send(int fd, const std::string& payload) {
+    const uint32_t size = static_cast<uint32_t>(payload.size());
+    return write_all(fd, reinterpret_cast<const char*>(&size), sizeof(size)) && write_all(fd, payload.data(), payload.size());
+}
+
+inline std::optional<std::string> receive(int fd) {
+    uint32_t size;
+    if (!read_all(fd, reinterpret_cast<char*>(&size), sizeof(size)) || size > (64u << 20)) {
+        return {};
+    }
+    std::string payload(size, '\0');
+    if (!read_all(fd, payload.data(), size)) {
+        return {};
+    }
+    return payload;
+}
+
+inline std::vector<std::string> split(const std::string& payload) {
+    std::vector<std::string> fields;
+    size_t start = 0;
+    while (start <= payload.size()) {
+        const size_t end = std::min(payload.find('\0', start), payload.size());
+        fields.push_back(payload.substr(start, end - start));
+        start = end + 1;
+    }
+    return fields;
+}
+
+inline int connect_to(const std::string& socket_path) {
+    sockaddr_un addr {};
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        return -1;
+    }
+    addr.sun_family = AF_UNIX;
+    std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+}
+
+// Thin client: forwards `args` and the working directory to the server at
+// `socket_path` and replays its output. Returns an empty optional when no
+// server is listening so the caller can compile in-process instead.
+inline std::optional<int> forward_to_server(const std::string& socket_path, const std::vector<std::string>& args) {
+    const int fd = wire::connect_to(socket_path);
+    if (fd < 0) {
+        return {};
+    }
+    std::string request = std::filesystem::current_path().string();
+    for (const std::string& arg : args) {
+        request += '\0';
+        request += arg;
+    }
+    std::optional<std::string> reply;
+    if (wire::send(fd, request)) {
+        reply = wire::receive(fd);
+    }
+    close(fd);
+    if (!reply.has_value() || reply->empty()) {
+        std::cerr << "Lost connection to compile server at " << socket_path << std::endl;
+        return EXIT_FAILURE;
+    }
+    const size_t split = std::min(reply->find('\0', 1), reply->size());
+    std::cout << std::string_view(*reply).substr(1, split - 1) << std::flush;
+    if (split < reply->size()) {
+        std::cerr << std::string_view(*reply).substr(split + 1) << std::flush;
+    }
+    return static_cast<unsigned char>((*reply)[0]);
+}
+
+// Resident compiler behind a Unix domain socket. It keeps one warm
+// ArenaAllocator for all requests and the machine code of every source it has
+// compiled, and watches their directories with inotify: when a watched file
+// is rewritten it is recompiled straight away, so the next request for it
+// only checks the file's size and mtime and writes out the stored code.
+class CompileServer {
+    public:
+        inline explicit CompileServer(std::string socket_path) : socket_path(std::move(socket_path)) {}
+
+        inline CompileServer(const CompileServer& other) = delete;
+        inline CompileServer operator = (const CompileServer& other) = delete;
+
+        inline ~CompileServer() {
+            if (listen_fd >= 0) {
+                close(listen_fd);
+                unlink(socket_path.c_str());
+            }
+            if (inotify_fd >= 0) {
+                close(inotify_fd);
+            }
+        }
+
+        // Serves requests until a --server-stop request arrives. Returns false
+        // when the socket cannot be set up.
+        inline bool run() {
+            if (!listen_on_socket()) {
+                return false;
+            }
+            inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            while (!stopping) {
+                pollfd fds[2] = {
+                    { .fd = listen_fd, .events = POLLIN, .revents = 0 },
+                    { .fd = inotify_fd, .events = POLLIN, .revents = 0 },
+                };
+                if (poll(fds, inotify_fd >= 0 ? 2 : 1, -1) < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    return false;
+                }
+                if (inotify_fd >= 0 && (fds[1].revents & POLLIN)) {
+                    drain_inotify();
+                }
+                if (fds[0].revents & POLLIN) {
+                    const int client = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+                    if (client >= 0 && set_timeouts(client)) {
+                        serve(client);
+                    }
+                    if (client >= 0) {
+                        close(client);
+                    }
+                }
+            }
+            return true;
+        }
+
+    private:
+        // Machine code for a watched source, valid while the file still has
+        // the recorded size and modification time.
+        struct Precompiled {
+            int opt_level = 1;
+            std::filesystem::file_time_type mtime {};
+            uint64_t size = 0;
+            std::optional<std::vector<uint8_t>> code;
+        };
+
+        // Requests are served one at a time, so a client that stops sending
+        // or reading mid-message must not hold up the ones queued behind it:
+        // its reads and writes time out and the request is dropped.
+        static inline bool set_timeouts(int client) {
+            const timeval timeout { .tv_sec = client_timeout_s, .tv_usec = 0 };
+            return setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0
+                && setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) == 0;
+        }
+
+        inline bool listen_on_socket() {
+            sockaddr_un addr {};
+            if (socket_path.size() >= sizeof(addr.sun_path)) {
+                std::cerr << "Socket path too long: " << socket_path << std::endl;
+                return false;
+            }
+            // A socket file nobody answers on is left over from a dead server.
+            if (const int fd = wire::connect_to(socket_path); fd >= 0) {
+                close(fd);
+                std::cerr << "A compile server is already listening on " << socket_path << std::endl;
+                return false;
+            }
+            unlink(socket_path.c_str());
+            addr.sun_family = AF_UNIX;
+            std::memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+            listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) != 0
+                || listen(listen_fd, 64) != 0) {
+                std::cerr << "Could not listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+        inline void serve(int client) {
+            const std::optional<std::string> request = wire::receive(client);
+            if (!request.has_value()) {
+                return;
+            }
+            const auto start = std::chrono::steady_clock::now();
+            std::vector<std::string> fields = wire::split(request.value());
+            const std::filesystem::path cwd = fields.front();
+            fields.erase(fields.begin());
+
+            std::ostringstream out;
+            std::ostringstream err;
+            int status = EXIT_SUCCESS;
+            const CommandLine cmd = parse_command_line(fields);
+            if (!cmd.valid) {
+                print_usage(err);
+                status = EXIT_FAILURE;
+            } else if (cmd.server_stats) {
+                write_stats(out);
+            } else if (cmd.server_stop) {
+                stopping = true;
+            } else if (cmd.server) {
+                err << "A compile server is already running" << std::endl;
+                status = EXIT_FAILURE;
+            } else if (cmd.run) {
+                // Programs run in the process that compiles them.
+                err << "--run is not served by the compile server" << std::endl;
+                status = EXIT_FAILURE;
+            } else {
+                status = compile(cmd, cwd, out, err);
+                const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                record_latency(elapsed.count());
+            }
+
+            std::string reply(1, static_cast<char>(status));
+            reply += out.str();
+            reply += '\0';
+            reply += err.str();
+            wire::send(client, reply);
+        }
+
+        inline int compile(const CommandLine& cmd, const std::filesystem::path& cwd, std::ostream& out, std::ostream& err) {
+            const bool plain = cmd.out_dir.empty() && !cmd.options.use_nasm && !cmd.options.bytecode && cmd.cache_dir.empty()
+                && !cmd.time_passes && !cmd.print_stats && cmd.json_path.empty() && !cmd.dump_ir;
+            for (const std::string& input : cmd.inputs) {
+                watch((cwd / input).lexically_normal(), cmd.options.opt_level);
+            }
+            if (plain) {
+                const std::string source = (cwd / cmd.inputs[0]).lexically_normal().string();
+                Precompiled& entry = precompiled[source];
+                if (entry.code.has_value() && fresh(source, entry)) {
+                    precompiled_hits++;
+                } else {
+                    precompile(source, entry);
+                }
+                if (entry.code.has_value()) {
+                    if (elf::write_executable((cwd / cmd.output_path).string(), entry.code.value())) {
+                        return EXIT_SUCCESS;
+                    }
+                    entry.code.reset();
+                }
+            }
+            // Everything else, including reporting the errors of a failed
+            // precompile, goes through the ordinary driver.
+            const int status = run_command(cmd, cwd, out, err, allocator);
+            allocator.reset();
+            return status;
+        }
+
+        [[nodiscard]] static inline bool fresh(const std::string& source, const Precompiled& entry) {
+            std::error_code ec;
+            const std::filesystem::file_time_type mtime = std::filesystem::last_write_time(source, ec);
+            const uint64_t size = std::filesystem::file_size(source, ec);
+            return !ec && mtime == entry.mtime && size == entry.size;
+        }
+
+        // Starts watching the directory holding `source` and remembers the
+        // options it was last compiled with.
+        inline void watch(const std::filesystem::path& source, int opt_level) {
+            Precompiled& entry = precompiled[source.string()];
+            if (entry.opt_level != opt_level) {
+                entry.opt_level = opt_level;
+                entry.code.reset();
+            }
+            if (inotify_fd < 0) {
+                return;
+            }
+            const std::string dir = source.parent_path().string();
+            if (watched_dirs.contains(dir)) {
+                return;
+            }
+            const int wd = inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+            if (wd >= 0) {
+                watched_dirs.insert(dir);
+                dirs[wd] = dir;
+            }
+        }
+
+        inline void drain_inotify() {
+            alignas(inotify_event) char buffer[16 * 1024];
+            while (true) {
+                const ssize_t n = ::read(inotify_fd, buffer, sizeof(buffer));
+                if (n <= 0) {
+                    return;
+                }
+                for (ssize_t at = 0; at < n;) {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer + at);
+                    at += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                    const auto dir = dirs.find(event->wd);
+                    if (dir == dirs.end() || event->len == 0) {
+                        continue;
+                    }
+                    const std::string path = (std::filesystem::path(dir->second) / event->name).string();
+                    if (const auto it = precompiled.find(path); it != precompiled.end()) {
+                        precompile(it->first, it->second);
+                    }
+                }
+            }
+        }
+
+        inline void precompile(const std::string& path, Precompiled& entry) {
+            entry.code.reset();
+            std::error_code ec;
+            entry.mtime = std::filesystem::last_write_time(path, ec);
+            entry.size = std::filesystem::file_size(path, ec);
+            const SourceFile file(path);
+            if (ec || !file.ok()) {
+                return;
+            }
+            Options options;
+            options.opt_level = entry.opt_level;
+            Stats stats;
+            try {
+                entry.code = compile_code(file.text(), options, allocator, stats);
+                precompiles++;
+            } catch (const CompileError&) {
+                // The next request for this file compiles it again and reports the error.
+            }
+            allocator.reset();
+        }
+
+        // Percentiles cover the last `latency_window` requests, kept in a ring;
+        // the count and the maximum cover every request.
+        inline void record_latency(double seconds) {
+            if (latencies.size() < latency_window) {
+                latencies.push_back(seconds);
+            } else {
+                latencies[requests % latency_window] = seconds;
+            }
+            requests++;
+            latency_max = std::max(latency_max, seconds);
+        }
+
+        inline void write_stats(std::ostream& out) const {
+            std::vector<double> sorted = latencies;
+            std::sort(sorted.begin(), sorted.end());
+            const auto percentile = [&sorted](double p) {
+                if (sorted.empty()) {
+                    return 0.0;
+                }
+                const size_t i = static_cast<size_t>(p / 100 * static_cast<double>(sorted.size() - 1) + 0.5);
+                return sorted[i] * 1e3;
+            };
+            out << "requests            " << requests << '\n';
+            out << "precompiled_hits    " << precompiled_hits << '\n';
+            out << "precompiles         " << precompiles << '\n';
+            out << "watched_files       " << precompiled.size() << '\n';
+            out << "latency_p50_ms      " << percentile(50) << '\n';
+            out << "latency_p90_ms      " << percentile(90) << '\n';
+            out << "latency_p99_ms      " << percentile(99) << '\n';
+            out << "latency_max_ms      " << latency_max * 1e3 << '\n';
+        }
+
+        static constexpr time_t client_timeout_s = 2;
+        static constexpr size_t latency_window = 4096;
+
+        const std::string socket_path;
+        int listen_fd = -1;
+        int inotify_fd = -1;
+        bool stopping = false;
+        ArenaAllocator allocator;
+        std::unordered_map<std::string, Precompiled> precompiled;
+        std::unordered_map<int, std::string> dirs;
+        std::unordered_set<std::string> watched_dirs;
+        std::vector<double> latencies;
+        uint64_t requests = 0;
+        double latency_max = 0;
+        uint64_t precompiled_hits = 0;
+        uint64_t precompiles = 0;
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The text of one input file, read without copying where possible. A regular
+// file is mapped read-only and advised for sequential access, so the
+// tokenizer scans the page cache directly and pages it has passed can be
+// dropped under memory pressure. Pipes, terminals and other files that cannot
+// be mapped are read into a buffer instead; "-" reads standard input.
+//
+// Views into text(), such as tokens and AST names, are only valid while the
+// SourceFile lives.
+class SourceFile {
+    public:
+        inline explicit SourceFile(const std::string& path) {
+            const int fd = path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                return;
+            }
+            struct stat st {};
+            if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+                map(fd, static_cast<size_t>(st.st_size));
+            }
+            if (!mapping) {
+                read_all(fd);
+            }
+            if (fd != STDIN_FILENO) {
+                close(fd);
+            }
+        }
+
+        inline SourceFile(const SourceFile& other) = delete;
+        inline SourceFile operator = (const SourceFile& other) = delete;
+
+        inline ~SourceFile() {
+            if (mapping) {
+                munmap(mapping, size);
+            }
+        }
+
+        // False when the file could not be opened or read.
+        [[nodiscard]] inline bool ok() const {
+            return readable;
+        }
+
+        [[nodiscard]] inline bool mapped() const {
+            return mapping != nullptr;
+        }
+
+        [[nodiscard]] inline std::string_view text() const {
+            if (mapping) {
+                return { static_cast<const char*>(mapping), size };
+            }
+            return buffer;
+        }
+
+    private:
+        inline void map(int fd, size_t length) {
+            void* mem = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mem == MAP_FAILED) {
+                return;
+            }
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            madvise(mem, length, MADV_SEQUENTIAL);
+            mapping = mem;
+            size = length;
+            readable = true;
+        }
+
+        inline void read_all(int fd) {
+            char chunk[64 * 1024];
+            while (true) {
+                const ssize_t n = read(fd, chunk, sizeof(chunk));
+                if (n < 0) {
+                    return;
+                }
+                if (n == 0) {
+                    break;
+                }
+                buffer.append(chunk, static_cast<size_t>(n));
+            }
+            readable = true;
+        }
+
+        void* mapping = nullptr;
+        size_t size = 0;
+        std::string buffer {};
+        bool readable = false;
+};
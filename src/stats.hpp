@@ -0,0 +1,184 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "./parser.hpp"
+
+// Per-phase timings and counters for --time-passes / --stats. A disabled
+// Stats never reads a clock: its timers carry a null pointer and the counters
+// are only gathered when enabled() is true.
+class Stats {
+    public:
+        struct Phase {
+            std::string_view name;
+            double wall;
+            double cpu;
+        };
+
+        struct Counter {
+            std::string_view name;
+            uint64_t value;
+        };
+
+        // Records the time between its construction and destruction as one phase.
+        class Timer {
+            public:
+                inline Timer(Stats* stats, std::string_view name) : stats(stats), name(name) {
+                    if (stats) {
+                        wall_start = std::chrono::steady_clock::now();
+                        cpu_start = cpu_seconds();
+                    }
+                }
+
+                inline Timer(const Timer& other) = delete;
+                inline Timer operator = (const Timer& other) = delete;
+
+                inline ~Timer() {
+                    if (stats) {
+                        const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wall_start;
+                        stats->phases.push_back({ .name = name, .wall = wall.count(), .cpu = cpu_seconds() - cpu_start });
+                    }
+                }
+
+            private:
+                Stats* stats;
+                std::string_view name;
+                std::chrono::steady_clock::time_point wall_start {};
+                double cpu_start = 0;
+        };
+
+        inline explicit Stats(bool enabled = false) : on(enabled) {}
+
+        [[nodiscard]] inline bool enabled() const {
+            return on;
+        }
+
+        [[nodiscard]] inline Timer time(std::string_view name) {
+            return Timer(on ? this : nullptr, name);
+        }
+
+        inline void count(std::string_view name, uint64_t value) {
+            if (on) {
+                counters.push_back({ .name = name, .value = value });
+            }
+        }
+
+        // Adds the phases and counters of `other` into those of the same name,
+        // appending the ones not seen yet. Phases of files compiled in
+        // parallel add up to more wall time than the batch took.
+        inline void merge(const Stats& other) {
+            if (!on) {
+                return;
+            }
+            for (const Phase& phase : other.phases) {
+                const auto it = std::find_if(phases.begin(), phases.end(), [&](const Phase& p) { return p.name == phase.name; });
+                if (it == phases.end()) {
+                    phases.push_back(phase);
+                } else {
+                    it->wall += phase.wall;
+                    it->cpu += phase.cpu;
+                }
+            }
+            for (const Counter& counter : other.counters) {
+                const auto it = std::find_if(counters.begin(), counters.end(), [&](const Counter& c) { return c.name == counter.name; });
+                if (it == counters.end()) {
+                    counters.push_back(counter);
+                } else {
+                    it->value += counter.value;
+                }
+            }
+        }
+
+        // Counts the nodes of a freshly parsed `ast` by kind, plus the bytes
+        // its node and list arrays occupy.
+        inline void count_nodes(const Ast& ast) {
+            if (!on) {
+                return;
+            }
+            std::array<uint64_t, node_kind_names.size()> counts {};
+            for (const Node& node : ast.nodes) {
+                counts[static_cast<size_t>(node.kind)]++;
+            }
+            for (size_t i = 0; i < counts.size(); i++) {
+                count(node_kind_names[i], counts[i]);
+            }
+            count("ast.nodes", ast.nodes.size());
+            count("ast.bytes", ast.nodes.size() * sizeof(Node) + ast.lists.size() * sizeof(NodeId));
+        }
+
+        // Peak resident set size of this process in KiB.
+        [[nodiscard]] static inline uint64_t peak_rss_kb() {
+            rusage usage {};
+            getrusage(RUSAGE_SELF, &usage);
+            return static_cast<uint64_t>(usage.ru_maxrss);
+        }
+
+        inline void print_phases(std::ostream& out) const {
+            double wall = 0;
+            double cpu = 0;
+            out << "===== Pass timings =====\n";
+            out << std::left << std::setw(12) << "phase" << std::right << std::setw(12) << "wall ms" << std::setw(12) << "cpu ms" << '\n';
+            for (const Phase& phase : phases) {
+                out << std::left << std::setw(12) << phase.name << std::right << std::fixed << std::setprecision(3)
+                    << std::setw(12) << phase.wall * 1e3 << std::setw(12) << phase.cpu * 1e3 << '\n';
+                wall += phase.wall;
+                cpu += phase.cpu;
+            }
+            out << std::left << std::setw(12) << "total" << std::right << std::setw(12) << wall * 1e3 << std::setw(12) << cpu * 1e3 << '\n';
+            out.flags(std::ios::fmtflags {});
+        }
+
+        inline void print_counters(std::ostream& out) const {
+            out << "===== Statistics =====\n";
+            for (const Counter& counter : counters) {
+                out << std::left << std::setw(24) << counter.name << std::right << counter.value << '\n';
+            }
+            out.flags(std::ios::fmtflags {});
+        }
+
+        inline void write_json(std::ostream& out) const {
+            out << "{\n  \"phases\": [";
+            for (size_t i = 0; i < phases.size(); i++) {
+                out << (i ? ",\n" : "\n") << "    {\"name\": \"" << phases[i].name << "\", \"wall_ms\": "
+                    << phases[i].wall * 1e3 << ", \"cpu_ms\": " << phases[i].cpu * 1e3 << "}";
+            }
+            out << "\n  ],\n  \"counters\": {";
+            for (size_t i = 0; i < counters.size(); i++) {
+                out << (i ? ",\n" : "\n") << "    \"" << counters[i].name << "\": " << counters[i].value;
+            }
+            out << "\n  }\n}\n";
+        }
+
+    private:
+        // CPU time of this process plus any children it has waited for, so
+        // phases that run nasm or ld are charged for them.
+        static inline double cpu_seconds() {
+            timespec self {};
+            clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &self);
+            rusage children {};
+            getrusage(RUSAGE_CHILDREN, &children);
+            return static_cast<double>(self.tv_sec) + static_cast<double>(self.tv_nsec) * 1e-9
+                + static_cast<double>(children.ru_utime.tv_sec + children.ru_stime.tv_sec)
+                + static_cast<double>(children.ru_utime.tv_usec + children.ru_stime.tv_usec) * 1e-6;
+        }
+
+        static constexpr std::array<std::string_view, 15> node_kind_names {
+            "ast.term_int", "ast.term_ident", "ast.expr_add", "ast.expr_sub", "ast.expr_mult", "ast.expr_div",
+            "ast.stmt_ret", "ast.stmt_let", "ast.stmt_assign", "ast.scope", "ast.stmt_if", "ast.if_elif", "ast.if_else",
+            "ast.term_call", "ast.stmt_fn",
+        };
+
+        bool on;
+        std::vector<Phase> phases {};
+        std::vector<Counter> counters {};
+};
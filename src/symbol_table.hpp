@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Variables in scope during lowering, keyed by interned identifier id, each
+// with its current SSA value. A variable's slot is only trusted while it still
+// points at a live entry carrying the same id, which makes end_scope() a plain
+// truncation.
+class SymbolTable {
+    public:
+        struct Var {
+            uint32_t id;
+            uint32_t value;
+        };
+
+        [[nodiscard]] inline Var* lookup(uint32_t id) {
+            return const_cast<Var*>(std::as_const(*this).lookup(id));
+        }
+
+        [[nodiscard]] inline const Var* lookup(uint32_t id) const {
+            if (id >= slots.size()) {
+                return nullptr;
+            }
+            const uint32_t slot = slots[id];
+            if (slot >= vars.size() || vars[slot].id != id) {
+                return nullptr;
+            }
+            return &vars[slot];
+        }
+
+        // Returns false when `id` is already visible.
+        inline bool declare(uint32_t id, uint32_t value) {
+            if (lookup(id)) {
+                return false;
+            }
+            if (id >= slots.size()) {
+                slots.resize(id + 1, UINT32_MAX);
+            }
+            slots[id] = static_cast<uint32_t>(vars.size());
+            vars.push_back({ .id = id, .value = value });
+            return true;
+        }
+
+        inline void begin_scope() {
+            scopes.push_back(vars.size());
+        }
+
+        // Drops the innermost scope and returns how many variables it declared.
+        inline size_t end_scope() {
+            const size_t count = vars.size() - scopes.back();
+            vars.resize(scopes.back());
+            scopes.pop_back();
+            return count;
+        }
+
+        [[nodiscard]] inline size_t size() const {
+            return vars.size();
+        }
+
+    private:
+        std::vector<Var> vars;
+        std::vector<uint32_t> slots;
+        std::vector<size_t> scopes;
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size work-stealing pool. Each worker owns a deque: it takes its own
+// work from the back and, once that runs dry, steals from the front of the
+// others. Tasks receive the index of the worker running them so callers can
+// keep per-worker state without locking.
+class ThreadPool {
+    public:
+        using Task = std::function<void(size_t worker)>;
+
+        inline explicit ThreadPool(size_t threads = default_threads()) {
+            queues.reserve(threads);
+            for (size_t i = 0; i < threads; i++) {
+                queues.push_back(std::make_unique<Queue>());
+            }
+            workers.reserve(threads);
+            for (size_t i = 0; i < threads; i++) {
+                workers.emplace_back([this, i] { run(i); });
+            }
+        }
+
+        inline ThreadPool(const ThreadPool& other) = delete;
+        inline ThreadPool operator = (const ThreadPool& other) = delete;
+
+        inline ~ThreadPool() {
+            {
+                std::lock_guard lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (std::thread& worker : workers) {
+                worker.join();
+            }
+        }
+
+        [[nodiscard]] static inline size_t default_threads() {
+            const unsigned cores = std::thread::hardware_concurrency();
+            return cores > 0 ? cores : 1;
+        }
+
+        [[nodiscard]] inline size_t size() const {
+            return workers.size();
+        }
+
+        // Queues tasks round-robin over the workers' deques. The task is
+        // counted before any worker can see it, so finishing it never takes
+        // `pending` below zero, and it is queued under `mutex` so a worker
+        // about to sleep either sees it or gets the notification.
+        inline void submit(Task task) {
+            Queue& queue = *queues[next++ % queues.size()];
+            {
+                std::lock_guard lock(mutex);
+                pending++;
+                std::lock_guard queue_lock(queue.mutex);
+                queue.tasks.push_back(std::move(task));
+            }
+            wake.notify_one();
+        }
+
+        // Blocks until every submitted task has finished.
+        inline void wait() {
+            std::unique_lock lock(mutex);
+            done.wait(lock, [this] { return pending == 0; });
+        }
+
+    private:
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        inline bool pop(size_t worker, Task& task) {
+            {
+                Queue& own = *queues[worker];
+                std::lock_guard lock(own.mutex);
+                if (!own.tasks.empty()) {
+                    task = std::move(own.tasks.back());
+                    own.tasks.pop_back();
+                    return true;
+                }
+            }
+            for (size_t i = 1; i < queues.size(); i++) {
+                Queue& victim = *queues[(worker + i) % queues.size()];
+                std::lock_guard lock(victim.mutex);
+                if (!victim.tasks.empty()) {
+                    task = std::move(victim.tasks.front());
+                    victim.tasks.pop_front();
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        inline void run(size_t worker) {
+            while (true) {
+                Task task;
+                if (pop(worker, task)) {
+                    task(worker);
+                    std::lock_guard lock(mutex);
+                    if (--pending == 0) {
+                        done.notify_all();
+                    }
+                    continue;
+                }
+                std::unique_lock lock(mutex);
+                if (stopping && pending == 0) {
+                    return;
+                }
+                // A task may have been queued between pop() and taking the
+                // lock; waiting only while none are queued avoids missing it.
+                wake.wait(lock, [this] { return stopping || queued_unclaimed(); });
+                if (stopping && pending == 0) {
+                    return;
+                }
+            }
+        }
+
+        // Called with `mutex` held.
+        inline bool queued_unclaimed() {
+            for (const std::unique_ptr<Queue>& queue : queues) {
+                std::lock_guard lock(queue->mutex);
+                if (!queue->tasks.empty()) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        std::vector<std::unique_ptr<Queue>> queues;
+        std::vector<std::thread> workers;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        size_t pending = 0;
+        std::atomic<size_t> next = 0;
+        bool stopping = false;
+};
@@ -1,213 +1,310 @@
-#pragma once
-
-#include <iostream>
-#include <vector>
-#include <optional>
-
-enum class TokenType {
-    _return,
-    _int,
-    _semi,
-    _open_paren,
-    _close_paren,
-    _ident,
-    _let,
-    _eq,
-    _plus,
-    _mult,
-    _minus,
-    _fslash,
-    _open_curly,
-    _close_curly,
-    _if,
-    _elif,
-    _else
-};
-
-inline std::string token_to_string(TokenType type) {
-    switch(type) {
-        case TokenType::_return:
-            return "return";
-            break;
-        case TokenType::_int:
-            return "int";
-            break;
-        case TokenType::_semi:
-            return "`;`";
-            break;
-        case TokenType::_open_paren:
-            return "`(`";
-            break;
-        case TokenType::_close_paren:
-            return "`)`";
-            break;
-        case TokenType::_ident:
-            return "identifier";
-            break;
-        case TokenType::_let:
-            return "let";
-            break;
-        case TokenType::_eq:
-            return "`=`";
-            break;
-        case TokenType::_plus:
-            return "`+`";
-            break;
-        case TokenType::_mult:
-            return "`*`";
-            break;
-        case TokenType::_minus:
-            return "`-`";
-            break;
-        case TokenType::_fslash:
-            return "`/`";
-            break;
-        case TokenType::_close_curly:
-            return "`}`";
-            break;
-        case TokenType::_open_curly:
-            return "`{`";
-            break;
-        case TokenType::_if:
-            return "if";
-            break;
-        case TokenType::_elif:
-            return "elif";
-            break;
-        case TokenType::_else:
-            return "else";
-            break;
-        default:
-            return {};
-    }
-}
-
-std::optional<int> bin_prec(TokenType type) {
-    switch(type) {
-        case TokenType::_minus:
-        case TokenType::_plus:
-            return 0;
-        case TokenType::_fslash:
-        case TokenType::_mult:
-            return 1;
-        default:
-            return {};
-    };
-}
-
-struct Token {
-    TokenType type;
-    std::optional<std::string> value;
-    int line;
-};
-
-class Tokenizer {
-    public:
-        inline explicit Tokenizer(const std::string str) : src(std::move(str)) {}
-        
-        [[nodiscard]] inline std::vector<Token> tokenize() {
-            std::vector<Token> tokens;
-            std::string buff;
-            int line_count = 1;
-            while (peek().has_value()) {
-                if (peek().value() == '\n') {
-                    consume();
-                    line_count++;
-                } else if (std::isspace(peek().value())) {
-                    consume();
-                } else if (std::isalpha(peek().value())) {
-                    buff.push_back(consume());
-                    while (peek().has_value() && std::isalnum(peek().value())) {
-                        buff.push_back(consume());
-                    }
-                    if (buff == "return") {
-                        tokens.push_back({ .type = TokenType::_return, .line = line_count });
-                    } else if (buff == "let") {
-                        tokens.push_back({ .type = TokenType::_let, .line = line_count });
-                    } else if (buff == "if") {
-                        tokens.push_back({ .type = TokenType::_if, .line = line_count });
-                    } else if (buff == "elif") {
-                        tokens.push_back({ .type = TokenType::_elif, .line = line_count });
-                    } else if (buff == "else") {
-                        tokens.push_back({ .type = TokenType::_else, .line = line_count });
-                    } else {
-                        tokens.push_back({ .type = TokenType::_ident, .value = buff, .line = line_count });
-                    }
-                } else if (std::isdigit(peek().value())) {
-                    while (peek().has_value() && std::isdigit(peek().value())) {
-                        buff.push_back(consume());
-                    }
-                    tokens.push_back({ .type = TokenType::_int, .value = buff, .line = line_count });
-                } else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '/') {
-                    while (peek().has_value() && peek().value() != '\n') {
-                        consume();
-                    }
-                } else if (peek().value() == '/' && peek(1).has_value() && peek(1).value() == '*') {
-                    consume();
-                    consume();
-                    while (peek().has_value()) {
-                        if (peek().value() == '*' && peek(1).has_value() && peek(1).value() == '/') {
-                            break;
-                        }
-                        consume();
-                    }
-                    if (peek().has_value()) {
-                        consume();
-                    }
-                    if (peek().has_value()) {
-                        consume();
-                    }
-                } else if (peek().value() == '=') {
-                    consume();
-                    tokens.push_back({ .type = TokenType::_eq, .line = line_count });
-                } else if (peek().value() == ';') {
-                    consume();
-                    tokens.push_back({ .type = TokenType::_semi, .line = line_count });
-                } else if (peek().value() == '(') {
-                    consume();
-                    tokens.push_back({ .type = TokenType::_open_paren, .line = line_count });
-                } else if (peek().value() == ')') {
-                    consume();
-                    tokens.push_back({ .type = TokenType::_close_paren, .line = line_count });
-                } else if (peek().value() == '+') {
-                    consume();
-                    tokens.push_back({ .type = TokenType::_plus, .line = line_count });
-                } else if (peek().value() == '*') {
-                    consume();
-                    tokens.push_back({ .type = TokenType::_mult, .line = line_count });
-                } else if (peek().value() == '-') {
-                    consume();
-                    tokens.push_back({ .type = TokenType::_minus, .line = line_count });
-                } else if (peek().value() == '/') {
-                    consume();
-                    tokens.push_back({ .type = TokenType::_fslash, .line = line_count });
-                } else if (peek().value() == '{') {
-                    consume();
-                    tokens.push_back({ .type = TokenType::_open_curly, .line = line_count });
-                } else if (peek().value() == '}') {
-                    consume();
-                    tokens.push_back({ .type = TokenType::_close_curly, .line = line_count });
-                } else {
-                    std::cerr << "Token" << peek().value() << "is invalid" << "line " << line_count << std::endl;
-                    exit(EXIT_FAILURE); 
-                }
-                buff.clear();
-            }
-            index = 0;
-            return tokens;
-        };
-
-    private:
-        [[nodiscard]] inline std::optional<char> peek(int offset = 0) const {
-            if (index + offset >= src.length()) {
-                return {};
-            }
-            return src.at(index + offset);
-        }
-
-        inline char consume() {
-            return src.at(index++);
-        }
-        const std::string src;
-        size_t index = 0;
-};
+#pragma once
+
+#include <array>
+#include <iostream>
+#include <vector>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "./interner.hpp"
+#include "./error.hpp"
+#include "./scan.hpp"
+
+enum class TokenType {
+    _return,
+    _int,
+    _semi,
+    _open_paren,
+    _close_paren,
+    _ident,
+    _let,
+    _eq,
+    _plus,
+    _mult,
+    _minus,
+    _fslash,
+    _open_curly,
+    _close_curly,
+    _if,
+    _elif,
+    _else,
+    _fn,
+    _comma
+};
+
+inline std::string token_to_string(TokenType type) {
+    switch(type) {
+        case TokenType::_return:
+            return "return";
+            break;
+        case TokenType::_int:
+            return "int";
+            break;
+        case TokenType::_semi:
+            return "`;`";
+            break;
+        case TokenType::_open_paren:
+            return "`(`";
+            break;
+        case TokenType::_close_paren:
+            return "`)`";
+            break;
+        case TokenType::_ident:
+            return "identifier";
+            break;
+        case TokenType::_let:
+            return "let";
+            break;
+        case TokenType::_eq:
+            return "`=`";
+            break;
+        case TokenType::_plus:
+            return "`+`";
+            break;
+        case TokenType::_mult:
+            return "`*`";
+            break;
+        case TokenType::_minus:
+            return "`-`";
+            break;
+        case TokenType::_fslash:
+            return "`/`";
+            break;
+        case TokenType::_close_curly:
+            return "`}`";
+            break;
+        case TokenType::_open_curly:
+            return "`{`";
+            break;
+        case TokenType::_if:
+            return "if";
+            break;
+        case TokenType::_elif:
+            return "elif";
+            break;
+        case TokenType::_else:
+            return "else";
+            break;
+        case TokenType::_fn:
+            return "fn";
+            break;
+        case TokenType::_comma:
+            return "`,`";
+            break;
+        default:
+            return {};
+    }
+}
+
+inline std::optional<int> bin_prec(TokenType type) {
+    switch(type) {
+        case TokenType::_minus:
+        case TokenType::_plus:
+            return 0;
+        case TokenType::_fslash:
+        case TokenType::_mult:
+            return 1;
+        default:
+            return {};
+    };
+}
+
+// `value` views the lexeme inside the tokenizer's source buffer, `id` is the
+// interned name of an `_ident` token.
+struct Token {
+    TokenType type;
+    std::string_view value {};
+    int line = 0;
+    uint32_t id = 0;
+};
+
+namespace lex {
+
+struct Keyword {
+    std::string_view spelling;
+    TokenType type;
+};
+
+inline constexpr std::array<Keyword, 6> keywords {{
+    { "return", TokenType::_return },
+    { "let", TokenType::_let },
+    { "if", TokenType::_if },
+    { "elif", TokenType::_elif },
+    { "else", TokenType::_else },
+    { "fn", TokenType::_fn },
+}};
+
+// Perfect hash over `keywords`, checked for collisions at compile time.
+[[nodiscard]] constexpr size_t keyword_hash(std::string_view word) {
+    return (2 * static_cast<unsigned char>(word.front()) + static_cast<unsigned char>(word.back()) + word.size()) & 15;
+}
+
+inline constexpr std::array<std::optional<Keyword>, 16> keyword_table = [] {
+    std::array<std::optional<Keyword>, 16> table {};
+    for (const Keyword& keyword : keywords) {
+        if (table[keyword_hash(keyword.spelling)].has_value()) {
+            throw "keyword hash collision";
+        }
+        table[keyword_hash(keyword.spelling)] = keyword;
+    }
+    return table;
+}();
+
+[[nodiscard]] constexpr std::optional<TokenType> keyword(std::string_view word) {
+    if (word.size() < 2 || word.size() > 6) {
+        return {};
+    }
+    const std::optional<Keyword>& keyword = keyword_table[keyword_hash(word)];
+    if (keyword.has_value() && keyword->spelling == word) {
+        return keyword->type;
+    }
+    return {};
+}
+
+inline constexpr std::array<TokenType, 256> punct_type = [] {
+    std::array<TokenType, 256> table {};
+    table['='] = TokenType::_eq;
+    table[';'] = TokenType::_semi;
+    table['('] = TokenType::_open_paren;
+    table[')'] = TokenType::_close_paren;
+    table['+'] = TokenType::_plus;
+    table['*'] = TokenType::_mult;
+    table['-'] = TokenType::_minus;
+    table['/'] = TokenType::_fslash;
+    table['{'] = TokenType::_open_curly;
+    table['}'] = TokenType::_close_curly;
+    table[','] = TokenType::_comma;
+    return table;
+}();
+
+}
+
+class Tokenizer {
+    public:
+        // Lexes `source` in place. It must outlive the tokenizer and every
+        // token and AST name taken from it.
+        inline explicit Tokenizer(std::string_view source, scan::Kernels kernels = scan::best_kernels())
+            : src(source), kernels(kernels), cursor(src.data()), end(src.data() + src.size()) {}
+
+        // Takes ownership of a temporary source. Lvalue strings bind to the
+        // string_view constructor above and are not copied.
+        inline explicit Tokenizer(std::string&& str, scan::Kernels kernels = scan::best_kernels())
+            : owned(std::move(str)), src(owned), kernels(kernels), cursor(src.data()), end(src.data() + src.size()) {}
+
+        inline Tokenizer(const Tokenizer& other) = delete;
+        inline Tokenizer operator = (const Tokenizer& other) = delete;
+
+        // Lexes the next token on demand, returns an empty optional at end of input.
+        [[nodiscard]] inline std::optional<Token> next() {
+            const char* p = cursor;
+            while (p < end) {
+                const uint8_t cls = scan::classify(*p);
+                if (cls & (scan::cls_space | scan::cls_newline)) {
+                    p = kernels.skip_space(p, end, line_count);
+                } else if (cls & scan::cls_alpha) {
+                    const char* start = p;
+                    p = kernels.skip_ident(p + 1, end);
+                    cursor = p;
+                    const std::string_view word(start, p - start);
+                    if (std::optional<TokenType> type = lex::keyword(word)) {
+                        return Token { .type = type.value(), .line = line_count };
+                    }
+                    return Token { .type = TokenType::_ident, .value = word, .line = line_count, .id = names.intern(word) };
+                } else if (cls & scan::cls_digit) {
+                    const char* start = p;
+                    p = kernels.skip_digits(p + 1, end);
+                    cursor = p;
+                    return Token { .type = TokenType::_int, .value = std::string_view(start, p - start), .line = line_count };
+                } else if (*p == '/' && p + 1 < end && p[1] == '/') {
+                    p = kernels.find_byte(p + 2, end, '\n', line_count);
+                } else if (*p == '/' && p + 1 < end && p[1] == '*') {
+                    p += 2;
+                    while (true) {
+                        p = kernels.find_byte(p, end, '*', line_count);
+                        if (p == end) {
+                            break;
+                        }
+                        p++;
+                        if (p < end && *p == '/') {
+                            p++;
+                            break;
+                        }
+                    }
+                } else if (cls & scan::cls_punct) {
+                    cursor = p + 1;
+                    return Token { .type = lex::punct_type[static_cast<unsigned char>(*p)], .line = line_count };
+                } else {
+                    throw CompileError("Token " + std::string(1, *p) + " is invalid on line " + std::to_string(line_count),
+                                       static_cast<uint32_t>(line_count));
+                }
+            }
+            cursor = p;
+            return {};
+        }
+
+        [[nodiscard]] inline std::vector<Token> tokenize() {
+            std::vector<Token> tokens;
+            tokens.reserve(src.size() / 8);
+            while (std::optional<Token> token = next()) {
+                tokens.push_back(token.value());
+            }
+            return tokens;
+        };
+
+        [[nodiscard]] inline const Interner& interner() const {
+            return names;
+        }
+
+    private:
+        const std::string owned {};
+        const std::string_view src;
+        const scan::Kernels kernels;
+        const char* cursor;
+        const char* const end;
+        int line_count = 1;
+        Interner names;
+};
+
+// Pull-based view of a Tokenizer for the Parser. Only the previous token and
+// up to `lookahead` upcoming ones are ever held, whatever the input size.
+class TokenStream {
+    public:
+        static constexpr int lookahead = 3;
+
+        inline explicit TokenStream(Tokenizer& tokenizer) : tokenizer(tokenizer) {}
+
+        // `offset` ranges from -1 (the last consumed token) to lookahead - 1.
+        [[nodiscard]] inline const Token* peek(int offset = 0) {
+            if (offset < 0) {
+                return head > 0 ? &ring[(head - 1) & mask] : nullptr;
+            }
+            while (tail <= head + offset) {
+                std::optional<Token> token = tokenizer.next();
+                if (!token.has_value()) {
+                    return nullptr;
+                }
+                ring[tail++ & mask] = token.value();
+            }
+            return &ring[(head + offset) & mask];
+        }
+
+        inline const Token& consume() {
+            static_cast<void>(peek());
+            return ring[head++ & mask];
+        }
+
+        [[nodiscard]] inline size_t count() const {
+            return tail;
+        }
+
+    private:
+        static constexpr size_t capacity = 4;
+        static constexpr size_t mask = capacity - 1;
+        static_assert(lookahead + 1 <= capacity);
+
+        Tokenizer& tokenizer;
+        std::array<Token, capacity> ring {};
+        size_t head = 0;
+        size_t tail = 0;
+};